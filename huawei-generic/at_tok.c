@@ -19,6 +19,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdarg.h>
 
 /**
  * Starts tokenizing an AT response string.
@@ -250,3 +251,198 @@ int at_tok_charcounter(char *p_in, char needle, int *p_out)
     *p_out = num_found;
     return 0;
 }
+
+#define AT_PARSE_ERROR(reason, field) (-((field) << 8 | (reason)))
+
+/**
+ * Finds the next field of an AT response line without modifying it.
+ * Quotes are left out of the field. Returns 0 on success and -1 if a
+ * quoted string isn't terminated.
+ * Updates *p_cur to the start of the next field, or NULL if there is none.
+ */
+static int nextField(const char **p_cur, const char **p_start, size_t *p_len)
+{
+    const char *p = *p_cur;
+
+    while (*p != '\0' && isspace(*p))
+        p++;
+
+    if (*p == '"') {
+        const char *start = ++p;
+
+        while (*p != '"') {
+            if (*p == '\0')
+                return -1;
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            p++;
+        }
+        *p_start = start;
+        *p_len = p - start;
+        p += strcspn(p, ",");
+    } else {
+        *p_start = p;
+        *p_len = strcspn(p, ",");
+        p += *p_len;
+    }
+
+    *p_cur = *p == ',' ? p + 1 : NULL;
+    return 0;
+}
+
+static int fieldToInt(const char *start, size_t len, int base, int *p_out)
+{
+    char *end;
+    long l;
+
+    if (base == 16)
+        l = strtoul(start, &end, base);
+    else
+        l = strtol(start, &end, base);
+
+    if (end == start || end > start + len)
+        return -1;
+
+    *p_out = (int)l;
+    return 0;
+}
+
+/**
+ * Parses an AT response line in one go, without modifying it.
+ * The line must start with prefix, or, if prefix is NULL, with anything
+ * up to a colon. Each character of format then takes one field:
+ *   i    decimal integer, stored in an int *
+ *   h    hexadecimal integer, stored in an int *
+ *   b    boolean (0 or 1), stored in a char *
+ *   s    string, copied to a char * buffer of the size_t size that follows
+ *   *    field is skipped
+ * Commas in format are ignored, and fields after a '[' are optional.
+ * Fields beyond the format are ignored.
+ *
+ * Returns the number of fields stored or skipped, or a negative error
+ * (see AT_PARSE_REASON() and AT_PARSE_FIELD()). Fields before the
+ * failing one are stored.
+ */
+int at_parse(const char *line, const char *prefix, const char *format, ...)
+{
+    const char *p;
+    int optional = 0;
+    int field = 0;
+    int ret = 0;
+    va_list ap;
+
+    if (line == NULL)
+        return AT_PARSE_ERROR(AT_PARSE_EPREFIX, 0);
+
+    if (prefix != NULL) {
+        size_t len = strlen(prefix);
+
+        if (strncmp(line, prefix, len) != 0)
+            return AT_PARSE_ERROR(AT_PARSE_EPREFIX, 0);
+        p = line + len;
+    } else {
+        p = strchr(line, ':');
+        if (p == NULL)
+            return AT_PARSE_ERROR(AT_PARSE_EPREFIX, 0);
+        p++;
+    }
+
+    /* An empty line has no fields at all, rather than an empty one. */
+    while (*p != '\0' && isspace(*p))
+        p++;
+    if (*p == '\0')
+        p = NULL;
+
+    va_start(ap, format);
+
+    for (; *format != '\0'; format++) {
+        const char *start;
+        size_t len;
+
+        if (*format == ',')
+            continue;
+        if (*format == '[') {
+            optional = 1;
+            continue;
+        }
+
+        if (p == NULL) {
+            if (!optional)
+                ret = AT_PARSE_ERROR(AT_PARSE_EMISSING, field);
+            break;
+        }
+
+        if (nextField(&p, &start, &len) < 0) {
+            ret = AT_PARSE_ERROR(AT_PARSE_EBADFIELD, field);
+            break;
+        }
+
+        switch (*format) {
+        case 'i':
+        case 'h':
+            if (fieldToInt(start, len, *format == 'h' ? 16 : 10,
+                           va_arg(ap, int *)) < 0)
+                ret = AT_PARSE_ERROR(AT_PARSE_EBADFIELD, field);
+            break;
+
+        case 'b': {
+            char *p_out = va_arg(ap, char *);
+            int value;
+
+            if (fieldToInt(start, len, 10, &value) < 0 ||
+                !(value == 0 || value == 1))
+                ret = AT_PARSE_ERROR(AT_PARSE_EBADFIELD, field);
+            else
+                *p_out = (char)value;
+            break;
+        }
+
+        case 's': {
+            char *p_out = va_arg(ap, char *);
+            size_t size = va_arg(ap, size_t);
+
+            if (len >= size) {
+                ret = AT_PARSE_ERROR(AT_PARSE_ETOOLONG, field);
+            } else {
+                memcpy(p_out, start, len);
+                p_out[len] = '\0';
+            }
+            break;
+        }
+
+        case '*':
+            break;
+
+        default:
+            ret = AT_PARSE_ERROR(AT_PARSE_EFORMAT, field);
+            break;
+        }
+
+        if (ret < 0)
+            break;
+        field++;
+    }
+
+    va_end(ap);
+
+    return ret < 0 ? ret : field;
+}
+
+/** Describes why at_parse() failed. */
+const char *at_parse_strerror(int err)
+{
+    switch (AT_PARSE_REASON(err)) {
+    case AT_PARSE_EPREFIX:
+        return "unexpected prefix";
+    case AT_PARSE_EMISSING:
+        return "missing field";
+    case AT_PARSE_EBADFIELD:
+        return "malformed field";
+    case AT_PARSE_ETOOLONG:
+        return "field too long";
+    case AT_PARSE_EFORMAT:
+        return "bad format";
+    default:
+        return "no error";
+    }
+}
@@ -28,4 +28,20 @@ int at_tok_nextstr(char **p_cur, char **out);
 int at_tok_hasmore(char **p_cur);
 
 int at_tok_charcounter(char *p_in, char needle, int *p_out);
+
+/*
+ * at_parse() reasons for failing. The error returned is negative and
+ * also holds the (0 based) field where parsing stopped.
+ */
+#define AT_PARSE_EPREFIX    1   /* Line doesn't start with the prefix */
+#define AT_PARSE_EMISSING   2   /* Line ended before a required field */
+#define AT_PARSE_EBADFIELD  3   /* Field isn't of the expected type */
+#define AT_PARSE_ETOOLONG   4   /* String doesn't fit the buffer given */
+#define AT_PARSE_EFORMAT    5   /* Unknown conversion in the format */
+
+#define AT_PARSE_REASON(err) ((-(err)) & 0xff)
+#define AT_PARSE_FIELD(err) ((-(err)) >> 8)
+
+int at_parse(const char *line, const char *prefix, const char *format, ...);
+const char *at_parse_strerror(int err);
 #endif
@@ -44,10 +44,14 @@
 #include "misc.h"
 
 #define MAX_AT_RESPONSE (8 * 1024)
+#define MAX_AT_LINE (64 * 1024)  /* Longer lines are dropped */
+#define AT_ARENA_SIZE 2048       /* Bytes kept with each response for its lines */
+#define AT_ARENA_POOL_SIZE 8     /* Responses kept around for reuse */
 #define HANDSHAKE_RETRY_COUNT 8
 #define HANDSHAKE_TIMEOUT_MSEC 250
 #define DEFAULT_AT_TIMEOUT_MSEC (3 * 60 * 1000)
 #define BUFFSIZE 512
+#define AT_BATCH_MAX_LINE 256    /* Longest command line a batch is chained into */
 
 struct atcontext {
     pthread_t tid_reader;
@@ -56,9 +60,16 @@ struct atcontext {
     int isInitialized;
     ATUnsolHandler unsolHandler;
 
-    /* For input buffering. */
-    char ATBuffer[MAX_AT_RESPONSE+1];
-    char *ATBufferCur;
+    /*
+     * For input buffering. Lines are handed out in place, so the data not
+     * read yet lies between ATBufferStart and ATBufferEnd. The buffer
+     * starts at MAX_AT_RESPONSE bytes and grows for longer lines.
+     */
+    char *ATBuffer;
+    size_t ATBufferSize;
+    size_t ATBufferStart;
+    size_t ATBufferEnd;
+    int ATDiscarding;       /* Dropping the rest of a line too long */
 
     int readCount;
 
@@ -78,11 +89,20 @@ struct atcontext {
     const char *smsPDU;
     ATResponse *response;
 
+    /* Commands chained on the pending command line, see at_send_batch(). */
+    ATBatchCommand *batch;
+    int batchCurrent;
+    int batchEnd;
+
     void (*onTimeout)(void);
     void (*onReaderClosed)(void);
     int readerClosed;
+    void *channelData;      /* For the callbacks, see at_set_channel_data() */
 
     int timeoutMsec;
+
+    /* For formatting commands, protected by commandmutex. */
+    char strbuf[BUFFSIZE];
 };
 
 static struct atcontext *s_defaultAtContext = NULL;
@@ -118,6 +138,7 @@ static void ac_free(void)
     struct atcontext *ac = NULL;
     (void) pthread_once(&key_once, make_key);
     if ((ac = (struct atcontext *) pthread_getspecific(key)) != NULL) {
+        free(ac->ATBuffer);
         free(ac);
         LOGD("%s() freed current thread AT context", __func__);
     } else {
@@ -149,7 +170,13 @@ static int initializeAtContext(void)
         ac->fd = -1;
         ac->readerCmdFds[0] = -1;
         ac->readerCmdFds[1] = -1;
-        ac->ATBufferCur = ac->ATBuffer;
+
+        ac->ATBufferSize = MAX_AT_RESPONSE;
+        ac->ATBuffer = (char *) malloc(ac->ATBufferSize + 1);
+        if (ac->ATBuffer == NULL) {
+            LOGE("%s() Failed to allocate memory", __func__);
+            goto error;
+        }
 
         if (pipe(ac->readerCmdFds)) {
             LOGE("%s() Failed to create pipe: %s", __func__, strerror(errno));
@@ -175,6 +202,8 @@ static int initializeAtContext(void)
 
 error:
     LOGE("%s() Failed initializing new AT Context!", __func__);
+    if (ac != NULL)
+        free(ac->ATBuffer);
     free(ac);
     return -1;
 }
@@ -250,26 +279,120 @@ static void sleepMsec(long long msec)
 
 
 
-/** Add an intermediate response to sp_response. */
-static void addIntermediate(const char *line)
+/*
+ * A response, its lines and their text are allocated from one arena, and
+ * freed at once. Arenas come with AT_ARENA_SIZE bytes, which is plenty for
+ * most responses; longer ones get extra blocks. Released arenas go back
+ * to a pool, so the usual commands don't allocate memory at all.
+ */
+struct atblock {
+    struct atblock *next;
+    size_t size;
+    size_t used;
+    /* Followed by size bytes */
+};
+
+struct atarena {
+    ATResponse response;        /* Must be first */
+    ATLine **tail;              /* Where to link the next line */
+    struct atblock *blocks;     /* Extra blocks, latest first */
+    struct atarena *nextFree;   /* In the pool */
+    struct atblock first;
+    /* Followed by AT_ARENA_SIZE bytes */
+};
+
+static struct atarena *s_arenaPool = NULL;
+static int s_arenaPoolCount = 0;
+static pthread_mutex_t s_arenaPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *arenaAlloc(struct atarena *arena, size_t size)
+{
+    struct atblock *b = arena->blocks != NULL ? arena->blocks : &arena->first;
+    void *p;
+
+    /* Keep the line structures aligned. */
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (b->size - b->used < size) {
+        size_t blockSize = size > AT_ARENA_SIZE ? size : AT_ARENA_SIZE;
+
+        b = (struct atblock *) malloc(sizeof(struct atblock) + blockSize);
+        if (b == NULL)
+            return NULL;
+        b->size = blockSize;
+        b->used = 0;
+        b->next = arena->blocks;
+        arena->blocks = b;
+    }
+
+    p = (char *) (b + 1) + b->used;
+    b->used += size;
+    return p;
+}
+
+static char *arenaStrdup(struct atarena *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = (char *) arenaAlloc(arena, len);
+
+    if (p != NULL)
+        memcpy(p, s, len);
+    return p;
+}
+
+static ATResponse *at_response_new(void)
+{
+    struct atarena *arena;
+
+    pthread_mutex_lock(&s_arenaPoolMutex);
+    arena = s_arenaPool;
+    if (arena != NULL) {
+        s_arenaPool = arena->nextFree;
+        s_arenaPoolCount--;
+    }
+    pthread_mutex_unlock(&s_arenaPoolMutex);
+
+    if (arena == NULL) {
+        arena = (struct atarena *) malloc(sizeof(struct atarena) + AT_ARENA_SIZE);
+        if (arena == NULL)
+            return NULL;
+        arena->first.size = AT_ARENA_SIZE;
+    }
+
+    memset(&arena->response, 0, sizeof(ATResponse));
+    arena->tail = &arena->response.p_intermediates;
+    arena->blocks = NULL;
+    arena->nextFree = NULL;
+    arena->first.next = NULL;
+    arena->first.used = 0;
+
+    return &arena->response;
+}
+
+/** Add an intermediate response to p_response. */
+static void addIntermediate(ATResponse *p_response, const char *line)
 {
     ATLine *p_new;
-    struct atcontext *ac = getAtContext();
+    struct atarena *arena = (struct atarena *) p_response;
 
-    p_new = (ATLine  *) malloc(sizeof(ATLine));
+    p_new = (ATLine  *) arenaAlloc(arena, sizeof(ATLine));
+    if (p_new != NULL)
+        p_new->line = arenaStrdup(arena, line);
 
-    p_new->line = strdup(line);
+    if (p_new == NULL || p_new->line == NULL) {
+        LOGE("%s() Failed to allocate memory, dropping line", __func__);
+        return;
+    }
 
-    /* Note: This adds to the head of the list, so the list will
-       be in reverse order of lines received. the order is flipped
-       again before passing on to the command issuer. */
-    p_new->p_next = ac->response->p_intermediates;
-    ac->response->p_intermediates = p_new;
+    /* Lines are kept in the order they were received. */
+    p_new->p_next = NULL;
+    *arena->tail = p_new;
+    arena->tail = &p_new->p_next;
 }
 
 
 /**
- * Returns 1 if line is a final response indicating error.
+ * Final responses indicating error.
  * See 27.007 annex B.
  * WARNING: NO CARRIER and others are sometimes unsolicited.
  */
@@ -282,21 +405,8 @@ static const char * s_finalResponsesError[] = {
     "NO DIALTONE",
 };
 
-static int isFinalResponseError(const char *line)
-{
-    size_t i;
-
-    for (i = 0 ; i < NUM_ELEMS(s_finalResponsesError) ; i++) {
-        if (strStartsWith(line, s_finalResponsesError[i])) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
 /**
- * Returns 1 if line is a final response indicating success.
+ * Final responses indicating success.
  * See 27.007 annex B.
  * WARNING: NO CARRIER and others are sometimes unsolicited.
  */
@@ -304,39 +414,52 @@ static const char * s_finalResponsesSuccess[] = {
     "OK",
     "CONNECT"       /* Some stacks start up data on another channel. */
 };
-static int isFinalResponseSuccess(const char *line)
-{
-    size_t i;
-
-    for (i = 0 ; i < NUM_ELEMS(s_finalResponsesSuccess) ; i++) {
-        if (strStartsWith(line, s_finalResponsesSuccess[i])) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
 
 /**
- * Returns 1 if line is the first line in (what will be) a two-line
- * SMS unsolicited response.
+ * First lines in (what will be) two-line SMS unsolicited responses.
  */
 static const char * s_smsUnsoliciteds[] = {
     "+CMT:",
     "+CDS:",
     "+CBM:"
 };
-static int isSMSUnsolicited(const char *line)
+
+/* Kinds of lines told apart by their prefix, from the tables above */
+enum {
+    LINE_OTHER = -1,
+    LINE_SUCCESS,
+    LINE_ERROR,
+    LINE_SMS
+};
+
+static struct prefixtable s_linePrefixes = PREFIX_TABLE_INIT;
+static pthread_once_t s_linePrefixesOnce = PTHREAD_ONCE_INIT;
+
+static void addLinePrefixes(const char **prefixes, size_t count, int kind)
 {
     size_t i;
 
-    for (i = 0 ; i < NUM_ELEMS(s_smsUnsoliciteds) ; i++) {
-        if (strStartsWith(line, s_smsUnsoliciteds[i])) {
-            return 1;
-        }
+    for (i = 0; i < count; i++) {
+        if (prefixTableAdd(&s_linePrefixes, prefixes[i], kind) < 0)
+            LOGE("%s() Failed to add prefix %s", __func__, prefixes[i]);
     }
+}
 
-    return 0;
+static void initLinePrefixes(void)
+{
+    addLinePrefixes(s_finalResponsesSuccess,
+                    NUM_ELEMS(s_finalResponsesSuccess), LINE_SUCCESS);
+    addLinePrefixes(s_finalResponsesError,
+                    NUM_ELEMS(s_finalResponsesError), LINE_ERROR);
+    addLinePrefixes(s_smsUnsoliciteds,
+                    NUM_ELEMS(s_smsUnsoliciteds), LINE_SMS);
+}
+
+/** Returns the kind of line, LINE_OTHER for anything not in the tables. */
+static int getLineKind(const char *line)
+{
+    (void) pthread_once(&s_linePrefixesOnce, initLinePrefixes);
+    return prefixTableFind(&s_linePrefixes, line);
 }
 
 
@@ -345,7 +468,7 @@ static void handleFinalResponse(const char *line)
 {
     struct atcontext *ac = getAtContext();
 
-    ac->response->finalResponse = strdup(line);
+    ac->response->finalResponse = arenaStrdup((struct atarena *) ac->response, line);
 
     pthread_cond_signal(&ac->commandcond);
 }
@@ -359,7 +482,49 @@ static void handleUnsolicited(const char *line)
     }
 }
 
-static void processLine(const char *line)
+/**
+ * Hand a line of chained commands to the first command, from the one
+ * answering now on, that expects it. Commands answer in order.
+ */
+static void handleBatchLine(const char *line)
+{
+    struct atcontext *ac = getAtContext();
+    int i;
+
+    for (i = ac->batchCurrent; i < ac->batchEnd; i++) {
+        ATBatchCommand *c = &ac->batch[i];
+        int match;
+
+        if (c->response == NULL)
+            continue;
+
+        switch (c->type) {
+        case NUMERIC:
+            match = c->response->p_intermediates == NULL && isdigit(line[0]);
+            break;
+        case SINGLELINE:
+            match = c->response->p_intermediates == NULL
+                    && strStartsWith(line, c->responsePrefix);
+            break;
+        case MULTILINE:
+            match = strStartsWith(line, c->responsePrefix);
+            break;
+        default:
+            match = 0;
+            break;
+        }
+
+        if (match) {
+            ac->batchCurrent = i;
+            addIntermediate(c->response, line);
+            return;
+        }
+    }
+
+    handleUnsolicited(line);
+}
+
+static void processLine(const char *line, int kind)
 {
     struct atcontext *ac = getAtContext();
     pthread_mutex_lock(&ac->commandmutex);
@@ -367,10 +532,10 @@ static void processLine(const char *line)
     if (ac->response == NULL) {
         /* No command pending. */
         handleUnsolicited(line);
-    } else if (isFinalResponseSuccess(line)) {
+    } else if (kind == LINE_SUCCESS) {
         ac->response->success = 1;
         handleFinalResponse(line);
-    } else if (isFinalResponseError(line)) {
+    } else if (kind == LINE_ERROR) {
         ac->response->success = 0;
         handleFinalResponse(line);
     } else if (ac->smsPDU != NULL && 0 == strcmp(line, "> ")) {
@@ -378,6 +543,8 @@ static void processLine(const char *line)
            Commands like AT+CMGS have a "> " prompt. */
         writeCtrlZ(ac->smsPDU);
         ac->smsPDU = NULL;
+    } else if (ac->batch != NULL) {
+        handleBatchLine(line);
     } else switch (ac->type) {
         case NO_RESULT:
             handleUnsolicited(line);
@@ -385,7 +552,7 @@ static void processLine(const char *line)
         case NUMERIC:
             if (ac->response->p_intermediates == NULL
                 && isdigit(line[0])) {
-                addIntermediate(line);
+                addIntermediate(ac->response, line);
             } else {
                 /* Either we already have an intermediate response or
                    the line doesn't begin with a digit. */
@@ -395,7 +562,7 @@ static void processLine(const char *line)
         case SINGLELINE:
             if (ac->response->p_intermediates == NULL
                 && strStartsWith (line, ac->responsePrefix)) {
-                addIntermediate(line);
+                addIntermediate(ac->response, line);
             } else {
                 /* We already have an intermediate response. */
                 handleUnsolicited(line);
@@ -403,7 +570,7 @@ static void processLine(const char *line)
             break;
         case MULTILINE:
             if (strStartsWith (line, ac->responsePrefix)) {
-                addIntermediate(line);
+                addIntermediate(ac->response, line);
             } else {
                 handleUnsolicited(line);
             }
@@ -420,24 +587,63 @@ static void processLine(const char *line)
 
 
 /**
- * Returns a pointer to the end of the next line,
+ * Returns a pointer to the end of the next line in the len bytes at cur,
  * special-cases the "> " SMS prompt.
  *
  * returns NULL if there is no complete line.
  */
-static char * findNextEOL(char *cur)
+static char * findNextEOL(char *cur, size_t len)
 {
-    if (cur[0] == '>' && cur[1] == ' ' && cur[2] == '\0') {
+    char *cr, *lf;
+
+    if (len == 2 && cur[0] == '>' && cur[1] == ' ') {
         /* SMS prompt character...not \r terminated */
         return cur+2;
     }
 
     /* Find next newline */
-    while (*cur != '\0' && *cur != '\r' && *cur != '\n') cur++;
+    cr = (char *) memchr(cur, '\r', len);
+    lf = (char *) memchr(cur, '\n', cr != NULL ? (size_t) (cr - cur) : len);
 
-    return *cur == '\0' ? NULL : cur;
+    return lf != NULL ? lf : cr;
 }
 
+/**
+ * Makes room for at least one more byte to be read after the data in
+ * the buffer: moves the data not read yet to the start of the buffer,
+ * or grows the buffer if that data fills it. Drops it if that would
+ * take more than MAX_AT_LINE.
+ */
+static void makeRoom(struct atcontext *ac)
+{
+    size_t len = ac->ATBufferEnd - ac->ATBufferStart;
+
+    if (ac->ATBufferEnd < ac->ATBufferSize)
+        return;
+
+    if (ac->ATBufferStart > 0) {
+        memmove(ac->ATBuffer, ac->ATBuffer + ac->ATBufferStart, len);
+        ac->ATBufferStart = 0;
+        ac->ATBufferEnd = len;
+        return;
+    }
+
+    if (ac->ATBufferSize * 2 <= MAX_AT_LINE) {
+        char *buffer = (char *) realloc(ac->ATBuffer, ac->ATBufferSize * 2 + 1);
+
+        if (buffer != NULL) {
+            ac->ATBuffer = buffer;
+            ac->ATBufferSize *= 2;
+            return;
+        }
+    }
+
+    LOGE("%s() ERROR: Input line exceeded %u bytes, dropping it",
+        __func__, (unsigned) ac->ATBufferSize);
+    ac->ATBufferStart = 0;
+    ac->ATBufferEnd = 0;
+    ac->ATDiscarding = 1;
+}
 
 /**
  * Reads a line from the AT channel, returns NULL on timeout.
@@ -453,59 +659,43 @@ static const char *readline(void)
 {
     ssize_t count;
 
-    char *p_read = NULL;
+    char *p_cur = NULL;
     char *p_eol = NULL;
     char *ret = NULL;
 
     struct atcontext *ac = getAtContext();
-    read(ac->fd,NULL,0);
 
-    /* This is a little odd. I use *s_ATBufferCur == 0 to mean
-     * "buffer consumed completely". If it points to a character,
-     * then the buffer continues until a \0.
-     */
-    if (*ac->ATBufferCur == '\0') {
-        /* Empty buffer. */
-        ac->ATBufferCur = ac->ATBuffer;
-        *ac->ATBufferCur = '\0';
-        p_read = ac->ATBuffer;
-    } else {   /* *s_ATBufferCur != '\0' */
-        /* There's data in the buffer from the last read. */
+    for (;;) {
+        int err;
+        struct pollfd pfds[2];
 
         /* skip over leading newlines */
-        while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
-            ac->ATBufferCur++;
-
-        p_eol = findNextEOL(ac->ATBufferCur);
-
-        if (p_eol == NULL) {
-            /* A partial line. Move it up and prepare to read more. */
-            size_t len;
-
-            len = strlen(ac->ATBufferCur);
+        while (ac->ATBufferStart < ac->ATBufferEnd &&
+               (ac->ATBuffer[ac->ATBufferStart] == '\r' ||
+                ac->ATBuffer[ac->ATBufferStart] == '\n'))
+            ac->ATBufferStart++;
+
+        if (ac->ATBufferStart == ac->ATBufferEnd) {
+            /* Empty buffer. */
+            ac->ATBufferStart = 0;
+            ac->ATBufferEnd = 0;
+        } else {
+            p_cur = ac->ATBuffer + ac->ATBufferStart;
+            p_eol = findNextEOL(p_cur, ac->ATBufferEnd - ac->ATBufferStart);
+
+            if (p_eol != NULL && ac->ATDiscarding) {
+                /* The end of a line too long to keep. */
+                ac->ATBufferStart = p_eol - ac->ATBuffer;
+                ac->ATDiscarding = 0;
+                p_eol = NULL;
+                continue;
+            }
 
-            memmove(ac->ATBuffer, ac->ATBufferCur, len + 1);
-            p_read = ac->ATBuffer + len;
-            ac->ATBufferCur = ac->ATBuffer;
+            if (p_eol != NULL)
+                break;
         }
-        /* Otherwise, (p_eol !- NULL) there is a complete line 
-           that will be returned from the while () loop below. */
-    }
-
-    while (p_eol == NULL) {
-        int err;
-        struct pollfd pfds[2];
 
-        /* This condition should be synchronized with the read function call
-         * size argument below.
-         */
-        if (0 >= MAX_AT_RESPONSE - (p_read - ac->ATBuffer) - 2) {
-            LOGE("%s() ERROR: Input line exceeded buffer", __func__);
-            /* Ditch buffer and start over again. */
-            ac->ATBufferCur = ac->ATBuffer;
-            *ac->ATBufferCur = '\0';
-            p_read = ac->ATBuffer;
-        }
+        makeRoom(ac);
 
         /* If our fd is invalid, we are probably closed. Return. */
         if (ac->fd < 0)
@@ -541,31 +731,15 @@ static const char *readline(void)
             continue;
 
         do
-            /* The size argument should be synchronized to the ditch buffer
-             * condition above.
-             */
-            count = read(ac->fd, p_read,
-                         MAX_AT_RESPONSE - (p_read - ac->ATBuffer) - 2);
+            count = read(ac->fd, ac->ATBuffer + ac->ATBufferEnd,
+                         ac->ATBufferSize - ac->ATBufferEnd);
 
         while (count < 0 && errno == EINTR);
 
         if (count > 0) {
-            AT_DUMP( "<< ", p_read, count );
+            AT_DUMP( "<< ", ac->ATBuffer + ac->ATBufferEnd, count );
             ac->readCount += count;
-
-            /* Implementation requires extra EOS or EOL to get it right if
-             * there are no trailing newlines in the read buffer. Adding extra
-             * EOS does not harm even if there actually were trailing EOLs.
-             */
-            p_read[count] = '\0';
-            p_read[count+1] = '\0';
-
-            /* Skip over leading newlines. */
-            while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
-                ac->ATBufferCur++;
-
-            p_eol = findNextEOL(ac->ATBufferCur);
-            p_read += count;
+            ac->ATBufferEnd += count;
         } else if (count <= 0) {
             /* Read error encountered or EOF reached. */
             if (count == 0)
@@ -577,16 +751,17 @@ static const char *readline(void)
         }
     }
 
-    /* A full line in the buffer. Place a \0 over the \r and return. */
+    /* A full line in the buffer. Place a \0 over the \r and return.
+     * The buffer has a spare byte past its size for the \0 ending
+     * the SMS prompt.
+     */
 
-    ret = ac->ATBufferCur;
+    ret = p_cur;
     *p_eol = '\0';
 
-    /* The extra EOS added after read takes care of the case when there is no
-     * valid data after p_eol.
-     */
-    ac->ATBufferCur = p_eol + 1;     /* This will always be <= p_read,    
-                                        and there will be a \0 at *p_read. */
+    ac->ATBufferStart = p_eol - ac->ATBuffer;
+    if (ac->ATBufferStart < ac->ATBufferEnd)
+        ac->ATBufferStart++;
 
     LOGI("AT(%d)< %s", ac->fd, ret);
     return ret;
@@ -620,13 +795,15 @@ static void *readerLoop(void *arg)
 
     for (;;) {
         const char * line;
+        int kind;
 
         line = readline();
 
         if (line == NULL)
             break;
 
-        if(isSMSUnsolicited(line)) {
+        kind = getLineKind(line);
+        if (kind == LINE_SMS) {
             char *line1;
             const char *line2;
 
@@ -646,7 +823,7 @@ static void *readerLoop(void *arg)
 
             free(line1);
         } else
-            processLine(line);
+            processLine(line, kind);
         }
 
     onReaderClosed();
@@ -751,6 +928,7 @@ static void clearPendingCommand(void)
     ac->response = NULL;
     ac->responsePrefix = NULL;
     ac->smsPDU = NULL;
+    ac->batch = NULL;
     }
 
 static AT_Error merror(int type, int error)
@@ -784,7 +962,7 @@ static AT_Error at_get_error(const ATResponse *p_response)
     if (p_response->finalResponse == NULL)
         return AT_ERROR_INVALID_RESPONSE;
 
-    if (isFinalResponseSuccess(p_response->finalResponse))
+    if (getLineKind(p_response->finalResponse) == LINE_SUCCESS)
         return AT_NOERROR;
 
     p_cur = p_response->finalResponse;
@@ -832,6 +1010,9 @@ int at_open(int fd, ATUnsolHandler h)
 
     ac->fd = fd;
     ac->isInitialized = 1;
+    ac->ATBufferStart = 0;
+    ac->ATBufferEnd = 0;
+    ac->ATDiscarding = 0;
     ac->unsolHandler = h;
     ac->readerClosed = 0;
 
@@ -879,50 +1060,28 @@ void at_close(void)
     write(ac->readerCmdFds[1], "x", 1);
 }
 
-static ATResponse *at_response_new(void)
-{
-    return (ATResponse *) calloc(1, sizeof(ATResponse));
-}
-
 void at_response_free(ATResponse *p_response)
 {
-    ATLine *p_line;
+    struct atarena *arena = (struct atarena *) p_response;
+    struct atblock *b;
 
     if (p_response == NULL) return;
 
-    p_line = p_response->p_intermediates;
-
-    while (p_line != NULL) {
-        ATLine *p_toFree;
-
-        p_toFree = p_line;
-        p_line = p_line->p_next;
-
-        free(p_toFree->line);
-        free(p_toFree);
+    while ((b = arena->blocks) != NULL) {
+        arena->blocks = b->next;
+        free(b);
     }
 
-    free (p_response->finalResponse);
-    free (p_response);
-}
-
-/**
- * The line reader places the intermediate responses in reverse order,
- * here we flip them back.
- */
-static void reverseIntermediates(ATResponse *p_response)
-{
-    ATLine *pcur,*pnext;
-
-    pcur = p_response->p_intermediates;
-    p_response->p_intermediates = NULL;
-
-    while (pcur != NULL) {
-        pnext = pcur->p_next;
-        pcur->p_next = p_response->p_intermediates;
-        p_response->p_intermediates = pcur;
-        pcur = pnext;
+    pthread_mutex_lock(&s_arenaPoolMutex);
+    if (s_arenaPoolCount < AT_ARENA_POOL_SIZE) {
+        arena->nextFree = s_arenaPool;
+        s_arenaPool = arena;
+        s_arenaPoolCount++;
+        arena = NULL;
     }
+    pthread_mutex_unlock(&s_arenaPoolMutex);
+
+    free(arena);
 }
 
 /**
@@ -985,11 +1144,8 @@ static int at_send_command_full_nolock (const char *command, ATCommandType type,
 
     if (pp_outResponse == NULL)
         at_response_free(ac->response);
-    else {
-        /* Line reader stores intermediate responses in reverse order. */
-        reverseIntermediates(ac->response);
+    else
         *pp_outResponse = ac->response;
-    }
 
     ac->response = NULL;
 
@@ -1019,7 +1175,6 @@ static int at_send_command_full (const char *command, ATCommandType type,
     int err;
 
     struct atcontext *ac = getAtContext();
-    static char strbuf[BUFFSIZE];
     const char *ptr;
 
     if (0 != pthread_equal(ac->tid_reader, pthread_self()))
@@ -1028,11 +1183,11 @@ static int at_send_command_full (const char *command, ATCommandType type,
 
     pthread_mutex_lock(&ac->commandmutex);
     if (useap) {
-        if (!vsnprintf(strbuf, BUFFSIZE, command, ap)) {
+        if (!vsnprintf(ac->strbuf, BUFFSIZE, command, ap)) {
            pthread_mutex_unlock(&ac->commandmutex);
            return AT_ERROR_STRING_CREATION;
     }
-        ptr = strbuf;
+        ptr = ac->strbuf;
     } else
         ptr = command;
 
@@ -1224,6 +1379,176 @@ int at_send_command_multiline (const char *command,
     return -err;
 }
 
+/**
+ * Checks the outcome of a command of a batch, like the at_send_command_*()
+ * functions do, and frees the response on error.
+ */
+static void finishBatchCommand(ATBatchCommand *c, int err)
+{
+    if (err == AT_NOERROR && (c->type == SINGLELINE || c->type == NUMERIC)
+            && c->response != NULL && c->response->p_intermediates == NULL)
+        /* Command with a response must have an intermediate response */
+        err = AT_ERROR_INVALID_RESPONSE;
+
+    if (err != AT_NOERROR) {
+        at_response_free(c->response);
+        c->response = NULL;
+        LOGI(" --- %s", at_str_err(-err));
+    }
+
+    c->err = -err;
+}
+
+/**
+ * Chains as many commands as fit, from first on, into one command line.
+ * Dialing and commands chained already are sent on their own.
+ * Returns the index after the last command chained.
+ */
+static int chainBatch(char *buf, const ATBatchCommand *commands,
+                      int first, int count)
+{
+    size_t len = 0;
+    int i;
+
+    for (i = first; i < count; i++) {
+        const char *cmd = commands[i].command;
+        size_t n;
+
+        if (strncasecmp(cmd, "AT", 2) != 0 || cmd[2] == '\0'
+                || toupper(cmd[2]) == 'D' || strchr(cmd, ';') != NULL)
+            break;
+
+        cmd += 2;
+        n = strlen(cmd);
+        if (len + n + 3 > AT_BATCH_MAX_LINE)
+            break;
+
+        if (i == first) {
+            memcpy(buf, "AT", 2);
+            len = 2;
+        } else
+            buf[len++] = ';';
+        memcpy(buf + len, cmd, n);
+        len += n;
+    }
+
+    buf[len] = '\0';
+    return i;
+}
+
+/**
+ * Issue several commands, chained on as few command lines as possible
+ * ("AT+CGACT?;+CGDCONT?"), so that they complete in one round trip. The
+ * intermediate responses are handed to the command that expects them.
+ *
+ * If a chained line fails, its commands are sent again one at a time, so
+ * that each gets its own result.
+ *
+ * Sets response (except for NO_RESULT commands, free it with
+ * at_response_free()) and err of each command. Returns AT_NOERROR if all
+ * of them succeeded, else the first error.
+ */
+int at_send_batch(ATBatchCommand *commands, int count)
+{
+    struct atcontext *ac = getAtContext();
+    ATResponse *p_response = NULL;
+    int first, last, i;
+    int err;
+
+    for (i = 0; i < count; i++) {
+        commands[i].response = NULL;
+        commands[i].err = AT_NOERROR;
+    }
+
+    if (0 != pthread_equal(ac->tid_reader, pthread_self())) {
+        /* Cannot be called from reader thread. */
+        for (i = 0; i < count; i++)
+            commands[i].err = -AT_ERROR_INVALID_THREAD;
+        return -AT_ERROR_INVALID_THREAD;
+    }
+
+    for (first = 0; first < count; first = last) {
+        pthread_mutex_lock(&ac->commandmutex);
+
+        last = chainBatch(ac->strbuf, commands, first, count);
+        if (last - first < 2) {
+            pthread_mutex_unlock(&ac->commandmutex);
+            last = first + 1;
+            goto one_by_one;
+        }
+
+        err = AT_NOERROR;
+        for (i = first; i < last; i++) {
+            if (commands[i].type == NO_RESULT)
+                continue;
+            commands[i].response = at_response_new();
+            if (commands[i].response == NULL)
+                err = AT_ERROR_MEMORY_ALLOCATION;
+        }
+
+        if (err == AT_NOERROR) {
+            ac->batch = commands;
+            ac->batchCurrent = first;
+            ac->batchEnd = last;
+
+            err = at_send_command_full_nolock(ac->strbuf, NO_RESULT, NULL,
+                        NULL, ac->timeoutMsec, &p_response);
+            ac->batch = NULL;
+        }
+
+        pthread_mutex_unlock(&ac->commandmutex);
+
+        if (err == AT_NOERROR) {
+            for (i = first; i < last; i++) {
+                ATResponse *r = commands[i].response;
+
+                if (r != NULL) {
+                    r->success = 1;
+                    r->finalResponse = arenaStrdup((struct atarena *) r,
+                                                   p_response->finalResponse);
+                }
+                finishBatchCommand(&commands[i], AT_NOERROR);
+            }
+            at_response_free(p_response);
+            p_response = NULL;
+            continue;
+        }
+
+        at_response_free(p_response);
+        p_response = NULL;
+        for (i = first; i < last; i++) {
+            at_response_free(commands[i].response);
+            commands[i].response = NULL;
+        }
+
+        if (err == AT_ERROR_TIMEOUT || err == AT_ERROR_CHANNEL_CLOSED) {
+            for (i = first; i < last; i++)
+                commands[i].err = -err;
+            LOGI(" --- %s", at_str_err(-err));
+
+            if (err == AT_ERROR_TIMEOUT && ac->onTimeout != NULL)
+                ac->onTimeout();
+            continue;
+        }
+
+one_by_one:
+        for (i = first; i < last; i++) {
+            ATBatchCommand *c = &commands[i];
+
+            err = at_send_command_full(c->command, c->type, c->responsePrefix,
+                        NULL, ac->timeoutMsec,
+                        c->type == NO_RESULT ? NULL : &c->response, 0, empty);
+            finishBatchCommand(c, err);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        if (commands[i].err != AT_NOERROR)
+            return commands[i].err;
+
+    return AT_NOERROR;
+}
+
 /**
  * Set the default timeout. Let it be reasonably high, some commands
  * take their time. Default is 10 minutes.
@@ -1257,6 +1582,24 @@ void at_set_on_reader_closed(void (*onClose)(void))
     ac->onReaderClosed = onClose;
 }
 
+/**
+ * Data the callbacks can get back with at_get_channel_data(), to tell
+ * which channel they are called for.
+ */
+void at_set_channel_data(void *data)
+{
+    struct atcontext *ac = getAtContext();
+
+    ac->channelData = data;
+}
+
+void *at_get_channel_data(void)
+{
+    struct atcontext *ac = getAtContext();
+
+    return ac->channelData;
+}
+
 
 /**
  * Periodically issue an AT command and wait for a response.
@@ -65,6 +65,15 @@ typedef struct {
     ATLine  *p_intermediates; /* Any intermediate responses. */
 } ATResponse;
 
+/** A command of a batch, see at_send_batch(). */
+typedef struct {
+    const char *command;        /* Eg "AT+CGACT?", not formatted */
+    ATCommandType type;
+    const char *responsePrefix; /* For SINGLELINE and MULTILINE */
+    ATResponse *response;       /* Set by at_send_batch() */
+    int err;                    /* Set by at_send_batch() */
+} ATBatchCommand;
+
 /**
  * A user-provided unsolicited response handler function.
  * This will be called from the reader thread, so do not block.
@@ -96,6 +105,13 @@ void at_set_on_timeout(void (*onTimeout)(void));
  */
 void at_set_on_reader_closed(void (*onClose)(void));
 
+/*
+ * Data for the callbacks above, which get it with at_get_channel_data()
+ * on the reader or command thread of the channel.
+ */
+void at_set_channel_data(void *data);
+void *at_get_channel_data(void);
+
 void at_send_escape(void);
 
 int at_send_command_singleline (const char *command,
@@ -123,6 +139,8 @@ int at_send_command (const char *command, ...);
  */
 int at_send_command_raw (const char *command, ATResponse **pp_outResponse);
 
+int at_send_batch (ATBatchCommand *commands, int count);
+
 int at_send_command_sms (const char *command, const char *pdu,
                             const char *responsePrefix,
                             ATResponse **pp_outResponse);
@@ -133,6 +133,13 @@ Regards, Phil.
         : (a).tv_sec op (b).tv_sec)
 
 #define TIMEOUT_SEARCH_FOR_TTY 5 /* Poll every Xs for the port*/
+#define REQUEST_AGING_MSEC 2000 /* Requests waiting longer than this go first */
+#define MAX_STATS_LINES 64
+#define URC_SETTLE_MSEC 500 /* Default quiet time before a refresh wanted by URCs */
+#define URC_SETTLE_MAX_WINDOWS 4 /* Longest a refresh is put off, in settle windows */
+
+/* First string of an OEM_HOOK_STRINGS request asking for statistics */
+#define OEM_HOOK_STATS "RILSTATS"
 #define TIMEOUT_EMRDY 10 /* Module should respond at least within 10s */
 #define MAX_BUF 1024
 
@@ -189,22 +196,63 @@ typedef struct RILRequest {
     void *data;
     size_t datalen;
     RIL_Token token;
+    struct timespec queued;
     struct RILRequest *next;
 } RILRequest;
 
+/* Requests are served by priority, then in order of arrival */
+typedef enum {
+    PRIORITY_URGENT,    /* Call control, including emergency calls */
+    PRIORITY_HIGH,      /* SMS */
+    PRIORITY_NORMAL,    /* Everything else */
+    PRIORITY_LOW,       /* Periodic polls from the framework */
+    PRIORITY_COUNT
+} RequestPriority;
+
+typedef struct RequestList {
+    RILRequest *head;
+    RILRequest *tail;
+} RequestList;
+
+typedef struct RequestStats {
+    unsigned int depth;         /* Requests waiting */
+    unsigned int maxDepth;
+    unsigned long served;
+    unsigned long aged;         /* Served ahead of higher priorities */
+    long long totalWaitMsec;
+    long long maxWaitMsec;
+} RequestStats;
+
 typedef struct RILEvent {
     void (*eventCallback) (void *param);
     void *param;
     struct timespec abstime;
-    struct RILEvent *next;
-    struct RILEvent *prev;
+    unsigned long seq;              /* Order of arrival */
+    unsigned int index;             /* Position in the heap */
+    struct RILEvent *hashNext;
+    char settle;                    /* Put off while triggers keep coming */
+    struct timespec firstQueued;
 } RILEvent;
 
+#define EVENT_HASH_SIZE 32
+
 typedef struct RequestQueue {
     pthread_mutex_t queueMutex;
     pthread_cond_t cond;
-    RILRequest *requestList;
-    RILEvent *eventList;
+    RequestList requests[PRIORITY_COUNT];
+    RequestStats stats[PRIORITY_COUNT];
+
+    /* Pending events, as a binary heap with the earliest one first, and
+       hashed by callback and parameter to find the duplicates */
+    RILEvent **events;
+    unsigned int eventCount;
+    unsigned int eventSize;
+    unsigned long eventSeq;
+    RILEvent *eventHash[EVENT_HASH_SIZE];
+    unsigned long eventsMerged;     /* Duplicates not queued */
+    unsigned long settleTriggers;   /* Events queued to settle */
+    unsigned long settleRuns;       /* Settled events run */
+
     char enabled;
     char closed;
 } RequestQueue;
@@ -212,15 +260,151 @@ typedef struct RequestQueue {
 static RequestQueue s_requestQueue = {
     PTHREAD_MUTEX_INITIALIZER,
     PTHREAD_COND_INITIALIZER,
+    { { NULL, NULL } },
+    { { 0, 0, 0, 0, 0, 0 } },
     NULL,
-    NULL,
+    0,
+    0,
+    0,
+    { NULL },
+    0,
+    0,
+    0,
     1,
     1
 };
 
-static RequestQueue *s_requestQueues[] = {
+/* Quiet time before a refresh wanted by URCs is run, set with -s */
+static long s_settleMsec = URC_SETTLE_MSEC;
+
+static const char * const s_priorityNames[PRIORITY_COUNT] = {
+    "urgent",
+    "high",
+    "normal",
+    "low"
+};
+
+static long long msecBetween(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000LL +
+           (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+/** Append a request to its list. Assumes the queue mutex is held. */
+static void queueRequest(RequestQueue *q, RILRequest *r, RequestPriority priority)
+{
+    RequestList *list = &q->requests[priority];
+    RequestStats *stats = &q->stats[priority];
+
+    r->next = NULL;
+    if (list->tail == NULL)
+        list->head = r;
+    else
+        list->tail->next = r;
+    list->tail = r;
+
+    if (++stats->depth > stats->maxDepth)
+        stats->maxDepth = stats->depth;
+}
+
+static int hasRequests(const RequestQueue *q)
+{
+    int i;
+
+    for (i = 0; i < PRIORITY_COUNT; i++) {
+        if (q->requests[i].head != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Take the next request to serve, NULL if there is none. That is the
+ * first one of the highest priority, unless a request of lower priority
+ * has waited for more than REQUEST_AGING_MSEC, in which case the one
+ * that waited the longest goes first. Assumes the queue mutex is held.
+ */
+static RILRequest *dequeueRequest(RequestQueue *q)
+{
+    struct timespec now;
+    RILRequest *r;
+    long long wait;
+    int pick = -1;
+    int aged = -1;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < PRIORITY_COUNT; i++) {
+        r = q->requests[i].head;
+        if (r == NULL)
+            continue;
+
+        if (pick < 0)
+            pick = i;
+        else if (msecBetween(&r->queued, &now) >= REQUEST_AGING_MSEC &&
+                 (aged < 0 || timespec_cmp(r->queued,
+                                  q->requests[aged].head->queued, < )))
+            aged = i;
+    }
+
+    if (pick < 0)
+        return NULL;
+
+    if (aged >= 0 && timespec_cmp(q->requests[aged].head->queued,
+                                  q->requests[pick].head->queued, < )) {
+        pick = aged;
+        q->stats[pick].aged++;
+    }
+
+    r = q->requests[pick].head;
+    q->requests[pick].head = r->next;
+    if (r->next == NULL)
+        q->requests[pick].tail = NULL;
+    r->next = NULL;
+
+    wait = msecBetween(&r->queued, &now);
+    q->stats[pick].depth--;
+    q->stats[pick].served++;
+    q->stats[pick].totalWaitMsec += wait;
+    if (wait > q->stats[pick].maxWaitMsec)
+        q->stats[pick].maxWaitMsec = wait;
+
+    return r;
+}
+
+/*
+ * Request classes. Each class can be given its own AT channel on another
+ * port of the modem, so a slow command in one class doesn't hold back the
+ * requests of the others. Classes without a channel of their own, and all
+ * the events, are served by the primary channel.
+ */
+typedef enum {
+    CHANNEL_DEFAULT,    /* Everything else */
+    CHANNEL_CALL,       /* Call control */
+    CHANNEL_SMS,        /* Sending and storing SMS */
+    CHANNEL_DATA,       /* Packet data calls */
+    CHANNEL_SLOW,       /* Network scans and supplementary service queries */
+    CHANNEL_CLASS_COUNT
+} ChannelClass;
+
+#define MAX_CHANNELS CHANNEL_CLASS_COUNT
+
+static const char * const s_channelClassNames[CHANNEL_CLASS_COUNT] = {
+    "default",
+    "call",
+    "sms",
+    "data",
+    "slow"
+};
+
+static RequestQueue *s_requestQueues[MAX_CHANNELS] = {
     &s_requestQueue
 };
+static unsigned int s_requestQueueCount = 1;
+
+/* Queue serving each class, NULL for the primary one */
+static RequestQueue *s_classQueues[CHANNEL_CLASS_COUNT] = { NULL };
 
 /* The Audio channel */
 static struct GsmAudioTunnel sAudioChannel = GSM_AUDIO_CHANNEL_STATIC_INIT;
@@ -298,16 +482,192 @@ static void stopAudioTunnel(void)
 	D("Audio Tunnel disabled");
 }
 
+/* True if event a is due before event b */
+static int eventBefore(const RILEvent *a, const RILEvent *b)
+{
+    if (a->abstime.tv_sec != b->abstime.tv_sec ||
+        a->abstime.tv_nsec != b->abstime.tv_nsec)
+        return timespec_cmp(a->abstime, b->abstime, < );
+    return a->seq < b->seq;
+}
+
+static void setEvent(RequestQueue *q, unsigned int i, RILEvent *e)
+{
+    q->events[i] = e;
+    e->index = i;
+}
+
+static void eventSiftUp(RequestQueue *q, unsigned int i)
+{
+    RILEvent *e = q->events[i];
+
+    while (i > 0 && eventBefore(e, q->events[(i - 1) / 2])) {
+        setEvent(q, i, q->events[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    setEvent(q, i, e);
+}
+
+static void eventSiftDown(RequestQueue *q, unsigned int i)
+{
+    RILEvent *e = q->events[i];
+    unsigned int child;
+
+    while ((child = 2 * i + 1) < q->eventCount) {
+        if (child + 1 < q->eventCount &&
+            eventBefore(q->events[child + 1], q->events[child]))
+            child++;
+        if (!eventBefore(q->events[child], e))
+            break;
+        setEvent(q, i, q->events[child]);
+        i = child;
+    }
+    setEvent(q, i, e);
+}
+
+static unsigned int eventHash(void (*callback) (void *param), void *param)
+{
+    unsigned long h = (unsigned long) callback ^ ((unsigned long) param * 31);
+
+    return (h ^ (h >> 4) ^ (h >> 12)) % EVENT_HASH_SIZE;
+}
+
+/** Find a pending event. Assumes the queue mutex is held. */
+static RILEvent *findEvent(RequestQueue *q, void (*callback) (void *param),
+                           void *param)
+{
+    RILEvent *e = q->eventHash[eventHash(callback, param)];
+
+    while (e != NULL && (e->eventCallback != callback || e->param != param))
+        e = e->hashNext;
+    return e;
+}
+
+/** Add an event to the heap. Assumes the queue mutex is held. */
+static int pushEvent(RequestQueue *q, RILEvent *e)
+{
+    unsigned int h;
+
+    if (q->eventCount == q->eventSize) {
+        unsigned int size = q->eventSize ? q->eventSize * 2 : 16;
+        RILEvent **events = (RILEvent **) realloc(q->events,
+                                                  size * sizeof(RILEvent *));
+        if (events == NULL)
+            return -1;
+        q->events = events;
+        q->eventSize = size;
+    }
+
+    e->seq = q->eventSeq++;
+    setEvent(q, q->eventCount++, e);
+    eventSiftUp(q, e->index);
+
+    h = eventHash(e->eventCallback, e->param);
+    e->hashNext = q->eventHash[h];
+    q->eventHash[h] = e;
+    return 0;
+}
+
+/** Take the earliest event off the heap. Assumes the queue mutex is held. */
+static RILEvent *popEvent(RequestQueue *q)
+{
+    RILEvent *e = q->events[0];
+    RILEvent **p = &q->eventHash[eventHash(e->eventCallback, e->param)];
+
+    while (*p != e)
+        p = &(*p)->hashNext;
+    *p = e->hashNext;
+
+    if (--q->eventCount > 0) {
+        setEvent(q, 0, q->events[q->eventCount]);
+        eventSiftDown(q, 0);
+    }
+
+    if (e->settle)
+        q->settleRuns++;
+    return e;
+}
+
+static void addMsec(struct timespec *ts, long msec)
+{
+    ts->tv_sec += msec / 1000;
+    ts->tv_nsec += (msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/**
+ * Queue a refresh wanted by an unsolicited response. URCs come in bursts,
+ * on a handover for instance, so the refresh is run once the modem has
+ * been quiet for the settle window, though never more than
+ * URC_SETTLE_MAX_WINDOWS of them after the first trigger.
+ */
+static void settleRILEvent(void (*callback) (void *param), void *param)
+{
+    RequestQueue *q = &s_requestQueue;
+    struct timespec now, due, latest;
+    RILEvent *pending;
+    int err;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    due = now;
+    addMsec(&due, s_settleMsec);
+
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+
+    q->settleTriggers++;
+    pending = findEvent(q, callback, param);
+    if (pending != NULL) {
+        /* Only put off what is already settling; anything else was
+           asked for explicitly and runs at its own time. */
+        if (pending->settle) {
+            latest = pending->firstQueued;
+            addMsec(&latest, s_settleMsec * URC_SETTLE_MAX_WINDOWS);
+            pending->abstime = timespec_cmp(due, latest, < ) ? due : latest;
+            eventSiftUp(q, pending->index);
+            eventSiftDown(q, pending->index);
+        }
+    } else {
+        RILEvent *e = (RILEvent *) malloc(sizeof(RILEvent));
+        memset(e, 0, sizeof(RILEvent));
+
+        e->eventCallback = callback;
+        e->param = param;
+        e->abstime = due;
+        e->firstQueued = now;
+        e->settle = 1;
+
+        if (pushEvent(q, e) < 0) {
+            LOGE("%s() failed to allocate memory, dropping event", __func__);
+            free(e);
+        }
+    }
+
+    if ((err = pthread_cond_broadcast(&q->cond)) != 0)
+        LOGE("%s() failed to take broadcast queue update: %s!",
+            __func__, strerror(err));
+
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s!",
+            __func__, strerror(err));
+}
+
 /**
  * Enqueue a RILEvent to the request queue.
+ *
+ * If the same callback is already pending with the same parameter, it
+ * is run only once, at the earliest of the two times.
  */
 static void enqueueRILEvent(void (*callback) (void *param),
                      void *param, const struct timespec *relativeTime)
 {
     int err;
     struct timespec ts;
-    char done = 0;
     RequestQueue *q = NULL;
+    RILEvent *pending;
 
     RILEvent *e = (RILEvent *) malloc(sizeof(RILEvent));
     memset(e, 0, sizeof(RILEvent));
@@ -325,41 +685,27 @@ static void enqueueRILEvent(void (*callback) (void *param),
     e->abstime.tv_sec = ts.tv_sec + relativeTime->tv_sec;
     e->abstime.tv_nsec = ts.tv_nsec + relativeTime->tv_nsec;
 
-    if (e->abstime.tv_nsec > 1000000000) {
+    if (e->abstime.tv_nsec >= 1000000000) {
         e->abstime.tv_sec++;
         e->abstime.tv_nsec -= 1000000000;
     }
 
     q = &s_requestQueue;
 
-again:
     if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
         LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
 
-    if (q->eventList == NULL)
-        q->eventList = e;
-    else {
-        if (timespec_cmp(q->eventList->abstime, e->abstime, > )) {
-            e->next = q->eventList;
-            q->eventList->prev = e;
-            q->eventList = e;
-        } else {
-            RILEvent *tmp = q->eventList;
-            do {
-                if (timespec_cmp(tmp->abstime, e->abstime, > )) {
-                    tmp->prev->next = e;
-                    e->prev = tmp->prev;
-                    tmp->prev = e;
-                    e->next = tmp;
-                    break;
-                } else if (tmp->next == NULL) {
-                    tmp->next = e;
-                    e->prev = tmp;
-                    break;
-                }
-                tmp = tmp->next;
-            } while (tmp);
+    pending = findEvent(q, callback, param);
+    if (pending != NULL) {
+        if (timespec_cmp(e->abstime, pending->abstime, < )) {
+            pending->abstime = e->abstime;
+            eventSiftUp(q, pending->index);
         }
+        q->eventsMerged++;
+        free(e);
+    } else if (pushEvent(q, e) < 0) {
+        LOGE("%s() failed to allocate memory, dropping event", __func__);
+        free(e);
     }
 
     if ((err = pthread_cond_broadcast(&q->cond)) != 0)
@@ -456,7 +802,89 @@ static const char *radioStateToString(RIL_RadioState radioState)
 
     return state;
 }
-  
+
+/*
+ * Identity values that can't change as long as the modem and the SIM stay
+ * the same, so that the framework's frequent queries don't need the AT
+ * channel. The IMSI is forgotten whenever the SIM may have changed, all of
+ * them when the modem is reset or the channel is lost.
+ */
+typedef enum {
+    IDENTITY_IMSI,
+    IDENTITY_IMEI,
+    IDENTITY_BASEBAND,
+    IDENTITY_COUNT
+} IdentityItem;
+
+static char *s_identity[IDENTITY_COUNT];
+static unsigned long s_identityHits;
+static unsigned long s_identityMisses;
+static unsigned long s_identityFlushes;
+static pthread_mutex_t s_identity_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Returns a copy of a cached value, to be freed, or NULL if unknown. */
+static char *getIdentity(IdentityItem item)
+{
+    char *value = NULL;
+
+    pthread_mutex_lock(&s_identity_mutex);
+    if (s_identity[item] != NULL) {
+        value = strdup(s_identity[item]);
+        s_identityHits++;
+    } else
+        s_identityMisses++;
+    pthread_mutex_unlock(&s_identity_mutex);
+
+    return value;
+}
+
+static void setIdentity(IdentityItem item, const char *value)
+{
+    char *copy = strdup(value);
+
+    pthread_mutex_lock(&s_identity_mutex);
+    free(s_identity[item]);
+    s_identity[item] = copy;
+    pthread_mutex_unlock(&s_identity_mutex);
+}
+
+/** Forget the IMSI, or all values unless simOnly. */
+static void flushIdentity(int simOnly)
+{
+    int i;
+    int flushed = 0;
+
+    pthread_mutex_lock(&s_identity_mutex);
+    for (i = 0; i < (simOnly ? IDENTITY_IMSI + 1 : IDENTITY_COUNT); i++) {
+        if (s_identity[i] != NULL) {
+            free(s_identity[i]);
+            s_identity[i] = NULL;
+            flushed = 1;
+        }
+    }
+    s_identityFlushes += flushed;
+    pthread_mutex_unlock(&s_identity_mutex);
+}
+
+static int getIdentityStats(char **lines, int max)
+{
+    unsigned long hits, misses, flushes;
+
+    if (max < 1)
+        return 0;
+
+    pthread_mutex_lock(&s_identity_mutex);
+    hits = s_identityHits;
+    misses = s_identityMisses;
+    flushes = s_identityFlushes;
+    pthread_mutex_unlock(&s_identity_mutex);
+
+    if (asprintf(&lines[0], "identity cache: hits %lu misses %lu flushes %lu",
+                 hits, misses, flushes) < 0)
+        return 0;
+    return 1;
+}
+
 
 /**
  * Synchronous call from the RIL to us to return current radio state.
@@ -486,6 +914,15 @@ static void setRadioState(RIL_RadioState newState)
     if ((err = pthread_mutex_unlock(&s_state_mutex)) != 0)
         LOGE("%s() failed to release state mutex: %s!", __func__, strerror(err));
 
+    /*
+     * The SIM may be swapped while it is away, and the modem (or the one
+     * on the port, once the channel closes) while it is unavailable.
+     */
+    if (newState == RADIO_STATE_UNAVAILABLE)
+        flushIdentity(0);
+    else if (newState == RADIO_STATE_SIM_LOCKED_OR_ABSENT)
+        flushIdentity(1);
+
     /* Do these outside of the mutex. */
     if (sState != oldState || sState == RADIO_STATE_SIM_LOCKED_OR_ABSENT) {
         RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED,
@@ -555,6 +992,7 @@ static SIM_Status getSIMStatus(void)
         switch (at_get_cme_error(err)) {
         case CME_SIM_NOT_INSERTED:
             ret = SIM_ABSENT;
+            flushIdentity(1);
             break;
         case CME_SIM_PIN_REQUIRED:
             ret = SIM_PIN;
@@ -736,65 +1174,45 @@ static int clccStateToRILState(int state, RIL_CallState *p_state)
 	}
 }
 
+#define CLCC_NUMBER_SIZE 64
+
 /**
- * Note: directly modified line and has *p_call point directly into
- * modified line
+ * Note: *p_call number points to the number buffer, which must hold
+ * CLCC_NUMBER_SIZE bytes
  */
-static int callFromCLCCLine(char *line, RIL_Call *p_call)
+static int callFromCLCCLine(const char *line, RIL_Call *p_call, char *number)
 {
 	//+CLCC: 1,0,2,0,0,\"+18005551212\",145
 	//     index,isMT,state,mode,isMpty(,number,TOA)?
 
-	int err;
+	int fields;
 	int state;
 	int mode;
 
-	err = at_tok_start(&line);
-	if (err < 0) goto error;
-
-	err = at_tok_nextint(&line, &(p_call->index));
-	if (err < 0) goto error;
-
-	err = at_tok_nextbool(&line, &(p_call->isMT));
-	if (err < 0) goto error;
-
-	err = at_tok_nextint(&line, &state);
-	if (err < 0) goto error;
+	fields = at_parse(line, "+CLCC:", "i,b,i,i,b[,s,i", &p_call->index,
+			&p_call->isMT, &state, &mode, &p_call->isMpty,
+			number, (size_t) CLCC_NUMBER_SIZE, &p_call->toa);
 
-	err = clccStateToRILState(state, &(p_call->state));
-	if (err < 0) goto error;
+	/* tolerate null number here */
+	if (fields < 0 && AT_PARSE_FIELD(fields) != 5) {
+		LOGE("invalid CLCC line: %s at field %d\n",
+			 at_parse_strerror(fields), AT_PARSE_FIELD(fields));
+		return -1;
+	}
 
-	err = at_tok_nextint(&line, &mode);
-	if (err < 0) goto error;
+	if (clccStateToRILState(state, &(p_call->state)) < 0)
+		return -1;
 
 	p_call->isVoice = (mode == 0);
 
-	err = at_tok_nextbool(&line, &(p_call->isMpty));
-	if (err < 0) goto error;
-
-	if (at_tok_hasmore(&line)) {
-		err = at_tok_nextstr(&line, &(p_call->number));
-
-		/* tolerate null here */
-		if (err < 0) return 0;
-
-		// Some lame implementations return strings
-		// like "NOT AVAILABLE" in the CLCC line
-		if (p_call->number != NULL
-				&& 0 == strspn(p_call->number, "+0123456789")
-		   ) {
-			p_call->number = NULL;
-		}
-
-		err = at_tok_nextint(&line, &p_call->toa);
-		if (err < 0) goto error;
-	}
+	// Some lame implementations return strings
+	// like "NOT AVAILABLE" in the CLCC line
+	if (fields >= 6 && 0 != strspn(number, "+0123456789"))
+		p_call->number = number;
+	else
+		p_call->number = NULL;
 
 	return 0;
-
-error:
-	LOGE("invalid CLCC line\n");
-	return -1;
 }
 
 static const struct timespec TIMEVAL_CALLSTATEPOLL = {0,500000};
@@ -807,6 +1225,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 	int countCalls;
 	RIL_Call *p_calls;
 	RIL_Call **pp_calls;
+	char *numbers;
 	int i;
 	char status[1];
 	int needRepoll = 0;
@@ -837,6 +1256,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 	pp_calls = (RIL_Call **)alloca(countCalls * sizeof(RIL_Call *));
 	p_calls = (RIL_Call *)alloca(countCalls * sizeof(RIL_Call));
 	memset (p_calls, 0, countCalls * sizeof(RIL_Call));
+	numbers = (char *)alloca(countCalls * CLCC_NUMBER_SIZE);
 
 	/* init the pointer array */
 	for(i = 0; i < countCalls ; i++) {
@@ -847,7 +1267,8 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 			; p_cur != NULL
 			; p_cur = p_cur->p_next
 	    ) {
-		err = callFromCLCCLine(p_cur->line, p_calls + countValidCalls);
+		err = callFromCLCCLine(p_cur->line, p_calls + countValidCalls,
+				numbers + countValidCalls * CLCC_NUMBER_SIZE);
 
 		if (err != 0) {
 			continue;
@@ -1168,23 +1589,31 @@ static void requestOrSendPDPContextList(RIL_Token *t)
     ATResponse *atResponse = NULL;
 	ATLine *p_cur;
    	RIL_Data_Call_Response_v6 *responses = NULL;
+	ATBatchCommand batch[] = {
+		{ "AT+CGACT?", MULTILINE, "+CGACT:", NULL, 0 },
+		{ "AT+CGDCONT?", MULTILINE, "+CGDCONT:", NULL, 0 }
+	};
 
     int err;
 	int fd;
     char *line, *out;
 	int i,n = 0;
 
-	err = at_send_command_multiline ("AT+CGACT?", "+CGACT:", &atResponse);
-	if (err != AT_NOERROR) {
+	/* Both lists in one round trip */
+	at_send_batch(batch, sizeof(batch) / sizeof(batch[0]));
+
+	if (batch[0].err != AT_NOERROR) {
 		if (t != NULL)
 			RIL_onRequestComplete(*t, RIL_E_GENERIC_FAILURE, NULL, 0);
 		else
 			RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED, NULL, 0);
 
-		at_response_free(atResponse); 
+		at_response_free(batch[1].response);
 		return;
 	}
 
+	atResponse = batch[0].response;
+
 	for (p_cur = atResponse->p_intermediates; p_cur != NULL;
 			p_cur = p_cur->p_next)
 		n++;
@@ -1226,9 +1655,10 @@ static void requestOrSendPDPContextList(RIL_Token *t)
 
 	at_response_free(atResponse);
 
-    err = at_send_command_multiline("AT+CGDCONT?", "+CGDCONT:", &atResponse);
-    if (err != AT_NOERROR)
-        goto error;
+	atResponse = batch[1].response;
+	batch[1].response = NULL;
+	if (batch[1].err != AT_NOERROR)
+		goto error;
 
 	for (p_cur = atResponse->p_intermediates; p_cur != NULL;
 		p_cur = p_cur->p_next) {
@@ -1300,6 +1730,7 @@ error:
         RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED, NULL, 0);
 
     at_response_free(atResponse); 
+    at_response_free(batch[1].response);
 }
 
 /**
@@ -3662,7 +4093,7 @@ static void requestRegistrationState(RIL_Token t)
     ATResponse *cgreg_resp = NULL;
     char *line;
     int commas = 0;
-    int skip, cs_status = 0;
+    int cs_status = 0;
     int i;
 
     /* Setting default values in case values are not returned by AT command */
@@ -3677,10 +4108,6 @@ static void requestRegistrationState(RIL_Token t)
 
     line = cgreg_resp->p_intermediates->line;
 
-    err = at_tok_start(&line);
-    if (err < 0)
-        goto error;
-
     /*
      * The solicited version of the CREG response is
      * +CREG: n, stat, [lac, cid]
@@ -3708,65 +4135,34 @@ static void requestRegistrationState(RIL_Token t)
     if (err < 0)
         goto error;
 
+    response[1] = -1;
+    response[2] = -1;
+
     switch (commas) {
     case 0:                    /* +CREG: <stat> */
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0)
-            goto error;
-
-        response[1] = -1;
-        response[2] = -1;
+        err = at_parse(line, "+CREG:", "i", &response[0]);
         break;
-
     case 1:                    /* +CREG: <n>, <stat> */
-        err = at_tok_nextint(&line, &skip);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0)
-            goto error;
-
-        response[1] = -1;
-        response[2] = -1;
-        if (err < 0)
-            goto error;
+        err = at_parse(line, "+CREG:", "*,i", &response[0]);
         break;
     case 2:                    /* +CREG: <stat>, <lac>, <cid> */
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[1]);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[2]);
-        if (err < 0)
-            goto error;
+        err = at_parse(line, "+CREG:", "i,h,h", &response[0],
+                       &response[1], &response[2]);
         break;
     case 3:                    /* +CREG: <n>, <stat>, <lac>, <cid> */
     case 4:                    /* +CREG: <n>, <stat>, <lac>, <cid>, <?> */
-        err = at_tok_nextint(&line, &skip);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nextint(&line, &response[0]);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[1]);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nexthexint(&line, &response[2]);
-        if (err < 0)
-            goto error;
+        err = at_parse(line, "+CREG:", "*,i,h,h", &response[0],
+                       &response[1], &response[2]);
         break;
     default:
         goto error;
     }
 
+    if (err < 0) {
+        LOGE("%s() Invalid +CREG: line, %s at field %d", __func__,
+             at_parse_strerror(err), AT_PARSE_FIELD(err));
+        goto error;
+    }
 
     asprintf(&responseStr[0], "%d", response[0]);
 
@@ -3975,21 +4371,111 @@ static void requestOEMHookRaw(void *data, size_t datalen, RIL_Token t)
  
 
 /**
- * RIL_REQUEST_OEM_HOOK_STRINGS
- *
- * This request reserved for OEM-specific uses. It passes strings
- * back and forth.
- */ 
-static void requestOEMHookStrings(void * data, size_t datalen, RIL_Token t)
+ * Add a line per request queue and priority to lines, and return how
+ * many were added.
+ */
+static int getQueueStats(char **lines, int max)
 {
-    int i;
-    const char **cur;
-    ATResponse *atResponse = NULL;
-    ATLine *atline;
-    int linecount;
-    int err;
+    unsigned int i;
+    int j, count = 0;
 
-    D("%s() got OEM_HOOK_STRINGS: %8p %lu", __func__, data, (long) datalen);
+    for (i = 0; i < s_requestQueueCount; i++) {
+        RequestQueue *q = s_requestQueues[i];
+        RequestStats stats[PRIORITY_COUNT];
+        int err;
+
+        if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+            LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+        memcpy(stats, q->stats, sizeof(stats));
+        if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+            LOGE("%s() failed to release queue mutex: %s!", __func__, strerror(err));
+
+        for (j = 0; j < PRIORITY_COUNT && count < max; j++) {
+            if (asprintf(&lines[count],
+                    "queue %u %s: depth %u max %u served %lu aged %lu "
+                    "wait avg %lld max %lld ms", i, s_priorityNames[j],
+                    stats[j].depth, stats[j].maxDepth, stats[j].served,
+                    stats[j].aged, stats[j].served ?
+                    stats[j].totalWaitMsec / (long long) stats[j].served : 0,
+                    stats[j].maxWaitMsec) < 0)
+                return count;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* Add a line about the events to lines, and return how many were added */
+static int getEventStats(char **lines, int max)
+{
+    RequestQueue *q = &s_requestQueue;
+    unsigned int pending, settling = 0;
+    unsigned long merged, triggers, runs;
+    unsigned int i;
+    int err;
+
+    if (max < 2)
+        return 0;
+
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+    pending = q->eventCount;
+    merged = q->eventsMerged;
+    triggers = q->settleTriggers;
+    runs = q->settleRuns;
+    for (i = 0; i < q->eventCount; i++)
+        settling += q->events[i]->settle;
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s!", __func__, strerror(err));
+
+    if (asprintf(&lines[0], "events: pending %u merged %lu",
+                 pending, merged) < 0)
+        return 0;
+    if (asprintf(&lines[1], "urc refreshes: triggered %lu run %lu saved %lu "
+                 "settle %ld ms", triggers, runs, triggers - runs - settling,
+                 s_settleMsec) < 0)
+        return 1;
+    return 2;
+}
+
+/**
+ * OEM_HOOK_STRINGS with OEM_HOOK_STATS as first string.
+ *
+ * Reports the statistics the RIL keeps about itself, a line per string.
+ */
+static void requestRILStats(RIL_Token t)
+{
+    char *lines[MAX_STATS_LINES];
+    int count = 0;
+    int i;
+
+    count += getQueueStats(lines + count, MAX_STATS_LINES - count);
+    count += getEventStats(lines + count, MAX_STATS_LINES - count);
+    count += getIdentityStats(lines + count, MAX_STATS_LINES - count);
+
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, lines, count * sizeof(char *));
+
+    for (i = 0; i < count; i++)
+        free(lines[i]);
+}
+
+/**
+ * RIL_REQUEST_OEM_HOOK_STRINGS
+ *
+ * This request reserved for OEM-specific uses. It passes strings
+ * back and forth.
+ */ 
+static void requestOEMHookStrings(void * data, size_t datalen, RIL_Token t)
+{
+    int i;
+    const char **cur;
+    ATResponse *atResponse = NULL;
+    ATLine *atline;
+    int linecount;
+    int err;
+
+    D("%s() got OEM_HOOK_STRINGS: %8p %lu", __func__, data, (long) datalen);
 
     for (i = (datalen / sizeof(char *)), cur = (const char **) data;
          i > 0; cur++, i--) {
@@ -3998,6 +4484,12 @@ static void requestOEMHookStrings(void * data, size_t datalen, RIL_Token t)
 
     /* Only take the first string in the array for now */
     cur = (const char **) data;
+    if (datalen >= sizeof(char *) && *cur != NULL &&
+        !strcmp(*cur, OEM_HOOK_STATS)) {
+        requestRILStats(t);
+        return;
+    }
+
     err = at_send_command_raw(*cur, &atResponse);
 
     if ((err != AT_NOERROR && at_get_error_type(err) == AT_ERROR)
@@ -4099,14 +4591,8 @@ static void unsolicitedRSSI(const char * s)
 	int err;
 	int rssi;
 	RIL_SignalStrength_v6 signalStrength;
-	char * line = NULL;
 
-	line = strdup(s);
-
-	err = at_tok_start(&line);
-	if (err < 0) goto error;
-
-	err = at_tok_nextint(&line, &rssi);
+	err = at_parse(s, NULL, "i", &rssi);
 	if (err < 0) goto error;
 
 	signalStrength.GW_SignalStrength.signalStrength = rssi;
@@ -4125,13 +4611,11 @@ static void unsolicitedRSSI(const char * s)
 	LOGI("Signal Strength %d", rssi);
 
 	RIL_onUnsolicitedResponse(RIL_UNSOL_SIGNAL_STRENGTH, &signalStrength, sizeof(signalStrength));
-	free(line);
 	return;
 
 error:
 	/* The notification was for a battery event - do not send a msg to upper layers */
 	LOGI("Error getting Signal Strength");
-	free(line);
 	return;
 }
 
@@ -4140,7 +4624,6 @@ static void unsolicitedMode(const char * s)
 	int err;
 	int mode1;
 	int mode2;
-	char * line = NULL;
 
 	/*
 	^MODE:3,2 indicates GPRS
@@ -4149,23 +4632,13 @@ static void unsolicitedMode(const char * s)
 	^MODE:5,5 indicates HSDPA
 	*/
 	
-	line = strdup(s);
-
-	err = at_tok_start(&line);
+	err = at_parse(s, NULL, "i,i", &mode1, &mode2);
 	if (err < 0) goto error;
 
-	err = at_tok_nextint(&line, &mode1);
-	if (err < 0) goto error;
-
-	err = at_tok_nextint(&line, &mode2);
-	if (err < 0) goto error;
-	
-	free(line);
 	return;
 
 error:
 	LOGI("Error getting mode");
-	free(line);
 	return;
 }
 
@@ -4182,7 +4655,6 @@ static void requestSignalStrength(RIL_Token t)
     RIL_SignalStrength_v6 signalStrength;
     ATResponse *atResponse = NULL;
     int err;
-    char *line;
     int ber;
     int rssi;
 
@@ -4198,20 +4670,15 @@ static void requestSignalStrength(RIL_Token t)
     if (err != AT_NOERROR)
         goto error;
     
-    line = atResponse->p_intermediates->line;
-
-    err = at_tok_start(&line);
-    if (err < 0) goto error;
+    err = at_parse(atResponse->p_intermediates->line, "+CSQ:", "i,i",
+                   &rssi, &ber);
+    if (err < 0) {
+        LOGE("%s() Invalid +CSQ: line, %s at field %d", __func__,
+             at_parse_strerror(err), AT_PARSE_FIELD(err));
+        goto error;
+    }
 
-    err = at_tok_nextint(&line,&rssi);
-    if (err < 0) goto error;
-	
     signalStrength.GW_SignalStrength.signalStrength = rssi;
-
-    err = at_tok_nextint(&line, &ber);
-    if (err < 0)
-        goto error;
-		
     signalStrength.GW_SignalStrength.bitErrorRate = ber;
 	
 	signalStrength.CDMA_SignalStrength.dbm = 0;
@@ -4410,13 +4877,22 @@ error:
 static void requestGetIMSI(RIL_Token t)
 {
     ATResponse *atResponse = NULL;
+    char *imsi;
     int err;
 
+    imsi = getIdentity(IDENTITY_IMSI);
+    if (imsi != NULL) {
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, imsi, sizeof(char *));
+        free(imsi);
+        return;
+    }
+
     err = at_send_command_numeric("AT+CIMI", &atResponse);
 
     if (err != AT_NOERROR)
         RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
     else {
+        setIdentity(IDENTITY_IMSI, atResponse->p_intermediates->line);
         RIL_onRequestComplete(t, RIL_E_SUCCESS,
                               atResponse->p_intermediates->line,
                               sizeof(char *));
@@ -4447,15 +4923,21 @@ static void requestDeviceIdentity(RIL_Token t)
 {
     ATResponse *atResponse = NULL;
     char* response[4];
+    char *imei;
     int err;
 
     /* IMEI */
-    err = at_send_command_numeric("AT+CGSN", &atResponse);
+    imei = getIdentity(IDENTITY_IMEI);
+    if (imei == NULL) {
+        err = at_send_command_numeric("AT+CGSN", &atResponse);
 
-    if (err != AT_NOERROR)
-        goto error;
+        if (err != AT_NOERROR)
+            goto error;
 
-    response[0] = atResponse->p_intermediates->line;
+        setIdentity(IDENTITY_IMEI, atResponse->p_intermediates->line);
+        response[0] = atResponse->p_intermediates->line;
+    } else
+        response[0] = imei;
 	
 	/* IMEISVN */
 	response[1] = (char*) "01";
@@ -4466,6 +4948,7 @@ static void requestDeviceIdentity(RIL_Token t)
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(response));
 
+    free(imei);
     at_response_free(atResponse);
     return;
 
@@ -4488,6 +4971,13 @@ static void requestBasebandVersion(RIL_Token t)
     ATResponse *atResponse = NULL;
     char *line;
 
+    line = getIdentity(IDENTITY_BASEBAND);
+    if (line != NULL) {
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, line, sizeof(char *));
+        free(line);
+        return;
+    }
+
     err = at_send_command_singleline("AT+CGMR", "\0", &atResponse);
 
     if (err != AT_NOERROR) {
@@ -4497,6 +4987,7 @@ static void requestBasebandVersion(RIL_Token t)
     }
 
     line = atResponse->p_intermediates->line;
+    setIdentity(IDENTITY_BASEBAND, line);
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, line, sizeof(char *));
 
@@ -5186,6 +5677,9 @@ static void requestResetRadio(RIL_Token t)
 {
 	int err = 0;
 
+	/* The modem may come back with a different firmware or SIM */
+	flushIdentity(0);
+
 	/* Reset MS */
 	err = at_send_command("AT+CFUN=6");
 	if(err != AT_NOERROR)
@@ -5877,6 +6371,120 @@ static void processRequest (int request, void *data, size_t datalen, RIL_Token t
  * the previous command has completed).
  */
 
+/* Class of the channel a request should run on */
+static ChannelClass getRequestClass(int request)
+{
+    switch (request) {
+        case RIL_REQUEST_GET_CURRENT_CALLS:
+        case RIL_REQUEST_DIAL:
+        case RIL_REQUEST_HANGUP:
+        case RIL_REQUEST_HANGUP_WAITING_OR_BACKGROUND:
+        case RIL_REQUEST_HANGUP_FOREGROUND_RESUME_BACKGROUND:
+        case RIL_REQUEST_SWITCH_WAITING_OR_HOLDING_AND_ACTIVE:
+        case RIL_REQUEST_ANSWER:
+        case RIL_REQUEST_CONFERENCE:
+        case RIL_REQUEST_UDUB:
+        case RIL_REQUEST_SEPARATE_CONNECTION:
+        case RIL_REQUEST_EXPLICIT_CALL_TRANSFER:
+        case RIL_REQUEST_LAST_CALL_FAIL_CAUSE:
+        case RIL_REQUEST_SET_MUTE:
+        case RIL_REQUEST_GET_MUTE:
+        case RIL_REQUEST_DTMF:
+        case RIL_REQUEST_DTMF_START:
+        case RIL_REQUEST_DTMF_STOP:
+            return CHANNEL_CALL;
+
+        case RIL_REQUEST_SEND_SMS:
+        case RIL_REQUEST_SEND_SMS_EXPECT_MORE:
+        case RIL_REQUEST_SMS_ACKNOWLEDGE:
+        case RIL_REQUEST_WRITE_SMS_TO_SIM:
+        case RIL_REQUEST_DELETE_SMS_ON_SIM:
+        case RIL_REQUEST_GET_SMSC_ADDRESS:
+        case RIL_REQUEST_SET_SMSC_ADDRESS:
+        case RIL_REQUEST_REPORT_SMS_MEMORY_STATUS:
+        case RIL_REQUEST_GSM_GET_BROADCAST_SMS_CONFIG:
+        case RIL_REQUEST_GSM_SET_BROADCAST_SMS_CONFIG:
+        case RIL_REQUEST_GSM_SMS_BROADCAST_ACTIVATION:
+            return CHANNEL_SMS;
+
+        case RIL_REQUEST_SETUP_DATA_CALL:
+        case RIL_REQUEST_DEACTIVATE_DATA_CALL:
+        case RIL_REQUEST_DATA_CALL_LIST:
+        case RIL_REQUEST_LAST_DATA_CALL_FAIL_CAUSE:
+            return CHANNEL_DATA;
+
+        case RIL_REQUEST_QUERY_AVAILABLE_NETWORKS:
+        case RIL_REQUEST_SET_NETWORK_SELECTION_AUTOMATIC:
+        case RIL_REQUEST_SET_NETWORK_SELECTION_MANUAL:
+        case RIL_REQUEST_QUERY_CALL_FORWARD_STATUS:
+        case RIL_REQUEST_SET_CALL_FORWARD:
+        case RIL_REQUEST_QUERY_CALL_WAITING:
+        case RIL_REQUEST_SET_CALL_WAITING:
+        case RIL_REQUEST_GET_CLIR:
+        case RIL_REQUEST_QUERY_CLIP:
+        case RIL_REQUEST_CHANGE_BARRING_PASSWORD:
+            return CHANNEL_SLOW;
+
+        default:
+            return CHANNEL_DEFAULT;
+    }
+}
+
+static RequestPriority getRequestPriority(int request)
+{
+    switch (getRequestClass(request)) {
+        case CHANNEL_CALL:
+            return PRIORITY_URGENT;
+
+        case CHANNEL_SMS:
+            return PRIORITY_HIGH;
+
+        default:
+            break;
+    }
+
+    switch (request) {
+        case RIL_REQUEST_SIGNAL_STRENGTH:
+        case RIL_REQUEST_OPERATOR:
+        case RIL_REQUEST_VOICE_REGISTRATION_STATE:
+        case RIL_REQUEST_DATA_REGISTRATION_STATE:
+        case RIL_REQUEST_QUERY_NETWORK_SELECTION_MODE:
+        case RIL_REQUEST_GET_NEIGHBORING_CELL_IDS:
+            return PRIORITY_LOW;
+
+        default:
+            return PRIORITY_NORMAL;
+    }
+}
+
+/**
+ * Take the mutex of the queue serving a request. Requests fall back on
+ * the primary queue while the channel of their class is down.
+ */
+static RequestQueue *lockRequestQueue(int request)
+{
+    RequestQueue *q = s_classQueues[getRequestClass(request)];
+    int err;
+
+    if (q != NULL) {
+        if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+            LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+
+        if (q->closed == 0)
+            return q;
+
+        if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+            LOGE("%s() failed to release queue mutex: %s!",
+                __func__, strerror(err));
+    }
+
+    q = &s_requestQueue;
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+
+    return q;
+}
+
 /**
  * Call from RIL to us to make a RIL_REQUEST.
  *
@@ -5885,7 +6493,7 @@ static void processRequest (int request, void *data, size_t datalen, RIL_Token t
 static void onRequest(int request, void *data, size_t datalen, RIL_Token t)
 {
     RILRequest *r;
-    RequestQueue *q = &s_requestQueue;
+    RequestQueue *q;
     int err;
 
     r = (RILRequest *) malloc(sizeof(RILRequest));
@@ -5896,20 +6504,10 @@ static void onRequest(int request, void *data, size_t datalen, RIL_Token t)
     r->data = dupRequestData(request, data, datalen);
     r->datalen = datalen;
     r->token = t;
+    clock_gettime(CLOCK_MONOTONIC, &r->queued);
 
-    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
-        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
-
-    /* Queue empty, just throw r on top. */
-    if (q->requestList == NULL)
-        q->requestList = r;
-    else {
-        RILRequest *l = q->requestList;
-        while (l->next != NULL)
-            l = l->next;
-
-        l->next = r;
-    }
+    q = lockRequestQueue(request);
+    queueRequest(q, r, getRequestPriority(request));
 
     if ((err = pthread_cond_broadcast(&q->cond)) != 0)
         LOGE("%s() failed to broadcast queue update: %s!",
@@ -5983,6 +6581,31 @@ static void sendTime(void *p)
 } 
 
 
+/**
+ * Send a list of settings, chained on as few command lines as the modem
+ * allows. Failures are only logged.
+ */
+static void sendInitCommands(const char* const* commands, unsigned int count)
+{
+	ATBatchCommand *batch;
+	unsigned int i;
+
+	batch = (ATBatchCommand *) alloca(count * sizeof(ATBatchCommand));
+	memset(batch, 0, count * sizeof(ATBatchCommand));
+	for (i = 0; i < count; i++) {
+		batch[i].command = commands[i];
+		batch[i].type = NO_RESULT;
+	}
+
+	at_send_batch(batch, count);
+
+	for (i = 0; i < count; i++) {
+		if (batch[i].err != AT_NOERROR) {
+			LOGE("Failed sending command '%s'",commands[i]);
+		}
+	}
+}
+
 static char initializeCommon(void)
 {
     int err = 0;
@@ -6084,8 +6707,16 @@ static char initializeCommon(void)
  */
 static char initializeChannel(void)
 {
-    int err = 0;
-	unsigned int i;
+	/* Settings many sticks reject. They are sent on their own, so
+	   their failure does not break the chained line below */
+	static const char* const optionalcmd[] = {
+
+		/*  Alternating voice/data off */
+		"AT+CMOD=0",
+
+		/*  Not muted */
+		"AT+CMUT=0"
+	};
 	static const char* const initcmd[] = {
 
 		/* Configure Packet Domain Network Registration Status events
@@ -6093,12 +6724,6 @@ static char initializeChannel(void)
 		 *        unsolicited result code
 		 */
 
-		/*  Alternating voice/data off */
-		"AT+CMOD=0",
-
-		/*  Not muted */
-		"AT+CMUT=0",
-		 
 		/*  Network registration events */
 		"AT+CREG=2",
 
@@ -6119,17 +6744,18 @@ static char initializeChannel(void)
 		/* Disable RF */
 		"AT^RFSWITCH=0"
 	};
+	unsigned int i;
 
     D("%s()", __func__);
 
     setRadioState(RADIO_STATE_OFF);
-		
-	for (i=0; i < sizeof(initcmd) / sizeof(initcmd[0]); i++) {
-		err = at_send_command(initcmd[i]);
-		if (err != AT_NOERROR) {
-			LOGE("Failed sending command '%s'",initcmd[i]);
-		}
+
+	for (i = 0; i < sizeof(optionalcmd) / sizeof(optionalcmd[0]); i++) {
+		if (at_send_command(optionalcmd[i]) != AT_NOERROR)
+			D("Modem does not support '%s'", optionalcmd[i]);
 	}
+
+	sendInitCommands(initcmd, sizeof(initcmd) / sizeof(initcmd[0]));
 	
     /* Assume radio is off on error. */
     if (isRadioOn() > 0)
@@ -6138,6 +6764,121 @@ static char initializeChannel(void)
     return 0;
 }
 
+static void onCallStateURC(const char *s, const char *sms_pdu)
+{
+	RIL_onUnsolicitedResponse (
+			RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
+			NULL, 0);
+	settleRILEvent(onDataCallListChanged, NULL);
+}
+
+static void onNetworkStateURC(const char *s, const char *sms_pdu)
+{
+	RIL_onUnsolicitedResponse (
+			RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
+			NULL, 0);
+	settleRILEvent(onDataCallListChanged, NULL);
+}
+
+static void onPacketDomainURC(const char *s, const char *sms_pdu)
+{
+	/* Really, we can ignore NW CLASS and ME CLASS events here,
+	 * but right now we don't since extranous
+	 * RIL_UNSOL_DATA_CALL_LIST_CHANGED calls are tolerated
+	 */
+	/* can't issue AT commands here -- call on main thread */
+	settleRILEvent(onDataCallListChanged, NULL);
+}
+
+static void onNitzTimeURC(const char *s, const char *sms_pdu)
+{
+	unsolicitedNitzTime(s);
+}
+
+static void onRSSIURC(const char *s, const char *sms_pdu)
+{
+	unsolicitedRSSI(s);
+}
+
+static void onModeURC(const char *s, const char *sms_pdu)
+{
+	unsolicitedMode(s);
+}
+
+static void onNewSmsURC(const char *s, const char *sms_pdu)
+{
+	onNewSms(sms_pdu);
+}
+
+static void onNewBroadcastSmsURC(const char *s, const char *sms_pdu)
+{
+	onNewBroadcastSms(sms_pdu);
+}
+
+static void onNewSmsOnSIMURC(const char *s, const char *sms_pdu)
+{
+	onNewSmsOnSIM(s);
+}
+
+static void onNewStatusReportURC(const char *s, const char *sms_pdu)
+{
+	onNewStatusReport(sms_pdu);
+}
+
+static void onUSSDURC(const char *s, const char *sms_pdu)
+{
+	unsolicitedUSSD(s);
+}
+
+static void onNewSmsIndicationURC(const char *s, const char *sms_pdu)
+{
+	onNewSmsIndication();
+}
+
+/*
+ * Handlers of the unsolicited responses, by prefix. A line goes to the
+ * handler of the longest prefix it starts with.
+ */
+static const struct {
+	const char *prefix;
+	void (*handler) (const char *s, const char *sms_pdu);
+} s_urcHandlers[] = {
+	{ "%CTZV:",			onNitzTimeURC },
+	{ "+CTZV:",			onNitzTimeURC },
+	{ "+CTZDST:",		onNitzTimeURC },
+	{ "+HTCCTZV:",		onNitzTimeURC },
+	{ "+CRING:",		onCallStateURC },
+	{ "RING",			onCallStateURC },
+	{ "NO CARRIER",		onCallStateURC },
+	{ "+CCWA",			onCallStateURC },
+	{ "^RSSI:",			onRSSIURC },
+	{ "%RSSI:",			onRSSIURC },
+	{ "^MODE:",			onModeURC },
+	{ "+CREG:",			onNetworkStateURC },
+	{ "+CGREG:",		onNetworkStateURC },
+	{ "+CMT:",			onNewSmsURC },
+	{ "+CBM:",			onNewBroadcastSmsURC },
+	{ "+CMTI:",			onNewSmsOnSIMURC },
+	{ "+CDS:",			onNewStatusReportURC },
+	{ "+CGEV:",			onPacketDomainURC },
+	{ "+CUSD:",			onUSSDURC },
+	{ "+CIEV: 7",		onNewSmsIndicationURC },
+	{ "Received SMS:",	onNewSmsIndicationURC },
+};
+
+static struct prefixtable s_urcPrefixes = PREFIX_TABLE_INIT;
+static pthread_once_t s_urcPrefixesOnce = PTHREAD_ONCE_INIT;
+
+static void initURCPrefixes(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_ELEMS(s_urcHandlers); i++) {
+		if (prefixTableAdd(&s_urcPrefixes, s_urcHandlers[i].prefix, i) < 0)
+			LOGE("%s() Failed to add prefix %s", __func__, s_urcHandlers[i].prefix);
+	}
+}
+
 /**
  * Called by atchannel when an unsolicited line appears
  * This is called on atchannel's reader thread. AT commands may
@@ -6145,64 +6886,24 @@ static char initializeChannel(void)
  */
 static void onUnsolicited (const char *s, const char *sms_pdu)
 {
+	int i;
+
     /* Ignore unsolicited responses until we're initialized.
        This is OK because the RIL library will poll for initial state. */
     if (getRadioState() == RADIO_STATE_UNAVAILABLE)
         return;
 
-	if (strStartsWith(s, "%CTZV:")
-			|| strStartsWith(s,"+CTZV:")
-			|| strStartsWith(s,"+CTZDST:")
-			|| strStartsWith(s,"+HTCCTZV:")) {
-		unsolicitedNitzTime(s);
-	} else if (strStartsWith(s,"+CRING:")
-			|| strStartsWith(s,"RING")
-			|| strStartsWith(s,"NO CARRIER")
-			|| strStartsWith(s,"+CCWA")
-		  ) {
-		RIL_onUnsolicitedResponse (
-				RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
-				NULL, 0);
-		enqueueRILEvent(onDataCallListChanged, NULL, NULL);
-	} else if (strStartsWith(s,"^RSSI:") ||
-			   strStartsWith(s,"%RSSI:")
-				) {
-		unsolicitedRSSI(s);
-	} else if (strStartsWith(s,"^MODE:")) {
-		unsolicitedMode(s);
-	} else if (strStartsWith(s,"+CREG:")
-			|| strStartsWith(s,"+CGREG:")) {
-		RIL_onUnsolicitedResponse (
-				RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
-				NULL, 0);
-		enqueueRILEvent(onDataCallListChanged, NULL, NULL);
-	} else if (strStartsWith(s, "+CMT:")) {
-		onNewSms(sms_pdu);
-    } else if (strStartsWith(s, "+CBM:")) {
-        onNewBroadcastSms(sms_pdu);
-    } else if (strStartsWith(s, "+CMTI:")) {
-        onNewSmsOnSIM(s);
-	} else if (strStartsWith(s, "+CDS:")) {
-        onNewStatusReport(sms_pdu);
-	} else if (strStartsWith(s, "+CGEV:")) {
-		/* Really, we can ignore NW CLASS and ME CLASS events here,
-		 * but right now we don't since extranous
-		 * RIL_UNSOL_DATA_CALL_LIST_CHANGED calls are tolerated
-		 */
-		/* can't issue AT commands here -- call on main thread */
-		enqueueRILEvent(onDataCallListChanged, NULL, NULL);
-	} else if (strStartsWith(s, "+CUSD:")) {
-		unsolicitedUSSD(s);
-	} else if (strStartsWith(s, "+CIEV: 7") ||
-			   strStartsWith(s, "Received SMS:")) { 
-        onNewSmsIndication(); 
-	} 
+	pthread_once(&s_urcPrefixesOnce, initURCPrefixes);
+
+	i = prefixTableFind(&s_urcPrefixes, s);
+	if (i >= 0)
+		s_urcHandlers[i].handler(s, sms_pdu);
 }
 
 static void signalCloseQueues(void)
 {
     unsigned int i;
-    for (i = 0; i < (sizeof(s_requestQueues) / sizeof(RequestQueue *)); i++) {
+    for (i = 0; i < s_requestQueueCount; i++) {
         int err;
         RequestQueue *q = s_requestQueues[i];
         if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
@@ -6245,21 +6946,229 @@ static void onATTimeout()
     /* TODO We may cause a radio reset here. */
 }
 
+struct queueArgs {
+    int port;
+    char * loophost;
+    const char *device_path;
+    RequestQueue *queue;
+    char primary;
+};
+
+/**
+ * Close an additional channel, without touching the others or the radio
+ * state. Its runner reopens it and hands its requests to the primary one.
+ */
+static void closeSecondaryChannel(void)
+{
+    struct queueArgs *args = (struct queueArgs *) at_get_channel_data();
+    RequestQueue *q = args->queue;
+    int err;
+
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s", __func__, strerror(err));
+
+    q->closed = 1;
+    if ((err = pthread_cond_signal(&q->cond)) != 0)
+        LOGE("%s() failed to broadcast queue update: %s",
+            __func__, strerror(err));
+
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s", __func__,
+             strerror(err));
+}
+
+/* Called on the reader thread of an additional channel */
+static void onSecondaryReaderClosed()
+{
+    struct queueArgs *args = (struct queueArgs *) at_get_channel_data();
+
+    LOGI("AT channel %s closed\n", args->device_path);
+    closeSecondaryChannel();
+}
+
+/* Called on the command thread of an additional channel */
+static void onSecondaryTimeout()
+{
+    struct queueArgs *args = (struct queueArgs *) at_get_channel_data();
+
+    LOGI("AT channel %s timeout; reopening..", args->device_path);
+    at_send_escape();
+    closeSecondaryChannel();
+}
+
 static void usage(char *s)
 {
 #ifdef RIL_SHLIB
 	fprintf(stderr, "htcgeneric-ril requires: -p <tcp port> or -d /dev/tty_device\n");
 #else 
-    fprintf(stderr, "usage: %s [-p <tcp port>] [-d /dev/tty_device] [-v /dev/tty_device]\n", s);
+    fprintf(stderr, "usage: %s [-p <tcp port>] [-d /dev/tty_device] [-v /dev/tty_device] "
+                    "[-c <call|sms|data|slow>[,...]:/dev/tty_device]... [-s <settle msec>]\n", s);
     exit(-1);
 #endif
 }
 
-struct queueArgs {
-    int port;
-    char * loophost;
-    const char *device_path;
-};
+/* Additional channels, from -c options */
+static struct queueArgs *s_channelArgs[MAX_CHANNELS - 1];
+static unsigned int s_channelCount = 0;
+
+/**
+ * Parse a "class[,class...]:device" channel specification, and set up
+ * the queue that will serve those classes on that device.
+ */
+static int addChannel(char *spec)
+{
+    char *device;
+    char *name;
+    struct queueArgs *args;
+    RequestQueue *q;
+    int classes[CHANNEL_CLASS_COUNT];
+    int count = 0;
+    int i;
+
+    device = strchr(spec, ':');
+    if (device == NULL || device[1] == '\0' ||
+        s_channelCount >= MAX_CHANNELS - 1)
+        return -1;
+    *device++ = '\0';
+
+    for (name = strtok(spec, ","); name != NULL; name = strtok(NULL, ",")) {
+        for (i = CHANNEL_DEFAULT + 1; i < CHANNEL_CLASS_COUNT; i++) {
+            if (!strcmp(name, s_channelClassNames[i]))
+                break;
+        }
+        if (i == CHANNEL_CLASS_COUNT || s_classQueues[i] != NULL) {
+            LOGE("%s() Unknown or already routed class '%s'", __func__, name);
+            return -1;
+        }
+        classes[count++] = i;
+    }
+
+    if (count == 0)
+        return -1;
+
+    q = (RequestQueue *) malloc(sizeof(RequestQueue));
+    memset(q, 0, sizeof(RequestQueue));
+    pthread_mutex_init(&q->queueMutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->enabled = 1;
+    q->closed = 1;
+
+    args = (struct queueArgs *) malloc(sizeof(struct queueArgs));
+    memset(args, 0, sizeof(struct queueArgs));
+    args->port = -1;
+    args->device_path = device;
+    args->queue = q;
+
+    for (i = 0; i < count; i++)
+        s_classQueues[classes[i]] = q;
+
+    s_requestQueues[s_requestQueueCount++] = q;
+    s_channelArgs[s_channelCount++] = args;
+
+    D("%s() Opening tty device %s for %d request classes", __func__, device, count);
+    return 0;
+}
+
+/**
+ * Hand the requests still waiting on a closed channel over to the
+ * primary queue, which will run them once the modem is back.
+ */
+static void moveRequestsToPrimary(RequestQueue *q)
+{
+    RequestList lists[PRIORITY_COUNT];
+    unsigned int depths[PRIORITY_COUNT];
+    int i;
+    int err;
+
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+    for (i = 0; i < PRIORITY_COUNT; i++) {
+        lists[i] = q->requests[i];
+        depths[i] = q->stats[i].depth;
+        q->requests[i].head = q->requests[i].tail = NULL;
+        q->stats[i].depth = 0;
+    }
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s!", __func__, strerror(err));
+
+    q = &s_requestQueue;
+    if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+
+    for (i = 0; i < PRIORITY_COUNT; i++) {
+        RequestStats *stats = &q->stats[i];
+
+        if (lists[i].head == NULL)
+            continue;
+
+        if (q->requests[i].tail == NULL)
+            q->requests[i].head = lists[i].head;
+        else
+            q->requests[i].tail->next = lists[i].head;
+        q->requests[i].tail = lists[i].tail;
+
+        stats->depth += depths[i];
+        if (stats->depth > stats->maxDepth)
+            stats->maxDepth = stats->depth;
+    }
+
+    if ((err = pthread_cond_broadcast(&q->cond)) != 0)
+        LOGE("%s() failed to broadcast queue update: %s!",
+            __func__, strerror(err));
+
+    if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+        LOGE("%s() failed to release queue mutex: %s!", __func__, strerror(err));
+}
+
+/**
+ * Additional channels are opened only once the primary one has reset
+ * and initialized the modem.
+ */
+static void waitForPrimaryChannel(void)
+{
+    char closed;
+    int err;
+
+    for (;;) {
+        if ((err = pthread_mutex_lock(&s_requestQueue.queueMutex)) != 0)
+            LOGE("%s() failed to take queue mutex: %s!", __func__, strerror(err));
+        closed = s_requestQueue.closed;
+        if ((err = pthread_mutex_unlock(&s_requestQueue.queueMutex)) != 0)
+            LOGE("%s() failed to release queue mutex: %s!", __func__, strerror(err));
+
+        if (!closed)
+            return;
+        sleep(1);
+    }
+}
+
+/**
+ * Initialize an additional channel. The modem was already set up through
+ * the primary one, so only the settings of the port itself are needed.
+ */
+static char initializeSecondaryChannel(void)
+{
+	static const char* const initcmd[] = {
+
+		/*  echo off, send verbose results */
+		"ATE0Q0V1",
+
+		/*  Extended errors without textual decriptions */
+		"AT+CMEE=1",
+
+		/*  SMS PDU mode */
+		"AT+CMGF=0"
+	};
+
+    if (at_handshake() < 0) {
+        LOGE("%s() Handshake failed!", __func__);
+        return 1;
+    }
+
+	sendInitCommands(initcmd, sizeof(initcmd) / sizeof(initcmd[0]));
+
+    return 0;
+}
 
 static int safe_read(int fd, char *buf, int count)
 {
@@ -6291,9 +7200,15 @@ static void *queueRunner(void *param)
 
     LOGI("%s() starting!", __func__);
 
+    q = queueArgs->queue;
+
     for (;;) {
         fd = -1;
         max_fd = -1;
+
+        if (!queueArgs->primary)
+            waitForPrimaryChannel();
+
         while (fd < 0) {
             if (queueArgs->port > 0) {
                 if (queueArgs->loophost)
@@ -6330,25 +7245,50 @@ static void *queueRunner(void *param)
             continue;
         }
 
-        at_set_on_reader_closed(onATReaderClosed);
-        at_set_on_timeout(onATTimeout);
+        if (queueArgs->primary) {
+            at_set_on_reader_closed(onATReaderClosed);
+            at_set_on_timeout(onATTimeout);
 
-        q = &s_requestQueue;
+            if (initializeCommon()) {
+                LOGE("%s() Failed to initialize channel!", __func__);
+                at_close();
+                continue;
+            }
 
-		if(initializeCommon()) {
-            LOGE("%s() Failed to initialize channel!", __func__);
-            at_close();
-            continue;
-        }
-		
-		q->closed = 0;
-		if (initializeChannel()) {
-			LOGE("%s() Failed to initialize channel!", __func__);
-			at_close();
-			continue;
-		}
+            q->closed = 0;
+            if (initializeChannel()) {
+                LOGE("%s() Failed to initialize channel!", __func__);
+                at_close();
+                continue;
+            }
 
-		at_make_default_channel();
+            at_make_default_channel();
+        } else {
+            int err;
+
+            /* A failing additional channel only takes itself down. */
+            at_set_channel_data(queueArgs);
+            at_set_on_reader_closed(onSecondaryReaderClosed);
+            at_set_on_timeout(onSecondaryTimeout);
+
+            if (initializeSecondaryChannel()) {
+                LOGE("%s() Failed to initialize channel %s!",
+                    __func__, queueArgs->device_path);
+                at_close();
+                sleep(TIMEOUT_SEARCH_FOR_TTY);
+                continue;
+            }
+
+            if ((err = pthread_mutex_lock(&q->queueMutex)) != 0)
+                LOGE("%s() failed to take queue mutex: %s!",
+                    __func__, strerror(err));
+            q->closed = 0;
+            if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
+                LOGE("%s() failed to release queue mutex: %s!",
+                    __func__, strerror(err));
+
+            LOGI("%s() Channel %s ready", __func__, queueArgs->device_path);
+        }
 
         LOGE("%s() Looping the requestQueue!", __func__);
         for (;;) {
@@ -6370,17 +7310,17 @@ static void *queueRunner(void *param)
                 break;
             }
 
-            while (q->closed == 0 && q->requestList == NULL &&
-                q->eventList == NULL) {
+            while (q->closed == 0 && !hasRequests(q) &&
+                q->eventCount == 0) {
                 if ((err = pthread_cond_wait(&q->cond, &q->queueMutex)) != 0)
                     LOGE("%s() failed broadcast queue cond: %s!",
                         __func__, strerror(err));
             }
 
-            /* eventList is prioritized, smallest abstime first. */
-            if (q->closed == 0 && q->requestList == NULL && q->eventList) {
+            /* The event heap has the smallest abstime first. */
+            if (q->closed == 0 && !hasRequests(q) && q->eventCount > 0) {
                 int err = 0;
-                err = pthread_cond_timedwait(&q->cond, &q->queueMutex, &q->eventList->abstime);
+                err = pthread_cond_timedwait(&q->cond, &q->queueMutex, &q->events[0]->abstime);
                 if (err && err != ETIMEDOUT)
                     LOGE("%s() timedwait returned unexpected error: %s",
 		        __func__, strerror(err));
@@ -6398,16 +7338,11 @@ static void *queueRunner(void *param)
 
             clock_gettime(CLOCK_MONOTONIC, &ts);
 
-            if (q->eventList != NULL &&
-                timespec_cmp(q->eventList->abstime, ts, < )) {
-                e = q->eventList;
-                q->eventList = e->next;
-            }
+            if (q->eventCount > 0 &&
+                timespec_cmp(q->events[0]->abstime, ts, < ))
+                e = popEvent(q);
 
-            if (q->requestList != NULL) {
-                r = q->requestList;
-                q->requestList = r->next;
-            }
+            r = dequeueRequest(q);
 
             if ((err = pthread_mutex_unlock(&q->queueMutex)) != 0)
                 LOGE("%s(): Failed to release queue mutex: %s!",
@@ -6426,6 +7361,8 @@ static void *queueRunner(void *param)
         }
 
         at_close();
+        if (!queueArgs->primary)
+            moveRequestsToPrimary(q);
         LOGE("%s() Re-opening after close", __func__);
     }
     return NULL;
@@ -6441,6 +7378,7 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
     const char *device_path = NULL;
     struct queueArgs *queueArgs;
     pthread_attr_t attr;
+    unsigned int i;
 
     s_rilenv = env;
 
@@ -6449,13 +7387,29 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
 	
     D("%s() entering...", __func__);
 
-    while (-1 != (opt = getopt(argc, argv, "z:p:d:v:"))) {
+    while (-1 != (opt = getopt(argc, argv, "z:p:d:v:c:s:"))) {
         switch (opt) {
             case 'z':
                 loophost = optarg;
                 D("%s() Using loopback host %s..", __func__, loophost);
                 break;
 
+            case 'c':
+                if (addChannel(optarg) < 0) {
+                    usage(argv[0]);
+                    return NULL;
+                }
+                break;
+
+            case 's':
+                s_settleMsec = atol(optarg);
+                if (s_settleMsec < 0) {
+                    usage(argv[0]);
+                    return NULL;
+                }
+                D("%s() Settling URC refreshes for %ld ms", __func__, s_settleMsec);
+                break;
+
             case 'p':
                 port = atoi(optarg);
                 if (port == 0) {
@@ -6492,12 +7446,19 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc,
     queueArgs->device_path = device_path;
     queueArgs->port = port;
     queueArgs->loophost = loophost;
+    queueArgs->queue = &s_requestQueue;
+    queueArgs->primary = 1;
 
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
     pthread_create(&s_tid_queueRunner, &attr, queueRunner, queueArgs);
 
+    for (i = 0; i < s_channelCount; i++) {
+        pthread_t tid;
+        pthread_create(&tid, &attr, queueRunner, s_channelArgs[i]);
+    }
+
     return &s_callbacks;
 }
 
@@ -6509,19 +7470,37 @@ int main (int argc, char **argv)
     char *loophost = NULL;
     const char *device_path = NULL;
     struct queueArgs *queueArgs;
+    pthread_attr_t attr;
+    unsigned int i;
 
 	/* By default, use USB1 as audio channel */
 	strcpy(sAudioDevice,"/dev/ttyUSB1");
 	
     D("%s() entering...", __func__);
 
-    while (-1 != (opt = getopt(argc, argv, "z:p:d:v:"))) {
+    while (-1 != (opt = getopt(argc, argv, "z:p:d:v:c:s:"))) {
         switch (opt) {
             case 'z':
                 loophost = optarg;
                 D("%s() Using loopback host %s..", __func__, loophost);
                 break;
 
+            case 'c':
+                if (addChannel(optarg) < 0) {
+                    usage(argv[0]);
+                    return 0;
+                }
+                break;
+
+            case 's':
+                s_settleMsec = atol(optarg);
+                if (s_settleMsec < 0) {
+                    usage(argv[0]);
+                    return 0;
+                }
+                D("%s() Settling URC refreshes for %ld ms", __func__, s_settleMsec);
+                break;
+
             case 'p':
                 port = atoi(optarg);
                 if (port == 0) {
@@ -6558,9 +7537,19 @@ int main (int argc, char **argv)
     queueArgs->device_path = device_path;
     queueArgs->port = port;
     queueArgs->loophost = loophost;
+    queueArgs->queue = &s_requestQueue;
+    queueArgs->primary = 1;
 
    	RIL_register(&s_callbacks);
 
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (i = 0; i < s_channelCount; i++) {
+        pthread_t tid;
+        pthread_create(&tid, &attr, queueRunner, s_channelArgs[i]);
+    }
+
 	queueRunner(queueArgs);
 	
 	return 0;
@@ -15,6 +15,7 @@
 ** limitations under the License.
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -167,3 +168,83 @@ underflow:
     return -EINVAL;
 #undef TLV_STREAM_GET
 }
+
+static int prefixNodeNew(struct prefixtable *table, char c)
+{
+    struct prefixnode *node;
+
+    if (table->count == table->size) {
+        int size = table->size ? table->size * 2 : 64;
+        struct prefixnode *nodes = (struct prefixnode *)
+            realloc(table->nodes, size * sizeof(struct prefixnode));
+
+        if (nodes == NULL)
+            return -ENOMEM;
+        table->nodes = nodes;
+        table->size = size;
+    }
+
+    node = &table->nodes[table->count];
+    node->c = c;
+    node->child = -1;
+    node->sibling = -1;
+    node->value = -1;
+    return table->count++;
+}
+
+int prefixTableAdd(struct prefixtable *table, const char *prefix, int value)
+{
+    int node;
+    int *link;
+
+    /* Node 0 is the root, matching the empty prefix. */
+    if (table->count == 0 && prefixNodeNew(table, '\0') < 0)
+        return -ENOMEM;
+
+    for (node = 0; *prefix != '\0'; prefix++) {
+        link = &table->nodes[node].child;
+        while (*link >= 0 && table->nodes[*link].c != *prefix)
+            link = &table->nodes[*link].sibling;
+
+        if (*link < 0) {
+            int n = prefixNodeNew(table, *prefix);
+            if (n < 0)
+                return -ENOMEM;
+            /* The nodes may have moved. */
+            link = &table->nodes[node].child;
+            while (*link >= 0)
+                link = &table->nodes[*link].sibling;
+            *link = n;
+        }
+        node = *link;
+    }
+
+    table->nodes[node].value = value;
+    return 0;
+}
+
+int prefixTableFind(const struct prefixtable *table, const char *line)
+{
+    int node = 0;
+    int value = -1;
+
+    if (table->count == 0)
+        return -1;
+
+    for (;;) {
+        if (table->nodes[node].value >= 0)
+            value = table->nodes[node].value;
+
+        if (*line == '\0')
+            break;
+
+        node = table->nodes[node].child;
+        while (node >= 0 && table->nodes[node].c != *line)
+            node = table->nodes[node].sibling;
+        if (node < 0)
+            break;
+        line++;
+    }
+
+    return value;
+}
@@ -50,4 +50,29 @@ int parseTlv(/*in*/ const char *stream,
 
 #define NUM_ELEMS(x) (sizeof(x) / sizeof(x[0]))
 
+/*
+ * Set of line prefixes, each with a value, kept as a trie so a line is
+ * matched against all of them in one pass over its first characters.
+ */
+struct prefixnode {
+    char c;
+    int child;      /* First node of the next level, -1 if none */
+    int sibling;    /* Next node of the same level, -1 if none */
+    int value;      /* Value of the prefix ending here, -1 if none */
+};
+
+struct prefixtable {
+    struct prefixnode *nodes;
+    int count;
+    int size;
+};
+
+#define PREFIX_TABLE_INIT { NULL, 0, 0 }
+
+/** Adds prefix with value >= 0 to table. Returns 0, or -ENOMEM. */
+int prefixTableAdd(struct prefixtable *table, const char *prefix, int value);
+
+/** Returns the value of the longest prefix line starts with, -1 if none. */
+int prefixTableFind(const struct prefixtable *table, const char *line);
+
 #endif
@@ -10,6 +10,9 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 
 LOCAL_CFLAGS:=-fno-short-enums -DHAVE_CONFIG_H 
 
+# Uncomment to compile out the logs issued for every captured frame
+#LOCAL_CFLAGS += -DCAMERA_NO_FRAME_LOGS
+
 LOCAL_C_INCLUDES += \
 	external/jpeg
 	
@@ -18,8 +21,13 @@ LOCAL_SRC_FILES:= \
 	CameraHal.cpp \
 	CameraHardware.cpp \
 	Converter.cpp \
+	Exif.cpp \
+	FaceDetector.cpp \
+	FramePool.cpp \
+	FrameStats.cpp \
 	Utils.cpp \
 	V4L2Camera.cpp \
+	V4L2Device.cpp \
 	SurfaceDesc.cpp \
 	SurfaceSize.cpp 
 
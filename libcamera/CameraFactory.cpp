@@ -23,8 +23,26 @@
 #define LOG_TAG "Camera_Factory"
 #include <cutils/log.h>
 #include <cutils/properties.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include "CameraFactory.h"
 
+/* Default capture device, used when no capture device is found */
+#define VIDEO_DEVICE			"/dev/video0"
+
+/* Property to use a single given capture device instead of the ones found. It 
+ * can also name a fake device replaying recorded frames, see V4L2Device.h */
+#define VIDEO_DEVICE_PROPERTY	"debug.camera.device"
+
+/* Once powered, the cameras are enumerated by USB one after the other. The
+ * capture nodes are scanned every ENUM_SETTLE_MS until they stop changing, 
+ * for up to ENUM_SETTLE_MAX_MS */
+#define ENUM_SETTLE_MS			500
+#define ENUM_SETTLE_MAX_MS		3000
+
 extern camera_module_t HAL_MODULE_INFO_SYM;
 
 /* A global instance of CameraFactory is statically instantiated and
@@ -35,20 +53,120 @@ android::CameraFactory  gCameraFactory;
 namespace android {
 
 CameraFactory::CameraFactory()
-        : mCamera(NULL)
+        : mEnumerated(false),
+		  mCameraNum(0)
 {
 	LOGD("CameraFactory::CameraFactory");
+	memset(mCamera, 0, sizeof(mCamera));
 }
 
 CameraFactory::~CameraFactory()
 {
 	LOGD("CameraFactory::~CameraFactory");
-    if (mCamera != NULL) {
-        delete mCamera;
-		mCamera = NULL;
+	for (int i = 0; i < MAX_CAMERAS; i++) {
+		if (mCamera[i] != NULL) {
+			delete mCamera[i];
+			mCamera[i] = NULL;
+		}
     }
 }
 
+/* Returns if the given device node is a streaming video capture device. Other
+ * V4L2 nodes (output, codecs, VBI...) are ignored */
+bool CameraFactory::isCaptureDevice(const char* device)
+{
+	int fd = ::open(device, O_RDWR);
+	if (fd < 0)
+		return false;
+		
+	struct v4l2_capability cap;
+	memset(&cap, 0, sizeof(cap));
+	bool ok = ::ioctl(fd, VIDIOC_QUERYCAP, &cap) >= 0 &&
+			  (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) &&
+			  (cap.capabilities & V4L2_CAP_STREAMING);
+	::close(fd);
+	
+	return ok;
+}
+
+static int compareInts(const void* a, const void* b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+/* Find the numbers of all the /dev/video nodes, in numerical order */
+static int scanVideoNodes(int* nums, int max)
+{
+	int count = 0;
+	DIR* dir = opendir("/dev");
+	if (dir != NULL) {
+		struct dirent* de;
+		while ((de = readdir(dir)) != NULL && count < max) {
+			char* end;
+			if (strncmp(de->d_name, "video", 5) != 0)
+				continue;
+			int n = strtol(de->d_name + 5, &end, 10);
+			if (end != de->d_name + 5 && *end == 0) 
+				nums[count++] = n;
+		}
+		closedir(dir);
+	}
+	qsort(nums, count, sizeof(nums[0]), compareInts);
+	return count;
+}
+
+void CameraFactory::enumerateCamerasLocked()
+{
+	LOGD("CameraFactory::enumerateCamerasLocked");
+	
+	mEnumerated = true;
+	mCameraNum = 0;
+	
+	// If a device was given, use only that one
+	char value[PROPERTY_VALUE_MAX];
+	if (property_get(VIDEO_DEVICE_PROPERTY, value, "") > 0) {
+		strcpy(mDevices[0], value);
+		mCameraNum = 1;
+		LOGI("CameraFactory: Using %s", mDevices[0]);
+		return;
+	}
+	
+	// The cameras must be powered to show up. PowerOn only waits for the first
+	//  one, so wait until the other cameras on the same power line show up
+	CameraHardware::PowerOn(VIDEO_DEVICE);
+	
+	// Find all the video capture nodes, once they stop changing
+	const int max = MAX_CAMERAS * 4;
+	int nums[max], next[max];
+	int count = scanVideoNodes(nums, max);
+	for (int waited = 0; waited < ENUM_SETTLE_MAX_MS; waited += ENUM_SETTLE_MS) {
+		usleep(ENUM_SETTLE_MS * 1000);
+		int nextCount = scanVideoNodes(next, max);
+		if (nextCount == count && !memcmp(next, nums, count * sizeof(nums[0])))
+			break;
+		LOGD("CameraFactory: %d capture nodes, was %d, waiting for them to settle", nextCount, count);
+		memcpy(nums, next, nextCount * sizeof(nums[0]));
+		count = nextCount;
+	}
+	
+	for (int i = 0; i < count && mCameraNum < MAX_CAMERAS; i++) {
+		char device[PROPERTY_VALUE_MAX];
+		snprintf(device, sizeof(device), "/dev/video%d", nums[i]);
+		if (isCaptureDevice(device)) {
+			strcpy(mDevices[mCameraNum++], device);
+			LOGI("CameraFactory: Camera %d is %s", mCameraNum - 1, device);
+		}
+	}
+	
+	CameraHardware::PowerOff(VIDEO_DEVICE);
+	
+	// If nothing was found, assume the default device will show up later
+	if (mCameraNum == 0) {
+		strcpy(mDevices[0], VIDEO_DEVICE);
+		mCameraNum = 1;
+	}
+}
+
 /****************************************************************************
  * Camera HAL API handlers.
  *
@@ -69,17 +187,26 @@ int CameraFactory::cameraDeviceOpen(const hw_module_t* module,int camera_id, hw_
         return -EINVAL;
     }
 	
-	if (!mCamera)
-		mCamera = new CameraHardware(module);	
+	CameraHardware* camera;
+	{
+		Mutex::Autolock lock(mLock);
+		if (!mCamera[camera_id])
+			mCamera[camera_id] = new CameraHardware(module, mDevices[camera_id]);	
+		camera = mCamera[camera_id];
+	}
 
-    return mCamera->connectCamera(device);
+    return camera->connectCamera(device);
 }
 
 /* Returns the number of available cameras */
 int CameraFactory::getCameraNum()
 {
 	LOGD("CameraFactory::getCameraNum");
-	return 2;
+	
+	Mutex::Autolock lock(mLock);
+	if (!mEnumerated)
+		enumerateCamerasLocked();
+	return mCameraNum;
 }
 
 
@@ -95,7 +222,7 @@ int CameraFactory::getCameraInfo(int camera_id, struct camera_info* info)
 	
 
 	LOGD("CameraFactory::getCameraInfo: about to fetch info");
-    return CameraHardware::getCameraInfo(info);
+    return CameraHardware::getCameraInfo(camera_id, info);
 }
 
 /****************************************************************************
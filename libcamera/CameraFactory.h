@@ -20,8 +20,13 @@
 #include <string.h>
 #include <hardware/hardware.h>
 #include <hardware/camera.h>
+#include <utils/threads.h>
+#include <cutils/properties.h>
 #include "CameraHardware.h"
 
+/* Maximum number of cameras handled */
+#define MAX_CAMERAS		4
+
 namespace android {
 
 /*
@@ -72,11 +77,11 @@ public:
     /* Gets emulated camera information.
      * This method is called in response to camera_module_t::get_camera_info callback.
      */
-    static int getCameraInfo(int camera_id, struct camera_info *info);
+    int getCameraInfo(int camera_id, struct camera_info *info);
 
 	
 	/* Returns the number of available cameras */
-	static int getCameraNum();
+	int getCameraNum();
 	
     /****************************************************************************
      * Camera HAL API callbacks.
@@ -95,10 +100,28 @@ private:
                            const char* name,
                            hw_device_t** device);
 
+private:
+	/* Finds the available video capture devices. Must be called with mLock held */
+	void enumerateCamerasLocked();
+	static bool isCaptureDevice(const char* device);
+
 private:
 
-    /* Camera hardware */
-    CameraHardware* mCamera;
+	/* Protects the list of cameras. Each camera has its own lock, so they 
+	 * can be used concurrently */
+	Mutex mLock;
+	
+	/* If the devices were already enumerated */
+	bool mEnumerated;
+	
+	/* Number of cameras found */
+	int mCameraNum;
+	
+	/* Capture device of each camera */
+	char mDevices[MAX_CAMERAS][PROPERTY_VALUE_MAX];
+	
+    /* Camera hardware, created when first opened */
+    CameraHardware* mCamera[MAX_CAMERAS];
 
 public:
     /* Contains device open entry point, as required by HAL API. */
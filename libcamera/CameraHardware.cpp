@@ -29,10 +29,13 @@ extern "C" {
 
 #include <ui/Rect.h>
 #include <ui/GraphicBufferMapper.h>
+#include <ui/GraphicBufferAllocator.h>
+#include <cutils/properties.h>
 #include "CameraHardware.h"
 #include "Converter.h"
+#include "Utils.h"
+#include "Exif.h"
 
-#define VIDEO_DEVICE	"/dev/video0"
 #define MIN_WIDTH  		320
 #define MIN_HEIGHT 		240
 
@@ -61,6 +64,11 @@ extern "C" {
 #define PIXEL_FORMAT_YCrCb_422_I 100
 #endif
 
+// The gralloc format of YUYV window buffers, used when capturing straight into them
+#ifndef HAL_PIXEL_FORMAT_YCbCr_422_I
+#define HAL_PIXEL_FORMAT_YCbCr_422_I 0x14
+#endif
+
 #ifndef PIXEL_FORMAT_YCbCr_422_SP
 #define PIXEL_FORMAT_YCbCr_422_SP 0x10    /* NV16  [ov] */
 #endif
@@ -105,30 +113,120 @@ extern "C" {
 #define PIXEL_FORMAT_YV16  0x36315659 /* YCrCb 4:2:2 Planar */
 #endif
 
+#ifndef HAL_PIXEL_FORMAT_YCrCb_420_SP
+#define HAL_PIXEL_FORMAT_YCrCb_420_SP 0x11 /* NV21 */
+#endif
+
+// Type of the recording metadata, as kMetadataBufferTypeGrallocSource
+#define METADATA_BUFFER_TYPE_GRALLOC	1
+
+// Maximum rate of preview callbacks (0 = every captured frame). The display is not affected
+#define KEY_PREVIEW_CALLBACK_FPS	"preview-callback-fps"
+
+// Digital zoom: ZOOM_STEPS levels above 1x, evenly spaced up to MAX_ZOOM_RATIO/100
+#define ZOOM_STEPS		30
+#define MAX_ZOOM_RATIO	400
+
 // File to control camera power
 #define CAMERA_POWER	    "/sys/devices/platform/shuttle-pm-camera/power_on"
 
+// Set to 1 by boards whose display path can show YUYV window buffers
+#define PROP_DIRECT_YUYV	"ro.camera.direct_yuyv"
+
 namespace android {
 
-bool CameraHardware::PowerOn()
+/* Zoom ratio of a zoom level, x100 */
+static int zoomRatio(int level)
+{
+	return 100 + level * (MAX_ZOOM_RATIO - 100) / ZOOM_STEPS;
+}
+
+/* Zoom converter output matching an android pixel format */
+static int zoomFormat(int format)
+{
+	switch (format) {
+	case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+	case PIXEL_FORMAT_YCbCr_420_SP:
+		return ZOOM_YVU420SP;
+	case PIXEL_FORMAT_YV12:
+		return ZOOM_YVU420P;
+	case PIXEL_FORMAT_YV16:
+		return ZOOM_YVU422P;
+	case PIXEL_FORMAT_RGB_888:
+		return ZOOM_RGB24;
+	case PIXEL_FORMAT_RGBA_8888:
+	case PIXEL_FORMAT_RGBX_8888:
+		return ZOOM_RGB32;
+	case PIXEL_FORMAT_BGRA_8888:
+		return ZOOM_BGR32;
+	case PIXEL_FORMAT_RGB_565:
+		return ZOOM_RGB565;
+	}
+	return ZOOM_YUYV;
+}
+
+/* Contents of the recording buffers when storing metadata in them: Instead of
+   a copy of the frame, the encoder gets the gralloc buffer holding it, and
+   reads it in place until it releases the recording buffer */
+struct VideoMetadata {
+	uint32_t			type;		// METADATA_BUFFER_TYPE_GRALLOC
+	buffer_handle_t		handle;		// The frame
+};
+
+/* Gralloc format of the frames handed to the encoder in metadata */
+static int recordingGrallocFormat(int format)
+{
+	switch (format) {
+	case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+	case PIXEL_FORMAT_YCbCr_420_SP:
+		return HAL_PIXEL_FORMAT_YCrCb_420_SP;
+	case PIXEL_FORMAT_YV12:
+		return PIXEL_FORMAT_YV12;
+	}
+	return HAL_PIXEL_FORMAT_YCbCr_422_I;
+}
+
+/* If the board can display YUYV window buffers. There is no way to ask gralloc or
+   SurfaceFlinger for it, so boards must opt in */
+static bool canDisplayYUYV()
+{
+	char value[PROPERTY_VALUE_MAX];
+	property_get(PROP_DIRECT_YUYV, value, "0");
+	return atoi(value) != 0;
+}
+
+// The camera power is shared by all the cameras: Only power it off when nobody uses it
+static Mutex gPowerLock;
+static int gPowerUsers = 0;
+
+bool CameraHardware::PowerOn(const char* device)
 {
 	LOGD("CameraHardware::PowerOn: Power ON camera.");
 	
+	// Nothing to power on if replaying recorded frames
+	if (V4L2Device::isFake(device))
+		return true;
+		
 	// power on camera
-	int handle = ::open(CAMERA_POWER,O_RDWR);
-	if (handle >= 0) {
-		::write(handle,"1\n",2);
-		::close(handle);
-	} else {
-		LOGE("Could not open %s for writing.", CAMERA_POWER);
-		return false;
-    } 
+	int handle;
+	{
+		Mutex::Autolock lock(gPowerLock);
+		handle = ::open(CAMERA_POWER,O_RDWR);
+		if (handle >= 0) {
+			if (gPowerUsers++ == 0) 
+				::write(handle,"1\n",2);
+			::close(handle);
+		} else {
+			LOGE("Could not open %s for writing.", CAMERA_POWER);
+			return false;
+		} 
+	}
 	
 	// Wait until the camera is recognized or timed out
 	int timeOut = 500;
 	do {
 		// Try to open the video capture device
-		handle = ::open(VIDEO_DEVICE,O_RDWR);
+		handle = ::open(device,O_RDWR);
 		if (handle >= 0)
 			break;
 		// Wait a bit
@@ -146,14 +244,20 @@ bool CameraHardware::PowerOn()
 	return false;
 }
 
-bool CameraHardware::PowerOff()
+bool CameraHardware::PowerOff(const char* device)
 {
 	LOGD("CameraHardware::PowerOff: Power OFF camera.");
 	
-	// power on camera
+	if (V4L2Device::isFake(device))
+		return true;
+		
+	Mutex::Autolock lock(gPowerLock);
+	
+	// power off camera, once no camera uses it
 	int handle = ::open(CAMERA_POWER,O_RDWR);
 	if (handle >= 0) {
-		::write(handle,"0\n",2);
+		if (gPowerUsers > 0 && --gPowerUsers == 0) 
+			::write(handle,"0\n",2);
 		::close(handle);
 	} else {
 		LOGE("Could not open %s for writing.", CAMERA_POWER);
@@ -162,16 +266,18 @@ bool CameraHardware::PowerOff()
 	return true;
 }
 
-CameraHardware::CameraHardware(const hw_module_t* module)
+CameraHardware::CameraHardware(const hw_module_t* module, const char* device)
         :
 		mWin(0),	
 		mPreviewWinFmt(PIXEL_FORMAT_UNKNOWN),
 		mPreviewWinWidth(0),
 		mPreviewWinHeight(0),
+		mDirectRender(false),
+		mDirectQueued(0),
 
 		mParameters(),
 		
-		mRawPreviewHeap(0),
+		mRawPreviewFrame(0),
 		mRawPreviewFrameSize(0),
 
 		mRawPreviewWidth(0),
@@ -184,15 +290,22 @@ CameraHardware::CameraHardware(const hw_module_t* module)
         mRawPictureHeap(0),
 		mRawPictureBufferSize(0),
 		
+		mRecFmt(PIXEL_FORMAT_UNKNOWN),
+		mStoreMetaData(false),
         mRecordingHeap(0),
 		mRecordingFrameSize(0),
-		mRecFmt(PIXEL_FORMAT_UNKNOWN),
+		mRecordingMeta(false),
+		mRecGrStride(0),
+		mCurrentRecordingFrame(0),
+		mRecordingFramesSent(0),
+		mRecordingFramesDropped(0),
 		
         mJpegPictureHeap(0),
 		mJpegPictureBufferSize(0),
 		
 		mRecordingEnabled(0),		
 		
+		mPreviewEnabled(0),
         mNotifyCb(0),
         mDataCb(0),
         mDataCbTimestamp(0),
@@ -200,8 +313,14 @@ CameraHardware::CameraHardware(const hw_module_t* module)
         mCallbackCookie(0),
 		
         mMsgEnabled(0),
-        mCurrentPreviewFrame(0),
-        mCurrentRecordingFrame(0)	
+		mPreviewCallbackInterval(0),
+		mNextPreviewCallback(0),
+		mPreviewCallbacksSkipped(0),
+		mZoom(0),
+		mZoomTarget(0),
+		mSmoothZoom(false),
+		mFaceMetaHeap(0),
+        mCurrentPreviewFrame(0)
 		
 {
     /*
@@ -217,10 +336,22 @@ CameraHardware::CameraHardware(const hw_module_t* module)
     /* camera_device fields. */
     ops = &mDeviceOps;
     priv = this;
+	
+	memset(mRecBuffers, 0, sizeof(mRecBuffers));
+	memset(mRecGrBuf, 0, sizeof(mRecGrBuf));
+	memset(mRecBufferOwned, 0, sizeof(mRecBufferOwned));
+	memset(mDirectBuf, 0, sizeof(mDirectBuf));
+	memset(mDirectAddr, 0, sizeof(mDirectAddr));
 
+	strncpy(mVideoDevice, device, sizeof(mVideoDevice) - 1);
+	mVideoDevice[sizeof(mVideoDevice) - 1] = 0;
+	
 	// Power on camera
-	PowerOn();
+	PowerOn(mVideoDevice);
 
+	// Publish the empty parameters, so there is always a configuration
+	publishConfigLocked();
+	
 	// Init default parameters
     initDefaultParameters();
 }
@@ -233,9 +364,9 @@ CameraHardware::~CameraHardware()
     }
 	
 	// Release all memory heaps
-	if (mRawPreviewHeap) {
-		mRawPreviewHeap->release(mRawPreviewHeap);
-		mRawPreviewHeap = NULL;
+	if (mRawPreviewFrame) {
+		mRawPreviewFrame->release();
+		mRawPreviewFrame = NULL;
 	}
 	
 	if (mPreviewHeap) {
@@ -248,21 +379,23 @@ CameraHardware::~CameraHardware()
 		mRawPictureHeap = NULL;
 	}
 	
-	if (mRecordingHeap) {
-		mRecordingHeap->release(mRecordingHeap);
-		mRecordingHeap = NULL;
-	}
+	freeRecordingPoolLocked();
 
 	if (mJpegPictureHeap) {
 		mJpegPictureHeap->release(mJpegPictureHeap);
 		mJpegPictureHeap = NULL;
 	}
 	
+	if (mFaceMetaHeap) {
+		mFaceMetaHeap->release(mFaceMetaHeap);
+		mFaceMetaHeap = NULL;
+	}
+	
 	// Power off camera
-	PowerOff();
+	PowerOff(mVideoDevice);
 }
 
-bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win)
+bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win, bool direct)
 {
 	LOGD("CameraHardware::NegotiatePreviewFormat");
 	
@@ -279,14 +412,16 @@ bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win)
 	mPreviewWinWidth = 0;
 	mPreviewWinHeight = 0;
 	
-	// Set the buffer geometry of the surface and YV12 as the preview format
-	if (win->set_buffers_geometry(win,pw,ph,PIXEL_FORMAT_YV12) != NO_ERROR) {
+	// Set the buffer geometry of the surface and YV12 as the preview format, or
+	//  YUYV if the camera will be capturing directly into the window buffers
+	int fmt = direct ? HAL_PIXEL_FORMAT_YCbCr_422_I : PIXEL_FORMAT_YV12;
+	if (win->set_buffers_geometry(win,pw,ph,fmt) != NO_ERROR) {
 		LOGE("Unable to set buffer geometry");
 		return false;
 	}
 
 	// Store the preview window format
-	mPreviewWinFmt = PIXEL_FORMAT_YV12;
+	mPreviewWinFmt = fmt;
 	mPreviewWinWidth = pw;
 	mPreviewWinHeight = ph;
 	
@@ -312,11 +447,12 @@ status_t CameraHardware::closeCamera()
     return NO_ERROR;
 }
 
-status_t CameraHardware::getCameraInfo(struct camera_info* info)
+status_t CameraHardware::getCameraInfo(int cameraId, struct camera_info* info)
 {
     LOGD("CameraHardware::getCameraInfo");
 
-    info->facing = CAMERA_FACING_FRONT;
+	// The first camera is the front one, any other faces back
+    info->facing = (cameraId == 0) ? CAMERA_FACING_FRONT : CAMERA_FACING_BACK;
     info->orientation = 0;
 
     return NO_ERROR;
@@ -329,10 +465,11 @@ status_t CameraHardware::setPreviewWindow(struct preview_stream_ops* window)
         Mutex::Autolock lock(mLock);
         
 		if (window != NULL) {
-			/* The CPU will write each frame to the preview window buffer.
+			/* The CPU will write each frame to the preview window buffer, or
+			 * read it back if the camera wrote it there directly.
 			 * Note that we delay setting preview window buffer geometry until
 			 * frames start to come in. */
-			status_t res = window->set_usage(window, GRALLOC_USAGE_SW_WRITE_OFTEN);
+			status_t res = window->set_usage(window, GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
 			if (res != NO_ERROR) {
 				res = -res; // set_usage returns a negative errno.
 				LOGE("%s: Error setting preview window usage %d -> %s",
@@ -341,13 +478,18 @@ status_t CameraHardware::setPreviewWindow(struct preview_stream_ops* window)
 			}
 		}
 		
+		// The camera must give back the buffers of the old window
+		if (mDirectRender) {
+			stopDirectRenderLocked();
+		}
+		
 		mWin = window;
 		
 		// setup the preview window geometry to be able to use the full preview window
 		if (mPreviewThread != 0 && mWin != 0) {
 			
 			LOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
-			NegotiatePreviewFormat(mWin);
+			NegotiatePreviewFormat(mWin, false);
 	
 		}
 		
@@ -364,6 +506,7 @@ void CameraHardware::setCallbacks(camera_notify_callback notify_cb,
     LOGD("CameraHardware::setCallbacks");
     {
         Mutex::Autolock lock(mLock);
+        Mutex::Autolock cblock(mCallbackLock);
         mNotifyCb = notify_cb;
         mDataCb = data_cb;
         mDataCbTimestamp = data_cb_timestamp;
@@ -373,44 +516,61 @@ void CameraHardware::setCallbacks(camera_notify_callback notify_cb,
 }
 
 
+CameraHardware::Callbacks CameraHardware::getCallbacks() const
+{
+	Mutex::Autolock lock(mCallbackLock);
+	Callbacks cb;
+	cb.notify = mNotifyCb;
+	cb.data = mDataCb;
+	cb.dataTimestamp = mDataCbTimestamp;
+	cb.cookie = mCallbackCookie;
+	return cb;
+}
+
 void CameraHardware::enableMsgType(int32_t msgType)
 {
     LOGD("CameraHardware::enableMsgType: %d", msgType);
-    {
-        Mutex::Autolock lock(mLock);
-		int32_t old = mMsgEnabled;
-        mMsgEnabled |= msgType;
+	
+	// Messages are flipped without waiting for the preview thread, except
+	//  the video frames: The heaps must be resized before it sees them
+	if (!(msgType & CAMERA_MSG_VIDEO_FRAME)) {
+		android_atomic_or(msgType, &mMsgEnabled);
+		return;
+	}
+	
+    Mutex::Autolock lock(mLock);
+	int32_t old = android_atomic_or(msgType, &mMsgEnabled);
 		
-		// If something changed related to the starting or stopping of
-		//  the recording process...
-		if ((msgType & CAMERA_MSG_VIDEO_FRAME) && 
-			(mMsgEnabled ^ old) & CAMERA_MSG_VIDEO_FRAME && mRecordingEnabled) {
+	// If something changed related to the starting or stopping of
+	//  the recording process...
+	if (!(old & CAMERA_MSG_VIDEO_FRAME) && mRecordingEnabled) {
 			
-			// Recreate the heaps if toggling recording changes the raw preview size
-			//  and also restart the preview so we use the new size if needed
-			initHeapLocked();
-		}
-    }
+		// Recreate the heaps if toggling recording changes the raw preview size
+		//  and also restart the preview so we use the new size if needed
+		initHeapLocked();
+	}
 }
 
 
 void CameraHardware::disableMsgType(int32_t msgType)
 {
     LOGD("CameraHardware::disableMsgType: %d", msgType);
-    {
-        Mutex::Autolock lock(mLock);
-		int32_t old = mMsgEnabled;
-        mMsgEnabled &= ~msgType;
+	
+	if (!(msgType & CAMERA_MSG_VIDEO_FRAME)) {
+		android_atomic_and(~msgType, &mMsgEnabled);
+		return;
+	}
+	
+    Mutex::Autolock lock(mLock);
+	int32_t old = android_atomic_and(~msgType, &mMsgEnabled);
 		
-		// If something changed related to the starting or stopping of
-		//  the recording process...
-		if ((msgType & CAMERA_MSG_VIDEO_FRAME) && 
-			(mMsgEnabled ^ old) & CAMERA_MSG_VIDEO_FRAME && mRecordingEnabled) {
+	// If something changed related to the starting or stopping of
+	//  the recording process...
+	if ((old & CAMERA_MSG_VIDEO_FRAME) && mRecordingEnabled) {
 			
-			// Recreate the heaps if toggling recording changes the raw preview size
-			//  and also restart the preview so we use the new size if needed
-			initHeapLocked();
-		}
+		// Recreate the heaps if toggling recording changes the raw preview size
+		//  and also restart the preview so we use the new size if needed
+		initHeapLocked();
 	}
 }
 
@@ -421,10 +581,8 @@ void CameraHardware::disableMsgType(int32_t msgType)
  */ 
 int CameraHardware::isMsgTypeEnabled(int32_t msgType)
 {
-	Mutex::Autolock lock(mLock);
-	
 	// All messages queried must be enabled to return true
-    int enabled = (mMsgEnabled & msgType) == msgType;
+    int enabled = (android_atomic_acquire_load(&mMsgEnabled) & msgType) == msgType;
 	
     LOGD("CameraHardware::isMsgTypeEnabled(%d): %d", msgType, enabled);
     return enabled;
@@ -471,7 +629,7 @@ status_t CameraHardware::startPreviewLocked()
 	
     LOGD("CameraHardware::startPreviewLocked: Open, %dx%d", width, height);
 
-    status_t ret = camera.Open(VIDEO_DEVICE);
+    status_t ret = camera.Open(mVideoDevice);
 	if (ret != NO_ERROR) {
 		LOGE("Failed to initialize Camera");
 		return ret;
@@ -500,27 +658,42 @@ status_t CameraHardware::startPreviewLocked()
 		/* Store it as the preview size to use */
 		mParameters.setPreviewSize(width, height);
 	}
+	publishConfigLocked();
 
 	/* And reinit the memory heaps to reflect the real used size if needed */
 	initHeapLocked();
 
+	// setup the preview window geometry in order to use it to zoom the image
+	if (mWin != 0) {
+		LOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
+		
+		// If the window can take the captured frames as they are, try to let
+		//  the camera capture straight into the window buffers
+		//  The camera can't zoom, so zoomed frames are always copied
+		bool direct = !mZoom && canDisplayYUYV() &&
+			camera.canCaptureDirect(width, height, width << 1);
+		NegotiatePreviewFormat(mWin, direct);
+		if (direct && !startDirectRenderLocked()) {
+			NegotiatePreviewFormat(mWin, false);
+		}
+	}
+	
     LOGD("CameraHardware::startPreviewLocked: StartStreaming");
 
     ret = camera.StartStreaming();
 	if (ret != NO_ERROR) {
 		LOGE("Failed to start streaming");
+		camera.UseMmap();
+		releaseDirectBuffersLocked();
 		return ret;
 	}
 
-	// setup the preview window geometry in order to use it to zoom the image
-	if (mWin != 0) {
-		LOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
-		NegotiatePreviewFormat(mWin);
-	}
-	
     LOGD("CameraHardware::startPreviewLocked: starting PreviewThread");
+	
+	resetStats(false);
 
     mPreviewThread = new PreviewThread(this);
+	android_atomic_release_store(1, &mPreviewEnabled);
 
     LOGD("CameraHardware::startPreviewLocked: O - this:0x%p",this);
 
@@ -543,6 +716,7 @@ void CameraHardware::stopPreviewLocked()
     if (mPreviewThread != 0) {
         LOGD("CameraHardware::stopPreviewLocked: stopping PreviewThread");
 
+		android_atomic_release_store(0, &mPreviewEnabled);
         mPreviewThread->requestExitAndWait();
 		mPreviewThread.clear();	
 
@@ -552,6 +726,13 @@ void CameraHardware::stopPreviewLocked()
         camera.StopStreaming();
         LOGD("CameraHardware::stopPreviewLocked: Close");
         camera.Close();
+		
+		// And give back the window buffers the camera was using, if any
+		releaseDirectBuffersLocked();
+		
+		// No frames to move the zoom or look for faces anymore
+		mSmoothZoom = false;
+		mFaceDetector.stop();
     }
 
     LOGD("CameraHardware::stopPreviewLocked: OK");
@@ -567,11 +748,8 @@ void CameraHardware::stopPreview()
 
 int CameraHardware::isPreviewEnabled() 
 {
-    int enabled = 0;
-    {
-        Mutex::Autolock lock(mLock);
-        enabled = (mPreviewThread != 0);
-    }
+	// Answered without the lock, so it never waits for the preview thread
+    int enabled = android_atomic_acquire_load(&mPreviewEnabled);
     LOGD("CameraHardware::isPreviewEnabled: %d", enabled);
 
     return enabled;
@@ -581,11 +759,16 @@ status_t CameraHardware::storeMetaDataInBuffers(int value)
 {
     LOGD("CameraHardware::storeMetaDataInBuffers: %d", value);
 	
-	// Do not accept to store metadata in buffers - We will always store
-	//  YUV data on video buffers. Metadata, in the case of Nvidia Tegra2
-	//  is a descriptor of an OpenMax endpoint that was filled with the
-	//  data.
-    return (value) ? INVALID_OPERATION : NO_ERROR;
+	// When storing metadata, the video buffers just hold the gralloc buffer
+	//  the frame was converted into, and the encoder reads it in place, saving
+	//  a full frame copy. The recording pool is rebuilt by initHeapLocked
+    Mutex::Autolock lock(mLock);
+	if (mRecordingEnabled && mStoreMetaData != (value != 0)) {
+		LOGE("CameraHardware::storeMetaDataInBuffers: can't be changed while recording");
+		return INVALID_OPERATION;
+	}
+	mStoreMetaData = (value != 0);
+    return NO_ERROR;
 }
 
 status_t CameraHardware::startRecording()
@@ -596,6 +779,14 @@ status_t CameraHardware::startRecording()
 		if (!mRecordingEnabled) {
 			mRecordingEnabled = true;
 			
+			// Start counting from scratch
+			{
+				Mutex::Autolock recLock(mRecordingLock);
+				mRecordingFramesSent = 0;
+				mRecordingFramesDropped = 0;
+			}
+			resetStats(true);
+			
 			// If something changed related to the starting or stopping of
 			//  the recording process...
 			if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
@@ -617,6 +808,11 @@ void CameraHardware::stopRecording()
 		if (mRecordingEnabled) {
 			mRecordingEnabled = false;
 			
+			{
+				Mutex::Autolock recLock(mRecordingLock);
+				LOGI("CameraHardware::stopRecording: %d frames sent, %d dropped as the encoder held all buffers", mRecordingFramesSent, mRecordingFramesDropped);
+			}
+			
 			// If something changed related to the starting or stopping of
 			//  the recording process...
 			if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
@@ -642,7 +838,93 @@ int CameraHardware::isRecordingEnabled()
 
 void CameraHardware::releaseRecordingFrame(const void* mem)
 {
-    LOGD("CameraHardware::releaseRecordingFrame");
+    Mutex::Autolock lock(mRecordingLock);
+	
+	int idx = getRecordingBufferIndex(mem);
+	if (idx < 0) {
+		LOGE("CameraHardware::releaseRecordingFrame: unknown buffer %p", mem);
+		return;
+	}
+	if (!mRecBufferOwned[idx]) {
+		LOGW("CameraHardware::releaseRecordingFrame: buffer %d was not in use", idx);
+	}
+	
+	// The encoder is done with it: It can be filled again
+	mRecBufferOwned[idx] = false;
+    LOGD("CameraHardware::releaseRecordingFrame: %d", idx);
+}
+
+/* Get the next recording buffer not owned by the encoder, and mark it as
+   owned. Returns -1, and counts a dropped frame, if all of them are in use */
+int CameraHardware::acquireRecordingBuffer()
+{
+    Mutex::Autolock lock(mRecordingLock);
+	
+	for (int i = 0; i < kBufferCount; i++) {
+		int idx = (mCurrentRecordingFrame + i) % kBufferCount;
+		if (!mRecBufferOwned[idx]) {
+			mRecBufferOwned[idx] = true;
+			mCurrentRecordingFrame = (idx + 1) % kBufferCount;
+			mRecordingFramesSent++;
+			return idx;
+		}
+	}
+	
+	mRecordingFramesDropped++;
+	return -1;
+}
+
+/* Start collecting the performance statistics from scratch */
+void CameraHardware::resetStats(bool recordingOnly)
+{
+	Mutex::Autolock lock(mStatsLock);
+	nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+	
+	mStageStats[STAGE_RECORD].reset();
+	mRecordingFps.reset(now);
+	if (recordingOnly)
+		return;
+		
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		mStageStats[i].reset();
+	}
+	mPreviewFps.reset(now);
+	mCallbackFps.reset(now);
+}
+
+/* Returns the index into the recording pool of a buffer handed out to the
+   encoder, either a frame or its metadata, or -1 if not ours */
+int CameraHardware::getRecordingBufferIndex(const void* opaque) const
+{
+	const char* p = (const char*) opaque;
+	int size = mRecordingMeta ? (int) sizeof(VideoMetadata) : mRecordingFrameSize;
+	
+	if (mRecordingHeap && size > 0) {
+		const char* base = (const char*) mRecordingHeap->data;
+		if (p >= base && p < base + kBufferCount * size) {
+			return (p - base) / size;
+		}
+	}
+	
+	return -1;
+}
+
+/* Free the recording pool, and the gralloc buffers if storing metadata */
+void CameraHardware::freeRecordingPoolLocked()
+{
+	if (mRecordingHeap) {
+		mRecordingHeap->release(mRecordingHeap);
+		mRecordingHeap = NULL;
+	}
+	memset(mRecBuffers,0,sizeof(mRecBuffers));
+	
+	GraphicBufferAllocator& allocator(GraphicBufferAllocator::get());
+	for (int i = 0; i < kBufferCount; i++) {
+		if (mRecGrBuf[i]) {
+			allocator.free(mRecGrBuf[i]);
+			mRecGrBuf[i] = NULL;
+		}
+	}
 }
 
 
@@ -684,13 +966,13 @@ status_t CameraHardware::setParameters(const char* parms)
     String8 str8_param(parms);
     params.unflatten(str8_param);
 	
-    Mutex::Autolock lock(mLock);
-	
-	// If no changes, trivially accept it!
-	if (params.flatten() == mParameters.flatten()) {
+	// If no changes, trivially accept it! Without waiting for the preview thread
+	if (params.flatten() == getConfig()->flat) {
 		LOGD("Trivially accept it. No changes detected");
 		return NO_ERROR;
 	}
+	
+    Mutex::Autolock lock(mLock);
 
 	if (strcmp(params.getPreviewFormat(),"yuv422i-yuyv") && 
 		strcmp(params.getPreviewFormat(),"yuv422sp") && 
@@ -724,13 +1006,37 @@ status_t CameraHardware::setParameters(const char* parms)
     params.getVideoSize(&w, &h);
     LOGD("CameraHardware::setParameters: VIDEO: Size %dx%d, format: %s", w, h, params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
 	
+	int zoom = params.getInt(CameraParameters::KEY_ZOOM);
+	if (zoom < 0 || zoom > ZOOM_STEPS) {
+        LOGE("CameraHardware::setParameters: Invalid zoom level %d",zoom);
+        return BAD_VALUE;
+	}
+	
+	int cbfps = params.getInt(KEY_PREVIEW_CALLBACK_FPS);
+	if (cbfps > 0 && cbfps < params.getPreviewFrameRate()) {
+		mPreviewCallbackInterval = seconds_to_nanoseconds(1) / cbfps;
+	} else {
+		mPreviewCallbackInterval = 0;
+	}
+	mNextPreviewCallback = 0;
+    LOGD("CameraHardware::setParameters: PREVIEW CALLBACKS: %d fps max", cbfps);
+	
 	// Store the new parameters
     mParameters = params;
+	
+	// While zooming smoothly, the preview thread owns the zoom level
+	if (mSmoothZoom) {
+		mParameters.set(CameraParameters::KEY_ZOOM, mZoom);
+	} else {
+		mZoom = zoom;
+	}
 
 	// Recreate the heaps if toggling recording changes the raw preview size
 	//  and also restart the preview so we use the new size if needed
 	initHeapLocked();
 	
+	publishConfigLocked();
+	
     LOGD("CameraHardware::setParameters: OK");
 
     return NO_ERROR;
@@ -743,11 +1049,10 @@ char* CameraHardware::getParameters()
 {
     LOGD("CameraHardware::getParameters");
 
-    String8 params;
-    {
-        Mutex::Autolock lock(mLock);
-		params = mParameters.flatten();
-    }
+	// The published snapshot is already flattened, and the preview thread 
+	//  never holds its lock
+	sp<CameraConfig> config = getConfig();
+	const String8& params = config->flat;
     
     char* ret_str =
         reinterpret_cast<char*>(malloc(sizeof(char) * (params.length()+1)));
@@ -773,8 +1078,61 @@ void CameraHardware::putParameters(char* params)
 
 status_t CameraHardware::sendCommand(int32_t command, int32_t arg1, int32_t arg2)
 {
-    LOGD("CameraHardware::sendCommand");
-    return 0;
+    LOGD("CameraHardware::sendCommand: %d, %d, %d", command, arg1, arg2);
+	
+    Mutex::Autolock lock(mLock);
+	
+	switch (command) {
+	case CAMERA_CMD_START_SMOOTH_ZOOM:
+		if (arg1 < 0 || arg1 > ZOOM_STEPS) {
+			LOGE("CameraHardware::sendCommand: Invalid zoom level %d", arg1);
+			return BAD_VALUE;
+		}
+		if (mPreviewThread == 0) {
+			LOGE("CameraHardware::sendCommand: Smooth zoom needs the preview running");
+			return INVALID_OPERATION;
+		}
+		
+		// The preview thread moves one level per frame towards the target, 
+		//  reporting each one
+		mZoomTarget = arg1;
+		mSmoothZoom = true;
+		break;
+		
+	case CAMERA_CMD_STOP_SMOOTH_ZOOM:
+		// Stop at the current level. The preview thread reports it
+		mZoomTarget = mZoom;
+		if (mPreviewThread == 0) {
+			mSmoothZoom = false;
+		}
+		break;
+		
+	case CAMERA_CMD_START_FACE_DETECTION:
+		if (arg1 != CAMERA_FACE_DETECTION_SW || !FaceDetector::isAvailable()) {
+			LOGE("CameraHardware::sendCommand: Face detection type %d not supported", arg1);
+			return BAD_VALUE;
+		}
+		if (mPreviewThread == 0) {
+			LOGE("CameraHardware::sendCommand: Face detection needs the preview running");
+			return INVALID_OPERATION;
+		}
+		
+		// The faces are reported as metadata, but the callback wants some data
+		if (!mFaceMetaHeap) {
+			mFaceMetaHeap = mRequestMemory(-1, 1, 1, NULL);
+			if (!mFaceMetaHeap) {
+				LOGE("Unable to allocate memory for face metadata");
+				return NO_MEMORY;
+			}
+		}
+		return mFaceDetector.start();
+		
+	case CAMERA_CMD_STOP_FACE_DETECTION:
+		mFaceDetector.stop();
+		break;
+	}
+	
+    return NO_ERROR;
 }
 
 void CameraHardware::releaseCamera()
@@ -783,12 +1141,71 @@ void CameraHardware::releaseCamera()
     if (mPreviewThread != 0) {
         stopPreview();
     }
+	
+	// Give back the raw preview buffer, it is taken again if the preview restarts.
+	//  And nobody is going to reuse the cached frame memory soon
+	{
+		Mutex::Autolock lock(mLock);
+		if (mRawPreviewFrame) {
+			mRawPreviewFrame->release();
+			mRawPreviewFrame = NULL;
+		}
+		mRawPreviewBuffer = NULL;
+		mRawPreviewFrameSize = 0;
+	}
+	FramePool::get().trim();
 }
 
 status_t CameraHardware::dumpCamera(int fd)
 {
     LOGD("dump");
-    return -EINVAL;
+	
+	String8 result;
+	{
+		Mutex::Autolock lock(mRecordingLock);
+		
+		int owned = 0;
+		for (int i = 0; i < kBufferCount; i++) {
+			if (mRecBufferOwned[i]) 
+				owned++;
+		}
+		result.appendFormat("  Direct rendering: %s, window buffers held by camera: %d\n",
+			mDirectRender ? "yes" : "no", mDirectQueued);
+		result.appendFormat("  Zoom: level %d (%d.%02dx)%s\n",
+			mZoom, zoomRatio(mZoom) / 100, zoomRatio(mZoom) % 100, mSmoothZoom ? ", smooth zooming" : "");
+		result.appendFormat("  Preview callbacks: max %d fps, %d frames skipped\n",
+			mPreviewCallbackInterval ? (int)(seconds_to_nanoseconds(1) / mPreviewCallbackInterval) : 0,
+			mPreviewCallbacksSkipped);
+		result.appendFormat("  Recording: %s%s\n",
+			mRecordingEnabled ? "yes" : "no", mRecordingMeta ? ", metadata in buffers" : "");
+		result.appendFormat("  Recording frames sent: %d, dropped: %d, buffers held by encoder: %d/%d\n",
+			mRecordingFramesSent, mRecordingFramesDropped, owned, kBufferCount);
+	}
+	
+	{
+		static const char* const stageNames[STAGE_COUNT] = {
+			"dqbuf", "decode", "record", "preview", "display", "callbacks", "frame"
+		};
+		
+		Mutex::Autolock lock(mStatsLock);
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+		
+		result.appendFormat("  Frame rates:\n");
+		mPreviewFps.dump(result, "display", now);
+		mCallbackFps.dump(result, "callbacks", now);
+		mRecordingFps.dump(result, "recording", now);
+		
+		result.appendFormat("  Latencies per stage:\n");
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			mStageStats[i].dump(result, stageNames[i]);
+		}
+	}
+	
+	mFaceDetector.dump(result);
+	FramePool::get().dump(result);
+	
+	::write(fd, result.string(), result.size());
+    return NO_ERROR;
 }
 
 // ---------------------------------------------------------------------------
@@ -808,7 +1225,7 @@ void CameraHardware::initDefaultParameters()
 	SortedVector<SurfaceSize> avSizes;
 	SortedVector<int> avFps;
 	
-    if (camera.Open(VIDEO_DEVICE) != NO_ERROR) {
+    if (camera.Open(mVideoDevice) != NO_ERROR) {
 	    LOGE("cannot open device.");
 
     } else {
@@ -954,6 +1371,9 @@ void CameraHardware::initDefaultParameters()
     p.set(CameraParameters::KEY_VIDEO_FRAME_FORMAT, CameraParameters::PIXEL_FORMAT_YUV420P);
     p.set("preferred-preview-size-for-video", "640x480");
 	
+	// Preview callbacks at the full preview rate
+	p.set(KEY_PREVIEW_CALLBACK_FPS, "0");
+	
 	// supported rotations
 	p.set("rotation-values","0");
 	p.set(CameraParameters::KEY_ROTATION,"0");
@@ -966,13 +1386,21 @@ void CameraHardware::initDefaultParameters()
 	p.set(CameraParameters::KEY_SUPPORTED_WHITE_BALANCE,CameraParameters::WHITE_BALANCE_AUTO);
 	p.set(CameraParameters::KEY_WHITE_BALANCE,CameraParameters::WHITE_BALANCE_AUTO);
 
-	// zoom
-	p.set(CameraParameters::KEY_SMOOTH_ZOOM_SUPPORTED,"false");
+	// zoom: digital, cropping and scaling the captured frames
+	String8 ratios("");
+	for (i = 0; i <= ZOOM_STEPS; i++) {
+		ratios.appendFormat(i ? ",%d" : "%d", zoomRatio(i));
+	}
+	p.set(CameraParameters::KEY_SMOOTH_ZOOM_SUPPORTED,"true");
 	p.set("max-video-continuous-zoom", 0 );
 	p.set(CameraParameters::KEY_ZOOM, "0");
-    p.set(CameraParameters::KEY_MAX_ZOOM, "100");
-    p.set(CameraParameters::KEY_ZOOM_RATIOS, "100");
-    p.set(CameraParameters::KEY_ZOOM_SUPPORTED, "false");
+    p.set(CameraParameters::KEY_MAX_ZOOM, ZOOM_STEPS);
+    p.set(CameraParameters::KEY_ZOOM_RATIOS, ratios.string());
+    p.set(CameraParameters::KEY_ZOOM_SUPPORTED, "true");
+
+	// face detection: in software, only if there is a cascade to use
+	p.set(CameraParameters::KEY_MAX_NUM_DETECTED_FACES_HW, 0);
+	p.set(CameraParameters::KEY_MAX_NUM_DETECTED_FACES_SW, FaceDetector::isAvailable() ? FACE_MAX_FACES : 0);
 
 	// Focal lenght
 	p.set(CameraParameters::KEY_FOCAL_LENGTH, "0.9");
@@ -982,6 +1410,32 @@ void CameraHardware::initDefaultParameters()
     }
 }
 
+CameraConfig::CameraConfig(const CameraParameters& p)
+	: params(p),
+	  flat(p.flatten()),
+	  previewFrameRate(p.getPreviewFrameRate())
+{
+	// Never divide by zero, even before the defaults are set
+	if (previewFrameRate <= 0)
+		previewFrameRate = 15;
+}
+
+/* Publish a snapshot of mParameters. Must be called after changing them */
+void CameraHardware::publishConfigLocked()
+{
+	sp<CameraConfig> config = new CameraConfig(mParameters);
+	
+	// The old snapshot is freed when its last reader drops it
+	Mutex::Autolock lock(mConfigLock);
+	mConfig = config;
+}
+
+sp<CameraConfig> CameraHardware::getConfig() const
+{
+	Mutex::Autolock lock(mConfigLock);
+	return mConfig;
+}
+
 void CameraHardware::initHeapLocked()
 {
     LOGD("CameraHardware::initHeapLocked");
@@ -1058,16 +1512,17 @@ void CameraHardware::initHeapLocked()
 
         mRawPreviewFrameSize = how_raw_preview_big;
 		
-        // Create raw picture heap.
-		if (mRawPreviewHeap) {
-			mRawPreviewHeap->release(mRawPreviewHeap);
-			mRawPreviewHeap = NULL;
+        // Take the raw preview buffer from the frame pool. Nobody outside 
+		//  the HAL sees it
+		if (mRawPreviewFrame) {
+			mRawPreviewFrame->release();
+			mRawPreviewFrame = NULL;
 		}
 		mRawPreviewBuffer = NULL;
 
-		mRawPreviewHeap = mRequestMemory(-1,mRawPreviewFrameSize,1,mCallbackCookie);
-		if (mRawPreviewHeap) { 
-			mRawPreviewBuffer = mRawPreviewHeap->data;
+		mRawPreviewFrame = FramePool::get().acquire(mRawPreviewFrameSize);
+		if (mRawPreviewFrame) { 
+			mRawPreviewBuffer = mRawPreviewFrame->data();
 		} else {
 			LOGE("Unable to allocate memory for RawPreview");
 		}
@@ -1190,7 +1645,7 @@ void CameraHardware::initHeapLocked()
 		how_recording_big = size;
 	}	
 	
-	if (how_recording_big != mRecordingFrameSize) {
+	if (how_recording_big != mRecordingFrameSize || mStoreMetaData != mRecordingMeta) {
 
 		// Stop the preview thread if needed
 		if (!restart_preview && mPreviewThread != 0) {
@@ -1199,22 +1654,50 @@ void CameraHardware::initHeapLocked()
 			LOGD("Stopping preview to allow changes");
 		}
 	
+		// The encoder returns buffers from its own thread, holding only
+		//  mRecordingLock, so the pool must not change under it
+		Mutex::Autolock recLock(mRecordingLock);
+		
         mRecordingFrameSize = how_recording_big;
-	
-		if (mRecordingHeap) {
-			mRecordingHeap->release(mRecordingHeap);
-			mRecordingHeap = NULL;
-		}
-		memset(mRecBuffers,0,sizeof(mRecBuffers));
-
-		mRecordingHeap = mRequestMemory(-1,mRecordingFrameSize,kBufferCount,mCallbackCookie);
-		if (mRecordingHeap) { 
-			// Make an IMemory for each frame so that we can reuse them in callbacks.
-			for (int i = 0; i < kBufferCount; i++) {
-				mRecBuffers[i] = (char*)mRecordingHeap->data + (i * mRecordingFrameSize);
+		mRecordingMeta = mStoreMetaData;
+		freeRecordingPoolLocked();
+		
+		// Forget about buffer ownership: They all belong to the new pool
+		memset(mRecBufferOwned, 0, sizeof(mRecBufferOwned));
+		mCurrentRecordingFrame = 0;
+
+		if (mRecordingMeta) {
+			// The encoder gets metadata pointing to gralloc buffers we convert the frames into
+			mRecordingHeap = mRequestMemory(-1,sizeof(VideoMetadata),kBufferCount,mCallbackCookie);
+			if (mRecordingHeap) {
+				GraphicBufferAllocator& allocator(GraphicBufferAllocator::get());
+				VideoMetadata* meta = (VideoMetadata*) mRecordingHeap->data;
+				for (int i = 0; i < kBufferCount; i++) {
+					int32_t stride = 0;
+					if (allocator.alloc(video_width, video_height, recordingGrallocFormat(mRecFmt),
+							GRALLOC_USAGE_SW_WRITE_OFTEN | GRALLOC_USAGE_HW_VIDEO_ENCODER,
+							&mRecGrBuf[i], &stride) != NO_ERROR) {
+						LOGE("Unable to allocate gralloc buffers for Recording");
+						freeRecordingPoolLocked();
+						break;
+					}
+					mRecGrStride = stride;
+					meta[i].type = METADATA_BUFFER_TYPE_GRALLOC;
+					meta[i].handle = mRecGrBuf[i];
+				}
+			} else {
+				LOGE("Unable to allocate memory for Recording metadata");
 			}
 		} else {
-			LOGE("Unable to allocate memory for Recording");
+			mRecordingHeap = mRequestMemory(-1,mRecordingFrameSize,kBufferCount,mCallbackCookie);
+			if (mRecordingHeap) { 
+				// Make an IMemory for each frame so that we can reuse them in callbacks.
+				for (int i = 0; i < kBufferCount; i++) {
+					mRecBuffers[i] = (char*)mRecordingHeap->data + (i * mRecordingFrameSize);
+				}
+			} else {
+				LOGE("Unable to allocate memory for Recording");
+			}
 		}
 	
         LOGD("CameraHardware::initHeapLocked: recording heap allocated");
@@ -1279,9 +1762,10 @@ void CameraHardware::initHeapLocked()
 
 int CameraHardware::previewThread()
 {
-    LOGD("CameraHardware::previewThread: this=%p",this);
+    LOGD_FRAME("CameraHardware::previewThread: this=%p",this);
 
-    int previewFrameRate = mParameters.getPreviewFrameRate();
+	// mParameters can't be read before taking the lock
+    int previewFrameRate = getConfig()->previewFrameRate;
 
     // Calculate how long to wait between frames.
     int delay = (int)(1000000 / previewFrameRate);
@@ -1292,6 +1776,22 @@ int CameraHardware::previewThread()
 	
 	bool record = false;
 	bool preview = false;
+	bool grabbed = false;
+	camera_memory_t* recHeap = NULL;
+	
+	// Smooth zoom progress to report
+	bool zoomNotify = false;
+	int zoomValue = 0;
+	bool zoomStopped = false;
+	
+	// Faces to report
+	camera_face_t faces[FACE_MAX_FACES];
+	int numFaces = 0;
+	bool facesNotify = false;
+	
+	// Time spent in each stage of this frame
+	nsecs_t stageTime[STAGE_COUNT];
+	memset(stageTime, 0, sizeof(stageTime));
 
 	// Get the current timestamp
 	nsecs_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
@@ -1322,16 +1822,68 @@ int CameraHardware::previewThread()
 		}
 
 
-		//  Get a pointer to the memory area to use... In case of previewing in YUV422I, we
-		// can save a buffer copy by directly using the output buffer. But ONLY if NOT recording
-		// or, in case of recording, when size matches
-		uint8_t* rawBase = (mPreviewFmt == PIXEL_FORMAT_YCrCb_422_I && 
-							(!mRecordingEnabled || mRawPreviewFrameSize == mPreviewFrameSize)) 
-							? frame
-							:(uint8_t*)mRawPreviewBuffer;
+		// Smooth zoom moves one level per frame
+		if (mSmoothZoom) {
+			if (mZoom != mZoomTarget) {
+				mZoom += (mZoomTarget > mZoom) ? 1 : -1;
+				mParameters.set(CameraParameters::KEY_ZOOM, mZoom);
+				publishConfigLocked();
+			}
+			zoomNotify = (mMsgEnabled & CAMERA_MSG_ZOOM) != 0;
+			zoomValue = mZoom;
+			zoomStopped = (mZoom == mZoomTarget);
+			if (zoomStopped) {
+				mSmoothZoom = false;
+			}
+		}
+		
+		// The camera can't zoom into the window buffers: Copy zoomed frames
+		if (mDirectRender && mZoom) {
+			stopDirectRenderLocked();
+			NegotiatePreviewFormat(mWin, false);
+		}
+
+		uint8_t* rawBase;
+		int directSlot = -1;
+		if (mDirectRender) {
+		
+			// The camera captured the frame straight into a preview window buffer
+			directSlot = dequeueDirectBufferLocked();
+			if (directSlot < 0) {
+				mLock.unlock();
+				return NO_ERROR;
+			}
+			rawBase = (uint8_t*)mDirectAddr[directSlot];
+			
+		} else {
+		
+			//  Get a pointer to the memory area to use... In case of previewing in YUV422I, we
+			// can save a buffer copy by directly using the output buffer. But ONLY if NOT recording
+			// or, in case of recording, when size matches. Zoomed frames are always converted
+			rawBase = (mPreviewFmt == PIXEL_FORMAT_YCrCb_422_I && !mZoom &&
+						(!mRecordingEnabled || mRawPreviewFrameSize == mPreviewFrameSize)) 
+						? frame
+						:(uint8_t*)mRawPreviewBuffer;
 							
-		// Grab a frame in the raw format YUYV
-		camera.GrabRawFrame(rawBase, mRawPreviewFrameSize);
+			// Grab a frame in the raw format YUYV
+			camera.GrabRawFrame(rawBase, mRawPreviewFrameSize);
+		}
+		camera.getLastFrameTimes(stageTime[STAGE_DQBUF], stageTime[STAGE_DECODE]);
+		grabbed = true;
+		
+		// When the face detector is idle, hand it the visible area of the frame
+		//  while it is still in the cache. Pick up what it found meanwhile
+		if (mFaceDetector.wantsFrame(timestamp)) {
+			int x = 0, y = 0, cw = mRawPreviewWidth, ch = mRawPreviewHeight;
+			if (mZoom) {
+				getZoomCropLocked(mRawPreviewWidth, mRawPreviewHeight, x, y, cw, ch);
+			}
+			mFaceDetector.putFrame(rawBase + y * (mRawPreviewWidth<<1) + (x<<1), (mRawPreviewWidth<<1), cw, ch, timestamp);
+		}
+		if (mFaceDetector.getFaces(faces, numFaces)) {
+			facesNotify = (mMsgEnabled & CAMERA_MSG_PREVIEW_METADATA) && mFaceMetaHeap;
+		}
+		nsecs_t stageStart = systemTime(SYSTEM_TIME_MONOTONIC);
 
 		// If the recording is enabled...
 		if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
@@ -1341,42 +1893,118 @@ int CameraHardware::previewThread()
 			// size IS exacty equal to the video size, as this condition is enforced
 			// by this driver, that priorizes recording size over preview size requirements
 			
-			uint8_t *recFrame = (uint8_t *) mRecBuffers[mCurrentRecordingFrame];
+			// The callback is made without the lock, so remember the heap
+			recHeap = mRecordingHeap;
+			
+			// Only fill buffers the encoder is not reading. If it holds all of them,
+			//  drop this frame rather than overwriting one in use
+			int recIdx = -1;
+			if (recHeap != NULL && (mRecordingMeta ? mRecGrBuf[0] != 0 : mRecBuffers[0] != 0)) {
+				recIdx = acquireRecordingBuffer();
+				if (recIdx < 0) {
+					LOGD_FRAME("CameraHardware::previewThread: all recording buffers in use, dropping frame");
+				}
+			}
+			
+			// When sending metadata, convert straight into the gralloc buffer the encoder reads
+			uint8_t *recFrame = 0;
+			int recStride = mRawPreviewWidth;
+			if (recIdx >= 0 && mRecordingMeta) {
+				void* vaddr = NULL;
+				Rect bounds(mRawPreviewWidth, mRawPreviewHeight);
+				if (GraphicBufferMapper::get().lock(mRecGrBuf[recIdx], GRALLOC_USAGE_SW_WRITE_OFTEN, bounds, &vaddr) == NO_ERROR) {
+					recFrame = (uint8_t *) vaddr;
+					recStride = mRecGrStride;
+				} else {
+					LOGE("CameraHardware::previewThread: unable to lock recording buffer %d", recIdx);
+					Mutex::Autolock recLock(mRecordingLock);
+					mRecBufferOwned[recIdx] = false;
+					mRecordingFramesSent--;
+				}
+			} else
+			if (recIdx >= 0) {
+				recFrame = (uint8_t *) mRecBuffers[recIdx];
+			}
 			if (recFrame != 0) {
 
 				// Convert from our raw frame to the one the Record requires
-				switch (mRecFmt) {
+				if (mZoom) {
 				
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-				case PIXEL_FORMAT_YCbCr_422_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
+					// Crop and scale while converting. OMX recorder needs YUV, but
+					//  gralloc YV12 buffers are YVU
+					int x, y, cw, ch;
+					getZoomCropLocked(mRawPreviewWidth, mRawPreviewHeight, x, y, cw, ch);
+					int zfmt = (mRecFmt == PIXEL_FORMAT_YV12 && !mRecordingMeta) ? ZOOM_YUV420P : zoomFormat(mRecFmt);
+					int stride = (zfmt == ZOOM_YUYV) ? (recStride << 1) : recStride;
+					yuyv_zoom(zfmt, recFrame, stride, mRawPreviewHeight, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), x, y, cw, ch, camera.getColorspace());
 					
-				case PIXEL_FORMAT_YCbCr_420_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
+				} else {
+					switch (mRecFmt) {
 				
-				case PIXEL_FORMAT_YV12:
-					/* OMX recorder needs YUV */
-					yuyv_to_yuv420p(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
+					// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
+					// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
+					case PIXEL_FORMAT_YCbCr_422_SP:
+						yuyv_to_yvu420sp(recFrame, recStride, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
+						break;
+					
+					case PIXEL_FORMAT_YCbCr_420_SP:
+						yuyv_to_yvu420sp(recFrame, recStride, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
+						break;
 				
-				case PIXEL_FORMAT_YCrCb_422_I:
-					memcpy(recFrame, rawBase, mRecordingFrameSize);
-					break; 
+					case PIXEL_FORMAT_YV12:
+						if (mRecordingMeta) {
+							yuyv_to_yvu420p(recFrame, recStride, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
+						} else {
+							/* OMX recorder needs YUV */
+							yuyv_to_yuv420p(recFrame, recStride, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
+						}
+						break;
+				
+					case PIXEL_FORMAT_YCrCb_422_I:
+						if (recStride == mRawPreviewWidth) {
+							memcpy(recFrame, rawBase, mRecordingFrameSize);
+						} else {
+							for (int h = 0; h < mRawPreviewHeight; h++) {
+								memcpy(recFrame + h * (recStride << 1), rawBase + h * (mRawPreviewWidth << 1), mRawPreviewWidth << 1);
+							}
+						}
+						break; 
+					}
+				}
+				
+				if (mRecordingMeta) {
+					GraphicBufferMapper::get().unlock(mRecGrBuf[recIdx]);
 				}
 				
 				// Remember we must schedule the callback
 				record = true;
+				recBufferIdx = recIdx;
 				
-				// Advance the buffer pointer.
-				recBufferIdx = mCurrentRecordingFrame;
-				mCurrentRecordingFrame = (mCurrentRecordingFrame + 1) % kBufferCount;
+				nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+				stageTime[STAGE_RECORD] = now - stageStart;
+				stageStart = now;
 			}
 		}
 
+		// Preview callbacks may be wanted at a lower rate than the display. Frames
+		//  nobody will receive are not even converted, and only the latest frame 
+		//  is delivered when a callback is due. Allow half a frame of jitter
+		bool previewDue = false;
 		if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+			if (timestamp + (us2ns(delay) >> 1) >= mNextPreviewCallback) {
+				previewDue = true;
+				
+				// Keep the cadence, but never try to catch up on missed callbacks
+				mNextPreviewCallback += mPreviewCallbackInterval;
+				if (mNextPreviewCallback <= timestamp) {
+					mNextPreviewCallback = timestamp + mPreviewCallbackInterval;
+				}
+			} else {
+				mPreviewCallbacksSkipped++;
+			}
+		}
+		
+		if (previewDue) {
 			//LOGD("CameraHardware::previewThread: posting preview frame...");
 
 			// Here we could eventually have a problem: If we are recording, the recording size
@@ -1399,41 +2027,52 @@ int CameraHardware::previewThread()
 				cheight = mRawPreviewHeight;
 
 			// Convert from our raw frame to the one the Preview requires
-			switch (mPreviewFmt) {
+			if (mZoom) {
+			
+				// Crop and scale while converting
+				int x, y, cw, ch;
+				getZoomCropLocked(mRawPreviewWidth, mRawPreviewHeight, x, y, cw, ch);
+				int zfmt = zoomFormat(mPreviewFmt);
+				int stride = (zfmt == ZOOM_YUYV) ? (width << 1) : width;
+				yuyv_zoom(zfmt, frame, stride, height, cwidth, cheight, rawBase, (mRawPreviewWidth<<1), x, y, cw, ch, camera.getColorspace());
+				
+			} else {
+				switch (mPreviewFmt) {
 			
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-			case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
+					// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
+					// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
+				case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+					yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+					break;
 				
-			case PIXEL_FORMAT_YCbCr_420_SP:
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
+				case PIXEL_FORMAT_YCbCr_420_SP:
+					yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+					break;
 
-			case PIXEL_FORMAT_YV12:
-				yuyv_to_yvu420p(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
+				case PIXEL_FORMAT_YV12:
+					yuyv_to_yvu420p(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+					break;
 				
-			case PIXEL_FORMAT_YCrCb_422_I:
-				// Nothing to do here. Is is handled as a special case without buffer copies...
-				//  but ONLY in special cases... Otherwise, handle the copy!
-				if (mRecordingEnabled && mRawPreviewFrameSize != mPreviewFrameSize) {
-					// We need to copy ... do it
-					uint8_t* dst = frame;
-					uint8_t* src = rawBase;
-					int h;
-					for (h = 0; h < cheight; h++) {
-						memcpy(dst,src,cwidth<<1);
-						dst += width << 1;
-						src += mRawPreviewWidth<<1;
+				case PIXEL_FORMAT_YCrCb_422_I:
+					// Nothing to do here. Is is handled as a special case without buffer copies...
+					//  but ONLY in special cases... Otherwise, handle the copy!
+					if (rawBase != frame) {
+						// We need to copy ... do it
+						uint8_t* dst = frame;
+						uint8_t* src = rawBase;
+						int h;
+						for (h = 0; h < cheight; h++) {
+							memcpy(dst,src,cwidth<<1);
+							dst += width << 1;
+							src += mRawPreviewWidth<<1;
+						}
 					}
-				}
-				break; 
+					break; 
 				
-			default:
-				LOGE("Unhandled pixel format");
+				default:
+					LOGE("Unhandled pixel format");
 
+				}
 			}
 			
 			// Remember we must schedule the callback
@@ -1442,10 +2081,19 @@ int CameraHardware::previewThread()
 			// Advance the buffer pointer.
 			previewBufferIdx = mCurrentPreviewFrame;
 			mCurrentPreviewFrame = (mCurrentPreviewFrame + 1) % kBufferCount;
+			
+			nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+			stageTime[STAGE_PREVIEW] = now - stageStart;
+			stageStart = now;
 		}
 
 		// Display the preview image
-		fillPreviewWindow(rawBase, mRawPreviewWidth, mRawPreviewHeight);
+		if (directSlot >= 0) {
+			displayDirectBufferLocked(directSlot);
+		} else {
+			fillPreviewWindow(rawBase, mRawPreviewWidth, mRawPreviewHeight);
+		}
+		stageTime[STAGE_DISPLAY] = systemTime(SYSTEM_TIME_MONOTONIC) - stageStart;
 		
 		// Release the lock
 		mLock.unlock();
@@ -1458,16 +2106,57 @@ int CameraHardware::previewThread()
 
 	// We must schedule the callbacks Outside the lock, or the caller
 	//  could call us and cause a deadlock!
-	if (preview) {
-	    mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, previewBufferIdx, NULL, mCallbackCookie);
+	nsecs_t callbackStart = systemTime(SYSTEM_TIME_MONOTONIC);
+	if (zoomNotify || preview || record || facesNotify) {
+		Callbacks cb = getCallbacks();
+		
+		if (zoomNotify) {
+			cb.notify(CAMERA_MSG_ZOOM, zoomValue, zoomStopped, cb.cookie);
+		}
+		
+		if (preview) {
+			cb.data(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, previewBufferIdx, NULL, cb.cookie);
+		}
+		
+		if (record) {
+			// Record callback uses a timestamped frame
+			cb.dataTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, recHeap, recBufferIdx, cb.cookie);
+		}
+		
+		if (facesNotify) {
+			camera_frame_metadata_t metadata;
+			metadata.number_of_faces = numFaces;
+			metadata.faces = faces;
+			cb.data(CAMERA_MSG_PREVIEW_METADATA, mFaceMetaHeap, 0, &metadata, cb.cookie);
+		}
 	}
 	
-	if (record) {
-		// Record callback uses a timestamped frame
-        mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, mRecordingHeap, recBufferIdx, mCallbackCookie);
+	// Account for this frame
+	if (grabbed) {
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+		stageTime[STAGE_CALLBACKS] = now - callbackStart;
+		stageTime[STAGE_FRAME] = now - timestamp;
+		
+		Mutex::Autolock lock(mStatsLock);
+		mStageStats[STAGE_DQBUF].add(stageTime[STAGE_DQBUF]);
+		mStageStats[STAGE_DECODE].add(stageTime[STAGE_DECODE]);
+		if (record)
+			mStageStats[STAGE_RECORD].add(stageTime[STAGE_RECORD]);
+		if (preview)
+			mStageStats[STAGE_PREVIEW].add(stageTime[STAGE_PREVIEW]);
+		mStageStats[STAGE_DISPLAY].add(stageTime[STAGE_DISPLAY]);
+		if (record || preview)
+			mStageStats[STAGE_CALLBACKS].add(stageTime[STAGE_CALLBACKS]);
+		mStageStats[STAGE_FRAME].add(stageTime[STAGE_FRAME]);
+		
+		mPreviewFps.tick(now);
+		if (preview)
+			mCallbackFps.tick(now);
+		if (record)
+			mRecordingFps.tick(now);
 	}
 
-    LOGD("previewThread OK");
+    LOGD_FRAME("previewThread OK");
 
     // Wait for it...
     usleep(delay);
@@ -1557,69 +2246,80 @@ void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeigh
 		mPreviewWinFmt == PIXEL_FORMAT_BGRA_8888) {
 		bytesPerPixel = 4;
 	} else
-	if (mPreviewWinFmt == PIXEL_FORMAT_YCrCb_422_I) {
+	if (mPreviewWinFmt == PIXEL_FORMAT_YCrCb_422_I ||
+		mPreviewWinFmt == HAL_PIXEL_FORMAT_YCbCr_422_I) {
 		bytesPerPixel = 2;
 	}
 
-	LOGD("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
+	LOGD_FRAME("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
 
 	// Based on the destination pixel type, we must convert from YUYV to it
 	int dstStride = bytesPerPixel * stride;
 	uint8_t* dst  = ((uint8_t*)vaddr) + (xStart * bytesPerPixel) + (dstStride * yStart);
 
-	switch (mPreviewWinFmt) {
-	case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
+	if (mZoom) {
+	
+		// Crop and scale while converting
+		int x, y, cw, ch;
+		getZoomCropLocked(srcWidth, srcHeight, x, y, cw, ch);
+		yuyv_zoom(zoomFormat(mPreviewWinFmt), dst, dstStride, mPreviewWinHeight, srcWidth, srcHeight, src, srcStride, x, y, cw, ch, camera.getColorspace());
 		
-	case PIXEL_FORMAT_YCbCr_420_SP:
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight,src, srcStride, srcWidth, srcHeight);
-		break;
+	} else {
+		switch (mPreviewWinFmt) {
+		case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+			yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
+			break;
 		
-	case PIXEL_FORMAT_YV12:
-		yuyv_to_yvu420p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_YCbCr_420_SP:
+			yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight,src, srcStride, srcWidth, srcHeight);
+			break;
+		
+		case PIXEL_FORMAT_YV12:
+			yuyv_to_yvu420p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
+			break;
 
-	case PIXEL_FORMAT_YV16:
-		yuyv_to_yvu422p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_YV16:
+			yuyv_to_yvu422p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
+			break;
 		
-	case PIXEL_FORMAT_YCrCb_422_I:
-	{
-		// We need to copy ... do it
-		uint8_t* pdst = dst;
-		uint8_t* psrc = src;
-		int h;
-		for (h = 0; h < srcHeight; h++) {
-			memcpy(pdst,psrc,srcWidth<<1);
-			pdst += dstStride;
-			psrc += srcStride;
+		case PIXEL_FORMAT_YCrCb_422_I:
+		case HAL_PIXEL_FORMAT_YCbCr_422_I:
+		{
+			// We need to copy ... do it
+			uint8_t* pdst = dst;
+			uint8_t* psrc = src;
+			int h;
+			for (h = 0; h < srcHeight; h++) {
+				memcpy(pdst,psrc,srcWidth<<1);
+				pdst += dstStride;
+				psrc += srcStride;
+			}
+			break; 
 		}
-		break; 
-	}
 	
-	case PIXEL_FORMAT_RGB_888:
-		yuyv_to_rgb24(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_RGB_888:
+			yuyv_to_rgb24(src, srcStride, dst, dstStride, srcWidth, srcHeight, camera.getColorspace());
+			break;
 			
-	case PIXEL_FORMAT_RGBA_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_RGBA_8888:
+			yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight, camera.getColorspace());
+			break;
 			
-	case PIXEL_FORMAT_RGBX_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_RGBX_8888:
+			yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight, camera.getColorspace());
+			break;
 			
-	case PIXEL_FORMAT_BGRA_8888:
-		yuyv_to_bgr32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break; 				
+		case PIXEL_FORMAT_BGRA_8888:
+			yuyv_to_bgr32(src, srcStride, dst, dstStride, srcWidth, srcHeight, camera.getColorspace());
+			break; 				
 		
-	case PIXEL_FORMAT_RGB_565:
-		yuyv_to_rgb565(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
+		case PIXEL_FORMAT_RGB_565:
+			yuyv_to_rgb565(src, srcStride, dst, dstStride, srcWidth, srcHeight, camera.getColorspace());
+			break;
 		
-	default:
-		LOGE("Unhandled pixel format");
+		default:
+			LOGE("Unhandled pixel format");
+		}
 	}
 				
 	/* Show it. */
@@ -1629,6 +2329,159 @@ void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeigh
 	grbuffer_mapper.unlock(*buf);
 }
 
+/* Lend preview window buffers to the camera, so it captures straight into them and
+   no copy is needed to display the frames. Must be called before streaming starts,
+   with the window negotiated in YUYV. Returns false if it is not possible */
+bool CameraHardware::startDirectRenderLocked()
+{
+	if (mWin == 0 || mPreviewWinFmt != HAL_PIXEL_FORMAT_YCbCr_422_I) 
+		return false;
+		
+	// Make sure the window has enough buffers for the camera to hold NB_BUFFER of them
+	int undequeued = 0;
+	mWin->get_min_undequeued_buffer_count(mWin, &undequeued);
+	if (mWin->set_buffer_count(mWin, NB_BUFFER + undequeued) != NO_ERROR) {
+		LOGD("CameraHardware::startDirectRenderLocked: Unable to set the preview window buffer count");
+	}
+	
+	int count = camera.UseUserPtr(NB_BUFFER);
+	if (count < 0)
+		return false;
+		
+	mDirectQueued = 0;
+	for (int i = 0; i < count; i++) {
+		if (!queueDirectBufferLocked(i))
+			break;
+	}
+	
+	// With less than 2 buffers the camera would be dropping every other frame
+	if (mDirectQueued < 2) {
+		LOGD("CameraHardware::startDirectRenderLocked: Preview window buffers not usable by the camera");
+		camera.UseMmap();
+		releaseDirectBuffersLocked();
+		return false;
+	}
+	
+	mDirectRender = true;
+	LOGI("CameraHardware::startDirectRenderLocked: Capturing into %d preview window buffers", mDirectQueued);
+	return true;
+}
+
+/* Go back to capturing into the camera buffers and copying the frames into the 
+   preview window, giving back the window buffers */
+void CameraHardware::stopDirectRenderLocked()
+{
+	LOGI("CameraHardware::stopDirectRenderLocked: Copying frames to the preview window");
+	
+	camera.StopStreaming();
+	camera.UseMmap();
+	releaseDirectBuffersLocked();
+	camera.StartStreaming();
+}
+
+/* Dequeue a preview window buffer, and queue it to the camera to capture into it. 
+   The camera must be able to write frames exactly as the window expects them, 
+   stride included. Otherwise, the buffer is given back */
+bool CameraHardware::queueDirectBufferLocked(int slot)
+{
+	buffer_handle_t* buf = NULL;
+	int stride = 0;
+	status_t res = mWin->dequeue_buffer(mWin, &buf, &stride);
+	if (res != NO_ERROR || buf == NULL) {
+		LOGD("CameraHardware::queueDirectBufferLocked: Unable to dequeue preview window buffer: %d", -res);
+		return false;
+	}
+	
+	res = mWin->lock_buffer(mWin, buf);
+	if (res != NO_ERROR) {
+		mWin->cancel_buffer(mWin, buf);
+		return false;
+	}
+	
+	// Keep the buffer mapped while the camera owns it
+	void* vaddr = NULL;
+	const Rect bounds(mPreviewWinWidth, mPreviewWinHeight);
+	GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
+	res = grbuffer_mapper.lock(*buf, GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN, bounds, &vaddr);
+	if (res != NO_ERROR || vaddr == NULL) {
+		mWin->cancel_buffer(mWin, buf);
+		return false;
+	}
+	
+	int length = (stride << 1) * mPreviewWinHeight;
+	if (!camera.canCaptureDirect(mPreviewWinWidth, mPreviewWinHeight, stride << 1) ||
+		camera.QueueUserPtr(vaddr, length) < 0) {
+		LOGD("CameraHardware::queueDirectBufferLocked: Camera can't capture into buffer (stride: %d)", stride);
+		grbuffer_mapper.unlock(*buf);
+		mWin->cancel_buffer(mWin, buf);
+		return false;
+	}
+	
+	mDirectBuf[slot] = buf;
+	mDirectAddr[slot] = vaddr;
+	mDirectQueued++;
+	return true;
+}
+
+/* Get the next frame captured into a preview window buffer. Returns the slot 
+   holding it, or -1 if none. If the camera can't go on capturing into the 
+   window buffers, falls back to copying frames */
+int CameraHardware::dequeueDirectBufferLocked()
+{
+	void* addr = (mDirectQueued > 0) ? camera.DequeueUserPtr() : NULL;
+	if (addr == NULL) {
+		stopDirectRenderLocked();
+		if (mWin != 0) {
+			NegotiatePreviewFormat(mWin, false);
+		}
+		return -1;
+	}
+	mDirectQueued--;
+	
+	for (int i = 0; i < NB_BUFFER; i++) {
+		if (mDirectAddr[i] == addr) 
+			return i;
+	}
+	
+	LOGE("CameraHardware::dequeueDirectBufferLocked: Unknown buffer %p", addr);
+	return -1;
+}
+
+/* Show a frame captured into a preview window buffer, and lend another
+   window buffer to the camera in its place */
+void CameraHardware::displayDirectBufferLocked(int slot)
+{
+	buffer_handle_t* buf = mDirectBuf[slot];
+	mDirectBuf[slot] = NULL;
+	mDirectAddr[slot] = NULL;
+	
+	GraphicBufferMapper::get().unlock(*buf);
+	mWin->enqueue_buffer(mWin, buf);
+	
+	// If no replacement is available now, the camera goes on with one less 
+	//  buffer. Once it has none left, we fall back to copying frames
+	queueDirectBufferLocked(slot);
+}
+
+/* Give back all the window buffers lent to the camera. The camera must not be
+   using them anymore */
+void CameraHardware::releaseDirectBuffersLocked()
+{
+	GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
+	for (int i = 0; i < NB_BUFFER; i++) {
+		if (mDirectBuf[i] != NULL) {
+			grbuffer_mapper.unlock(*mDirectBuf[i]);
+			if (mWin != 0) {
+				mWin->cancel_buffer(mWin, mDirectBuf[i]);
+			}
+			mDirectBuf[i] = NULL;
+			mDirectAddr[i] = NULL;
+		}
+	}
+	mDirectQueued = 0;
+	mDirectRender = false;
+}
+
 int CameraHardware::beginAutoFocusThread(void *cookie)
 {
     LOGD("CameraHardware::beginAutoFocusThread");
@@ -1639,8 +2492,10 @@ int CameraHardware::beginAutoFocusThread(void *cookie)
 int CameraHardware::autoFocusThread()
 {
     LOGD("CameraHardware::autoFocusThread");
-    if (mMsgEnabled & CAMERA_MSG_FOCUS)
-        mNotifyCb(CAMERA_MSG_FOCUS, true, 0, mCallbackCookie);
+    if (mMsgEnabled & CAMERA_MSG_FOCUS) {
+		Callbacks cb = getCallbacks();
+        cb.notify(CAMERA_MSG_FOCUS, true, 0, cb.cookie);
+	}
     return NO_ERROR;
 }
 
@@ -1678,8 +2533,9 @@ int CameraHardware::pictureThread()
 
 		LOGD("CameraHardware::pictureThread: taking picture (%d x %d)", w, h);
 
-		if (camera.Open(VIDEO_DEVICE) == NO_ERROR) {
-			camera.Init(w, h, 1);
+		if (camera.Open(mVideoDevice) == NO_ERROR) {
+			/* If a jpeg is wanted, prefer the camera's own compressed frames */
+			camera.Init(w, h, 1, (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) != 0);
 			
 			/* Retrieve the real size being used */
 			camera.getSize(w,h);
@@ -1688,6 +2544,7 @@ int CameraHardware::pictureThread()
 
 			/* Store it as the picture size to use */
 			mParameters.setPictureSize(w, h);
+			publishConfigLocked();
 
 			/* And reinit the capture heap to reflect the real used size if needed */
 			initHeapLocked();
@@ -1695,44 +2552,11 @@ int CameraHardware::pictureThread()
 			camera.StartStreaming();
 			
 			LOGD("CameraHardware::pictureThread: waiting until camera picture stabilizes...");
-	
-			int maxFramesToWait = 8;
-			int luminanceStableFor = 0;
-			int prevLuminance = 0;
-			int prevDif = -1;
-			int stride = w << 1;
-			int thresh = (w >> 4) * (h >> 4) * 12; // 5% of full range
-	
-			while (maxFramesToWait > 0 && luminanceStableFor < 4) {
-				uint8_t* ptr = (uint8_t *)mRawBuffer;
-				
-				// Get the image
-				camera.GrabRawFrame(ptr, (w * h << 1)); // Always YUYV
 			
-				// luminance metering points
-				int luminance = 0;
-				for (int x = 0; x < (w<<1); x += 32) {
-					for (int y = 0; y < h*stride; y += 16*stride) {
-						luminance += ptr[y + x];
-					}
-				}
-			  
-				// Calculate variation of luminance
-				int dif = prevLuminance - luminance;
-				if (dif < 0) dif = -dif;
-				prevLuminance = luminance;
-
-				// Wait until variation is less than 5%
-				if (dif > thresh) {
-					luminanceStableFor = 1;
-				} else {
-					luminanceStableFor++;
-				}
-			    
-				maxFramesToWait--;
-	    
-				LOGD("luminance: %4d, dif: %4d, thresh: %d, stableFor: %d, maxWait: %d", luminance, dif, thresh, luminanceStableFor, maxFramesToWait);
-			}
+			/* Grab frames until the auto exposure settles. The last one is the picture */
+			int frames = waitForExposureLocked(w, h);
+			
+			LOGI("CameraHardware::pictureThread: exposure settled after %d frames", frames);
 	
 			LOGD("CameraHardware::pictureThread: picture taken"); 			
 			
@@ -1746,11 +2570,28 @@ int CameraHardware::pictureThread()
 			
 				int quality = mParameters.getInt(CameraParameters::KEY_JPEG_QUALITY);
 
-				uint8_t* jpegBuff = (uint8_t*) malloc(mJpegPictureBufferSize);
-				if (jpegBuff) {
+				FrameBuffer* jpegFrame = FramePool::get().acquire(mJpegPictureBufferSize);
+				FrameBuffer* app1Frame = FramePool::get().acquire(EXIF_MAX_APP1_SIZE);
+				if (jpegFrame && app1Frame) {
+					uint8_t* jpegBuff = (uint8_t*) jpegFrame->data();
+					uint8_t* app1 = (uint8_t*) app1Frame->data();
+					int fileSize = 0;
+					
+					// Exif block, with the thumbnail made out of the raw captured image
+					int app1len = buildExifLocked(app1, EXIF_MAX_APP1_SIZE, w, h);
 					
-					// Compress the raw captured image to our buffer
-					int fileSize = yuyv_to_jpeg((uint8_t *)mRawBuffer, jpegBuff, mJpegPictureBufferSize, w, h, w << 1,quality);
+					// If the camera compresses the frames itself, just use them. But
+					//  zoomed pictures must be cropped
+					if (camera.isJpegCapture() && !mZoom) {
+						fileSize = passthroughJpegLocked(jpegBuff, mJpegPictureBufferSize, w, h, app1, app1len);
+					}
+					
+					// Otherwise, compress the raw captured image to our buffer
+					if (!fileSize) {
+						int x, y, cw, ch;
+						getZoomCropLocked(w, h, x, y, cw, ch);
+						fileSize = yuyv_zoom_to_jpeg((uint8_t *)mRawBuffer, w << 1, x, y, cw, ch, jpegBuff, mJpegPictureBufferSize, w, h, quality, app1len ? app1 : NULL, app1len);
+					}
 					
 					// Create a buffer with the exact compressed size
 					if (mJpegPictureHeap) {
@@ -1758,7 +2599,9 @@ int CameraHardware::pictureThread()
 						mJpegPictureHeap = NULL;
 					}
 
-					mJpegPictureHeap = mRequestMemory(-1,fileSize,1,mCallbackCookie);
+					if (fileSize) {
+						mJpegPictureHeap = mRequestMemory(-1,fileSize,1,mCallbackCookie);
+					}
 					if (mJpegPictureHeap) { 
 						memcpy(mJpegPictureHeap->data,jpegBuff,fileSize);
 						LOGD("CameraHardware::pictureThread: took jpeg picture compressed to %d bytes, q=%d", fileSize, quality);
@@ -1766,12 +2609,15 @@ int CameraHardware::pictureThread()
 					} else {
 						LOGE("Unable to allocate memory for RawPicture");
 					}
-					free(jpegBuff);					
 					
 				} else {
 				
 					LOGE("Unable to allocate temporary memory for Jpeg compression");
 				}
+				if (app1Frame)
+					app1Frame->release();
+				if (jpegFrame)
+					jpegFrame->release();
 				
 			}
 			
@@ -1786,19 +2632,20 @@ int CameraHardware::pictureThread()
 	
 	/* All this callbacks can potentially call one of our methods. 
 	   Make sure to dispatch them OUTSIDE the lock! */
+	Callbacks cb = getCallbacks();
 	if (shutter) {
 		LOGD("Sending the Shutter message");
-		mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+		cb.notify(CAMERA_MSG_SHUTTER, 0, 0, cb.cookie);
 	}
 
     if (raw) {
 		LOGD("Sending the raw message");
-        mDataCb(CAMERA_MSG_RAW_IMAGE, mRawPictureHeap, 0, NULL, mCallbackCookie);
+        cb.data(CAMERA_MSG_RAW_IMAGE, mRawPictureHeap, 0, NULL, cb.cookie);
     }
 
     if (jpeg) {
 		LOGD("Sending the jpeg message");
-        mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mJpegPictureHeap, 0, NULL, mCallbackCookie);
+        cb.data(CAMERA_MSG_COMPRESSED_IMAGE, mJpegPictureHeap, 0, NULL, cb.cookie);
     }
 
     LOGD("CameraHardware::pictureThread OK");
@@ -1806,6 +2653,186 @@ int CameraHardware::pictureThread()
     return NO_ERROR;
 }
 
+/* Grab frames into the raw picture buffer until the auto exposure of the camera
+   settles: The coarse luma histogram must stop changing between frames and,
+   if the camera reports it, so must the exposure time. Returns the number of 
+   frames grabbed */
+int CameraHardware::waitForExposureLocked(int width, int height)
+{
+	static const int kMaxFramesToWait = 10;
+	static const int kStableFrames = 2;
+	
+	unsigned int hist[2][LUMA_HISTOGRAM_BINS];
+	int cur = 0;
+	int frames = 0;
+	int stableFor = 0;
+	int exposure = 0, prevExposure = 0;
+	bool hasExposure = camera.getExposure(prevExposure);
+	
+	while (frames < kMaxFramesToWait && stableFor < kStableFrames) {
+		uint8_t* ptr = (uint8_t *)mRawBuffer;
+		
+		// Get the image
+		camera.GrabRawFrame(ptr, (width * height << 1)); // Always YUYV
+		frames++;
+		
+		// Sample one pixel out of 64
+		int samples = yuyv_luma_histogram(hist[cur], ptr, width << 1, width, height, 8);
+		
+		if (frames > 1) {
+		
+			// Samples that moved to another bin since the previous frame
+			int moved = 0;
+			for (int i = 0; i < LUMA_HISTOGRAM_BINS; i++) {
+				int d = hist[cur][i] - hist[cur ^ 1][i];
+				moved += (d < 0) ? -d : d;
+			}
+			moved >>= 1;
+			
+			// The exposure time must not be changing either
+			bool exposureStable = true;
+			if (hasExposure && camera.getExposure(exposure)) {
+				exposureStable = (exposure == prevExposure);
+				prevExposure = exposure;
+			}
+			
+			// Settled if less than 1/16 of the samples moved
+			if ((moved << 4) <= samples && exposureStable) {
+				stableFor++;
+			} else {
+				stableFor = 0;
+			}
+			
+			LOGD("CameraHardware::waitForExposureLocked: moved: %d/%d, exposure: %d (%s), stableFor: %d", moved, samples, exposure, hasExposure ? "reported" : "unknown", stableFor);
+		}
+		cur ^= 1;
+	}
+	
+	return frames;
+}
+
+/* Build the exif block of a picture, including a thumbnail as requested by 
+   the parameters, made from the raw captured image. Returns the size of 
+   the APP1 segment, or 0 if it could not be built */
+int CameraHardware::buildExifLocked(uint8_t* app1, int maxSize, int width, int height)
+{
+	char make[PROPERTY_VALUE_MAX];
+	char model[PROPERTY_VALUE_MAX];
+	property_get("ro.product.manufacturer", make, "");
+	property_get("ro.product.model", model, "");
+	
+	struct exif_info exif;
+	exif.width = width;
+	exif.height = height;
+	exif.orientation = mParameters.getInt(CameraParameters::KEY_ROTATION);
+	exif.timestamp = time(NULL);
+	exif.make = make[0] ? make : NULL;
+	exif.model = model[0] ? model : NULL;
+	exif.thumbnail = NULL;
+	exif.thumbnailSize = 0;
+	
+	/* The jpeg encoder needs widths multiple of 16 */
+	int tw = mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) & (-16);
+	int th = mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT) & (-2);
+	int tq = mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY);
+	
+	FrameBuffer* thumbFrame = NULL;
+	FrameBuffer* thumbJpegFrame = NULL;
+	int thumbMaxSize = maxSize - 1024; // Leave room for the exif tags
+	
+	/* The thumbnail shows the zoomed window of the picture */
+	int zx, zy, zw, zh;
+	getZoomCropLocked(width, height, zx, zy, zw, zh);
+	
+	if (tw > 0 && th > 0 && tw <= zw && th <= zh && mRawBuffer) {
+		thumbFrame = FramePool::get().acquire(tw * th << 1);
+		thumbJpegFrame = FramePool::get().acquire(thumbMaxSize);
+		if (thumbFrame && thumbJpegFrame) {
+			uint8_t* thumb = (uint8_t*) thumbFrame->data();
+			uint8_t* thumbJpeg = (uint8_t*) thumbJpegFrame->data();
+		
+			/* Crop the window to the aspect ratio of the thumbnail, then shrink it */
+			int cw = zw, ch = zh;
+			if (cw * th > ch * tw) {
+				cw = (ch * tw / th) & (-2);
+			} else {
+				ch = cw * th / tw;
+			}
+			uint8_t* src = (uint8_t*)mRawBuffer + 
+				(zy + ((zh - ch) >> 1)) * (width << 1) + 
+				((zx + (((zw - cw) >> 1) & (-2))) << 1);
+			
+			yuyv_scale_box(thumb, tw << 1, tw, th, src, width << 1, cw, ch);
+			exif.thumbnailSize = yuyv_to_jpeg(thumb, thumbJpeg, thumbMaxSize, tw, th, tw << 1, tq, NULL, 0);
+			if (exif.thumbnailSize) {
+				exif.thumbnail = thumbJpeg;
+			}
+		} else {
+			LOGE("Unable to allocate temporary memory for the thumbnail");
+		}
+	}
+	
+	int len = exif_build_app1(app1, maxSize, &exif);
+	
+	/* If the thumbnail did not fit, go without it */
+	if (!len && exif.thumbnail) {
+		exif.thumbnail = NULL;
+		exif.thumbnailSize = 0;
+		len = exif_build_app1(app1, maxSize, &exif);
+	}
+	
+	LOGD("CameraHardware::buildExifLocked: exif of %d bytes, thumbnail %dx%d of %d bytes", len, tw, th, exif.thumbnailSize);
+	
+	if (thumbFrame)
+		thumbFrame->release();
+	if (thumbJpegFrame)
+		thumbJpegFrame->release();
+	return len;
+}
+
+/* Window of a width x height frame to show at the current zoom level. It keeps
+   the aspect ratio, and starts on an even column so chroma is not shifted */
+void CameraHardware::getZoomCropLocked(int width, int height, int& x, int& y, int& cropWidth, int& cropHeight) const
+{
+	int ratio = zoomRatio(mZoom);
+	cropWidth  = (width  * 100 / ratio) & (-2);
+	cropHeight = (height * 100 / ratio) & (-2);
+	x = ((width - cropWidth) >> 1) & (-2);
+	y = (height - cropHeight) >> 1;
+}
+
+/* Build the jpeg picture out of a frame as compressed by the camera, avoiding 
+   the decode and recompress passes. The frame is checked, its missing huffman 
+   tables are added and the given exif block is attached. Returns the size of 
+   the picture, or 0 if the frame could not be used as is */
+int CameraHardware::passthroughJpegLocked(uint8_t* jpegBuff, int maxSize, int width, int height, const uint8_t* app1, int app1len)
+{
+	int frameWidth = 0, frameHeight = 0, hasDHT = 0;
+	
+	FrameBuffer* frameBuf = FramePool::get().acquire(maxSize);
+	if (!frameBuf) {
+		LOGE("Unable to allocate temporary memory for Jpeg passthrough");
+		return 0;
+	}
+	uint8_t* frame = (uint8_t*) frameBuf->data();
+	
+	int size = camera.GrabJpegFrame(frame, maxSize);
+	if (size > 0) {
+		size = jpeg_validate(frame, size, &frameWidth, &frameHeight, &hasDHT);
+	}
+	if (size <= 0 || frameWidth != width || frameHeight != height) {
+		LOGD("CameraHardware::passthroughJpegLocked: unusable camera frame (%d, %dx%d)", size, frameWidth, frameHeight);
+		frameBuf->release();
+		return 0;
+	}
+
+	int fileSize = jpeg_rebuild(jpegBuff, maxSize, frame, size, app1, app1len);
+	frameBuf->release();
+	
+	LOGD("CameraHardware::passthroughJpegLocked: camera jpeg of %d bytes (dht:%d) delivered as %d bytes", size, hasDHT, fileSize);
+	return fileSize;
+}
+
 /****************************************************************************
  * Camera API callbacks as defined by camera_device_ops structure.
  *
@@ -21,11 +21,26 @@
 #include <camera/CameraParameters.h>
 #include <hardware/camera.h>
 #include <utils/threads.h>
-#include <utils/threads.h>
+#include <utils/RefBase.h>
+#include <cutils/properties.h>
+#include <cutils/atomic.h>
 #include "V4L2Camera.h"
+#include "FaceDetector.h"
 
 namespace android {
 
+/* Snapshot of the camera parameters. A new one is published each time they 
+   change, and is never modified afterwards: readers just keep a reference to
+   the one they got, without waiting for the preview thread */
+class CameraConfig : public LightRefBase<CameraConfig> {
+public:
+	CameraConfig(const CameraParameters& params);
+	
+	CameraParameters	params;
+	String8				flat;					// As returned by getParameters
+	int					previewFrameRate;
+};
+
 class CameraHardware : public camera_device {
 
 public:
@@ -171,18 +186,20 @@ public:
 
 private:
 
-	bool PowerOn();
-	bool PowerOff();
-	bool NegotiatePreviewFormat(struct preview_stream_ops* win);
+public:
+	static bool PowerOn(const char* device);
+	static bool PowerOff(const char* device);
+	
+private:
+	bool NegotiatePreviewFormat(struct preview_stream_ops* win, bool direct);
 
 public:
     /* Constructs Camera instance.
      * Param:
-     *  cameraId - Zero based camera identifier, which is an index of the camera
-     *      instance in camera factory's array.
      *  module - Emulated camera HAL module descriptor.
+     *  device - The V4L2 capture device to use.
      */
-    CameraHardware(const hw_module_t* module);
+    CameraHardware(const hw_module_t* module, const char* device);
 
     /* Destructs EmulatedCamera instance. */
     virtual ~CameraHardware();
@@ -212,7 +229,7 @@ public:
      * NOTE: When this method is called the object is locked.
      * Note that failures in this method are reported as negave EXXX statuses.
      */
-    static status_t getCameraInfo(struct camera_info* info);
+    static status_t getCameraInfo(int cameraId, struct camera_info* info);
 	
 private:
 
@@ -220,6 +237,8 @@ private:
 
     void initDefaultParameters();
     void initHeapLocked();
+	void publishConfigLocked();
+	sp<CameraConfig> getConfig() const;
 
 	class PreviewThread : public Thread {
 		CameraHardware* mHardware;
@@ -240,20 +259,48 @@ private:
 
     static int beginPictureThread(void *cookie);
     int pictureThread();
+	int waitForExposureLocked(int width, int height);
+	void getZoomCropLocked(int width, int height, int& x, int& y, int& cropWidth, int& cropHeight) const;
+	int buildExifLocked(uint8_t* app1, int maxSize, int width, int height);
+	int passthroughJpegLocked(uint8_t* jpegBuff, int maxSize, int width, int height, const uint8_t* app1, int app1len);
 
     void fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeight);
-
+	bool startDirectRenderLocked();
+	void stopDirectRenderLocked();
+	bool queueDirectBufferLocked(int slot);
+	int  dequeueDirectBufferLocked();
+	void displayDirectBufferLocked(int slot);
+	void releaseDirectBuffersLocked();
+	int  getRecordingBufferIndex(const void* opaque) const;
+	int  acquireRecordingBuffer();
+	void freeRecordingPoolLocked();
+
+	// Protects the device, the buffers and the working copy of the parameters. 
+	//  The preview thread holds it while processing each frame
     mutable Mutex       mLock;
+	
+	char				mVideoDevice[PROPERTY_VALUE_MAX];	// Capture device to use
 
     preview_stream_ops*	mWin;
 	int					mPreviewWinFmt;
 	int					mPreviewWinWidth;
 	int					mPreviewWinHeight;
+	
+	// Direct rendering: The camera captures straight into the preview window buffers
+	bool				mDirectRender;
+	buffer_handle_t*	mDirectBuf[NB_BUFFER];		// Window buffers lent to the camera
+	void*				mDirectAddr[NB_BUFFER];		// And their mapped addresses
+	int					mDirectQueued;				// Number of them queued to the camera
 
     CameraParameters    mParameters;
+	
+	// Published configuration, see CameraConfig. mConfigLock is only held to 
+	//  take or replace the reference
+	mutable Mutex		mConfigLock;
+	sp<CameraConfig>	mConfig;
 
 
-    camera_memory_t*  	mRawPreviewHeap;
+    FrameBuffer*		mRawPreviewFrame;		// From the frame pool
 	int					mRawPreviewFrameSize;
 	void*			    mRawPreviewBuffer;
 	int					mRawPreviewWidth;
@@ -268,10 +315,24 @@ private:
 	void*			    mRawBuffer;
 	int					mRawPictureBufferSize;
     
-	camera_memory_t*  	mRecordingHeap;
+	int					mRecFmt;
+	bool				mStoreMetaData;			// The encoder wants metadata instead of frames
+	
+	// The recording pool. Changed holding both mLock and mRecordingLock, so
+	//  any of them is enough to read it
+	camera_memory_t*  	mRecordingHeap;			// What the encoder gets: Frames, or metadata of mRecGrBuf
     void*		        mRecBuffers[kBufferCount];
 	int                 mRecordingFrameSize;
-	int					mRecFmt;
+	bool				mRecordingMeta;			// mRecordingHeap holds metadata
+	buffer_handle_t		mRecGrBuf[kBufferCount];	// The frames, when sending metadata
+	int					mRecGrStride;			// And their stride, in pixels
+	
+	// protected by mRecordingLock, as the encoder returns buffers from its own thread
+	mutable Mutex		mRecordingLock;
+	bool				mRecBufferOwned[kBufferCount];	// Buffer handed to the encoder, not yet released
+	int					mCurrentRecordingFrame;			// Where to start looking for a free buffer
+	int					mRecordingFramesSent;
+	int					mRecordingFramesDropped;
 	
     camera_memory_t*  	mJpegPictureHeap;
 	int					mJpegPictureBufferSize;
@@ -281,18 +342,63 @@ private:
     
     // protected by mLock
     sp<PreviewThread>   mPreviewThread;
-
+	volatile int32_t	mPreviewEnabled;		// mPreviewThread != 0, readable without the lock
+
+	// Callbacks to the framework. Set holding both mLock and mCallbackLock, so
+	//  any of them is enough to read them. Threads calling them without mLock
+	//  take a copy with getCallbacks
+	struct Callbacks {
+		camera_notify_callback			notify;
+		camera_data_callback			data;
+		camera_data_timestamp_callback	dataTimestamp;
+		void*							cookie;
+	};
+	Callbacks getCallbacks() const;
+	
+	mutable Mutex		mCallbackLock;
     camera_notify_callback    	mNotifyCb;
     camera_data_callback      	mDataCb;
     camera_data_timestamp_callback mDataCbTimestamp;
 	camera_request_memory mRequestMemory;
     void               *mCallbackCookie;
 
-    int32_t             mMsgEnabled;
+	// Only changed with atomic operations, so it can be read without locks
+    volatile int32_t    mMsgEnabled;
+
+	// Preview callbacks are rate limited independently of the display
+	nsecs_t				mPreviewCallbackInterval;	// Minimum time between preview callbacks, 0 for every frame
+	nsecs_t				mNextPreviewCallback;		// Earliest time for the next preview callback
+	int					mPreviewCallbacksSkipped;
 
+	// Digital zoom: Frames are cropped and scaled while converted
+	int					mZoom;					// Current zoom level
+	int					mZoomTarget;			// Level the smooth zoom is moving to
+	bool				mSmoothZoom;			// Smooth zoom in progress
+	
+	// Face detection, in software, on a background thread
+	FaceDetector		mFaceDetector;
+	camera_memory_t*	mFaceMetaHeap;			// Dummy data for the metadata callbacks
+	
+	// Performance statistics, reported by dumpCamera
+	enum {
+		STAGE_DQBUF,							// Waiting for the camera to deliver the frame
+		STAGE_DECODE,							// Decoding/converting the captured frame to YUYV
+		STAGE_RECORD,							// Converting it to the recording format
+		STAGE_PREVIEW,							// Converting it to the preview callback format
+		STAGE_DISPLAY,							// Converting and enqueuing it to the preview window
+		STAGE_CALLBACKS,						// Running the data callbacks
+		STAGE_FRAME,							// The whole frame, from start to end
+		STAGE_COUNT
+	};
+	mutable Mutex		mStatsLock;
+	LatencyHistogram	mStageStats[STAGE_COUNT];
+	FpsCounter			mPreviewFps;			// Frames displayed
+	FpsCounter			mCallbackFps;			// Preview frames sent to the app
+	FpsCounter			mRecordingFps;			// Frames sent to the encoder
+	void resetStats(bool recordingOnly);
+	
     // only used from PreviewThread
     int                 mCurrentPreviewFrame;
-    int                 mCurrentRecordingFrame;
 	
     /****************************************************************************
      * Camera API callbacks as defined by camera_device_ops structure.
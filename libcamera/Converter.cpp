@@ -43,6 +43,8 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include <jpeglib.h>
 };
 #include "Converter.h"
@@ -52,32 +54,30 @@ extern "C" {
 #define CLIP(value) (uint8_t)(((value)>0xFF)?0xff:(((value)<0)?0:(value)))
 
  
-/* convert yuyv to YVU420SP */
-void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
+/* Core of the yuyv to 4:2:0 converters. Chroma is averaged over each pair of lines
+   and stored every cstep bytes, so both planar and interleaved layouts are handled */
+static inline void yuyv_to_420(uint8_t *dstY, int dstStride, uint8_t *dstU, uint8_t *dstV, int dstCStride, int cstep, uint8_t *src, int srcStride, int width, int height)
 {
-	// Start of Y plane
-	uint8_t* dstY = dst;
-	
-	// Calculate start of UV plane
-	uint8_t* dstVU = dst + dstStride * dstHeight;
-	
 	int h=0;
 	int w=0;
-	int dyvu = dstStride - width;
-	int sw   = srcStride - (width<<1);
+	int dy  = dstStride - width;
+	int dc  = dstCStride - (width >> 1) * cstep;
+	int sw  = srcStride - (width<<1);
 	for (h = 0; h<height; h +=2) {
 		for (w=0; w < width; w += 2) {
-			*dstY++  = *src++;							// Y0
-			dstVU[1] = (src[0] + src[srcStride]) >> 1;	// U
+			*dstY++ = *src++;							// Y0
+			*dstU   = (src[0] + src[srcStride]) >> 1;	// U
 			src++;
-			*dstY++  = *src++;							// Y1
-			dstVU[0] = (src[0] + src[srcStride]) >> 1;	// V
+			*dstY++ = *src++;							// Y1
+			*dstV   = (src[0] + src[srcStride]) >> 1;	// V
 			src++;
-			dstVU+=2;
+			dstU += cstep;
+			dstV += cstep;
 		}
-		src   += sw;
-		dstY  += dyvu;
-		dstVU += dyvu;
+		src  += sw;
+		dstY += dy;
+		dstU += dc;
+		dstV += dc;
 		for (w=0; w < width; w += 2) {
 			*dstY++  = *src;	// Y0
 			src += 2;
@@ -85,10 +85,41 @@ void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, i
 			src += 2;
 		}
 		src   += sw;
-		dstY  += dyvu;
+		dstY  += dy;
 	}
 }
 
+/* Core of the yuyv to 4:2:2 planar converters */
+static inline void yuyv_to_422p(uint8_t *dstY, int dstStride, uint8_t *dstU, uint8_t *dstV, int dstCStride, uint8_t *src, int srcStride, int width, int height)
+{
+	int h=0;
+	int w=0;
+	int dy  = dstStride - width;
+	int dvu = dstCStride - (width >> 1);
+	int sw  = srcStride - (width<<1);
+	for (h = 0; h<height; h ++) {
+		for (w=0; w < width; w += 2) {
+			*dstY++ = *src++;	// Y0
+			*dstU++ = *src++;	// U
+			*dstY++ = *src++;	// Y1
+			*dstV++ = *src++;	// V
+		}
+		src  += sw;
+		dstY += dy;
+		dstU += dvu;
+		dstV += dvu;
+	}
+}
+ 
+/* convert yuyv to YVU420SP */
+void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
+{
+	// Calculate start of VU plane
+	uint8_t* dstVU = dst + dstStride * dstHeight;
+	
+	yuyv_to_420(dst, dstStride, dstVU + 1, dstVU, dstStride, 2, src, srcStride, width, height);
+}
+
 /* convert yuyv to YVU420P */
 /* This format assumes that the horizontal strides (luma and chroma) are multiple of 16 pixels */
 void yuyv_to_yvu420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
@@ -96,42 +127,13 @@ void yuyv_to_yvu420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	// Calculate the chroma plane stride
 	int dstVUStride = ((dstStride >> 1) + 15) & (-16);
 
-	// Start of Y plane
-	uint8_t* dstY = dst;
-	
 	// Calculate start of V plane
 	uint8_t* dstV = dst + dstStride * dstHeight;
 	
 	// Calculate start of U plane
 	uint8_t* dstU = dstV + (dstVUStride * dstHeight >> 1);
 	
-	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstVUStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
-	for (h = 0; h<height; h +=2) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;							// Y0
-			*dstU++ = (src[0] + src[srcStride]) >> 1;	// U
-			src++;
-			*dstY++ = *src++;							// Y1
-			*dstV++ = (src[0] + src[srcStride]) >> 1;	// V
-			src++;
-		}
-		src   += sw;
-		dstY  += dy;
-		dstU += dvu;
-		dstV += dvu;
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src;	// Y0
-			src += 2;
-			*dstY++  = *src;	// Y1
-			src += 2;
-		}
-		src   += sw;
-		dstY  += dy;
-	}
+	yuyv_to_420(dst, dstStride, dstU, dstV, dstVUStride, 1, src, srcStride, width, height);
 }
 
 /* This format assumes that the horizontal strides (luma and chroma) are multiple of 16 pixels */
@@ -140,42 +142,13 @@ void yuyv_to_yuv420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	// Calculate the chroma plane stride
 	int dstUVStride = ((dstStride >> 1) + 15) & (-16);
 
-	// Start of Y plane
-	uint8_t* dstY = dst;
-	
 	// Calculate start of U plane
 	uint8_t* dstU = dst + dstStride * dstHeight;
 	
 	// Calculate start of V plane
 	uint8_t* dstV = dstU + (dstUVStride * dstHeight >> 1);
 	
-	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstUVStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
-	for (h = 0; h<height; h +=2) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;							// Y0
-			*dstU++ = (src[0] + src[srcStride]) >> 1;	// U
-			src++;
-			*dstY++ = *src++;							// Y1
-			*dstV++ = (src[0] + src[srcStride]) >> 1;	// V
-			src++;
-		}
-		src   += sw;
-		dstY  += dy;
-		dstU += dvu;
-		dstV += dvu;
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src;	// Y0
-			src += 2;
-			*dstY++  = *src;	// Y1
-			src += 2;
-		}
-		src   += sw;
-		dstY  += dy;
-	}
+	yuyv_to_420(dst, dstStride, dstU, dstV, dstUVStride, 1, src, srcStride, width, height);
 }
 
 
@@ -186,32 +159,13 @@ void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	// Calculate the chroma plane stride
 	int dstVUStride = ((dstStride >> 1) + 15) & (-16);
 
-	// Start of Y plane
-	uint8_t* dstY = dst;
-	
-	// Calculate start of U plane
+	// Calculate start of V plane
 	uint8_t* dstV = dst + dstStride * dstHeight;
 	
-	// Calculate start of V plane
+	// Calculate start of U plane
 	uint8_t* dstU = dstV + (dstVUStride * dstHeight);
 	
-	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstVUStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
-	for (h = 0; h<height; h ++) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;	// Y0
-			*dstU++ = *src++;	// U
-			*dstY++ = *src++;	// Y1
-			*dstV++ = *src++;	// V
-		}
-		src  += sw;
-		dstY += dy;
-		dstU += dvu;
-		dstV += dvu;
-	}
+	yuyv_to_422p(dst, dstStride, dstU, dstV, dstVUStride, src, srcStride, width, height);
 }
 
 
@@ -1315,331 +1269,459 @@ void bayer_to_rgb24(uint8_t *pBay, uint8_t *pRGB24, int width, int height, int p
 }
 
 
-void rgb_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *prgb, int srcStride, int width, int height) 
+/*------------------------------- Color space conversions --------------------*/
+
+/* The yuv <-> rgb conversions use precomputed per channel tables in fixed point,
+   one set for each supported colorspace. Results are saturated by looking them 
+   up in clamping tables instead of comparing them */
+
+/* Sums can fall well outside 0..255: Range of the clamping tables */
+#define CLAMP_OFFSET	384
+#define CLAMP_SIZE		1024
+
+/* yuv -> rgb, with 8 fractional bits. Rounding is included in the luma table */
+struct yuv2rgb_tables {
+	int y[256];
+	int rv[256];
+	int gu[256];
+	int gv[256];
+	int bu[256];
+};
+
+/* rgb -> yuv, with 16 fractional bits. Offsets and rounding are included in 
+   the red tables */
+struct rgb2yuv_tables {
+	int yr[256], yg[256], yb[256];
+	int ur[256], ug[256], ub[256];
+	int vr[256], vg[256], vb[256];
+};
+
+static struct yuv2rgb_tables yuv2rgb[COLORSPACE_COUNT];
+static struct rgb2yuv_tables rgb2yuv[COLORSPACE_COUNT];
+static uint8_t  clamp8[CLAMP_SIZE];
+static uint16_t clamp565r[CLAMP_SIZE];
+static uint16_t clamp565g[CLAMP_SIZE];
+static uint16_t clamp565b[CLAMP_SIZE];
+static pthread_once_t colorTablesOnce = PTHREAD_ONCE_INIT;
+
+static inline int to_fixed(double x, int bits)
 {
+	return (int)floor(x * (1 << bits) + 0.5);
+}
 
-	int h;
-	int dw = dstStride - (width << 1);
-	for (h=0;h<height;h++) {
-		int i=0;
-		for(i=0;i<(width*3);i=i+6) 
-		{
-			/* y */ 
-			*pyuv++ =CLIP(0.299 * (prgb[i] - 128) + 0.587 * (prgb[i+1] - 128) + 0.114 * (prgb[i+2] - 128) + 128);
-			/* u */
-			*pyuv++ =CLIP(((- 0.147 * (prgb[i] - 128) - 0.289 * (prgb[i+1] - 128) + 0.436 * (prgb[i+2] - 128) + 128) +
-				(- 0.147 * (prgb[i+3] - 128) - 0.289 * (prgb[i+4] - 128) + 0.436 * (prgb[i+5] - 128) + 128))/2);
-			/* y1 */ 
-			*pyuv++ =CLIP(0.299 * (prgb[i+3] - 128) + 0.587 * (prgb[i+4] - 128) + 0.114 * (prgb[i+5] - 128) + 128); 
-			/* v*/
-			*pyuv++ =CLIP(((0.615 * (prgb[i] - 128) - 0.515 * (prgb[i+1] - 128) - 0.100 * (prgb[i+2] - 128) + 128) +
-				(0.615 * (prgb[i+3] - 128) - 0.515 * (prgb[i+4] - 128) - 0.100 * (prgb[i+5] - 128) + 128))/2);
+static void color_tables_init()
+{
+	int i, n;
+	
+	/* rrrr rggg gggb bbbb */
+	for (i = 0; i < CLAMP_SIZE; i++) {
+		int c = i - CLAMP_OFFSET;
+		if (c < 0) 
+			c = 0;
+		if (c > 255) 
+			c = 255;
+		clamp8[i]    = c;
+		clamp565r[i] = (c << 8) & 0xf800;
+		clamp565g[i] = (c << 3) & 0x07e0;
+		clamp565b[i] = (c >> 3) & 0x001f;
+	}
+	
+	for (n = 0; n < COLORSPACE_COUNT; n++) {
+		int hd   = (n == COLORSPACE_BT709_FULL || n == COLORSPACE_BT709_LIMITED);
+		int full = (n == COLORSPACE_BT601_FULL || n == COLORSPACE_BT709_FULL);
+		
+		// Luma weights of each primary
+		double kr = hd ? 0.2126 : 0.299;
+		double kb = hd ? 0.0722 : 0.114;
+		double kg = 1.0 - kr - kb;
+		
+		// Limited range uses 16..235 for luma and 16..240 for chroma
+		double ys = full ? 1.0 : 255.0 / 219.0;
+		double cs = full ? 1.0 : 255.0 / 224.0;
+		int yoff  = full ? 0 : 16;
+		
+		struct yuv2rgb_tables* t = &yuv2rgb[n];
+		struct rgb2yuv_tables* r = &rgb2yuv[n];
+		for (i = 0; i < 256; i++) {
+			int c = i - 128;
+			t->y[i]  = to_fixed(ys * (i - yoff), 8) + 128;
+			t->rv[i] = to_fixed( cs * 2 * (1 - kr) * c, 8);
+			t->gu[i] = to_fixed(-cs * 2 * (1 - kb) * kb / kg * c, 8);
+			t->gv[i] = to_fixed(-cs * 2 * (1 - kr) * kr / kg * c, 8);
+			t->bu[i] = to_fixed( cs * 2 * (1 - kb) * c, 8);
+			
+			r->yr[i] = to_fixed(kr * i / ys, 16) + (yoff << 16) + 0x8000;
+			r->yg[i] = to_fixed(kg * i / ys, 16);
+			r->yb[i] = to_fixed(kb * i / ys, 16);
+			r->ur[i] = to_fixed(-kr / (2 * (1 - kb)) * i / cs, 16) + (128 << 16) + 0x8000;
+			r->ug[i] = to_fixed(-kg / (2 * (1 - kb)) * i / cs, 16);
+			r->ub[i] = to_fixed(0.5 * i / cs, 16);
+			r->vr[i] = to_fixed(0.5 * i / cs, 16) + (128 << 16) + 0x8000;
+			r->vg[i] = to_fixed(-kg / (2 * (1 - kr)) * i / cs, 16);
+			r->vb[i] = to_fixed(-kb / (2 * (1 - kr)) * i / cs, 16);
 		}
-		pyuv += dw;
-		prgb += srcStride;
 	}
 }
 
-void bgr_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *pbgr, int srcStride, int width, int height) 
+/* Build the tables the first time they are needed */
+static inline void color_tables_setup()
 {
-	int h;
+	pthread_once(&colorTablesOnce, color_tables_init);
+}
+
+/* rgb24 or bgr24 to yuyv: ro and bo are the positions of red and blue in each pixel */
+static inline void rgb24_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *prgb, int srcStride, int width, int height, int colorspace, int ro, int bo)
+{
+	color_tables_setup();
+	const struct rgb2yuv_tables* t = &rgb2yuv[colorspace];
+	const uint8_t* c = clamp8 + CLAMP_OFFSET;
+	
+	int h, w;
 	int dw = dstStride - (width << 1);
+	int sw = srcStride - (width * 3);
 	for (h=0;h<height;h++) {
-		int i=0;
-		for(i=0;i<(width*3);i=i+6) 
-		{
-			/* y */ 
-			*pyuv++ =CLIP(0.299 * (pbgr[i+2] - 128) + 0.587 * (pbgr[i+1] - 128) + 0.114 * (pbgr[i] - 128) + 128);
-			/* u */
-			*pyuv++ =CLIP(((- 0.147 * (pbgr[i+2] - 128) - 0.289 * (pbgr[i+1] - 128) + 0.436 * (pbgr[i] - 128) + 128) +
-				(- 0.147 * (pbgr[i+5] - 128) - 0.289 * (pbgr[i+4] - 128) + 0.436 * (pbgr[i+3] - 128) + 128))/2);
-			/* y1 */ 
-			*pyuv++ =CLIP(0.299 * (pbgr[i+5] - 128) + 0.587 * (pbgr[i+4] - 128) + 0.114 * (pbgr[i+3] - 128) + 128); 
-			/* v*/
-			*pyuv++ =CLIP(((0.615 * (pbgr[i+2] - 128) - 0.515 * (pbgr[i+1] - 128) - 0.100 * (pbgr[i] - 128) + 128) +
-				(0.615 * (pbgr[i+5] - 128) - 0.515 * (pbgr[i+4] - 128) - 0.100 * (pbgr[i+3] - 128) + 128))/2);
+		for (w=0;w<width;w+=2) {
+			int r0 = prgb[ro], g0 = prgb[1], b0 = prgb[bo];
+			int r1 = prgb[ro+3], g1 = prgb[4], b1 = prgb[bo+3];
+			
+			*pyuv++ = c[(t->yr[r0] + t->yg[g0] + t->yb[b0]) >> 16];		// Y0
+			*pyuv++ = c[(t->ur[r0] + t->ug[g0] + t->ub[b0] + 
+						 t->ur[r1] + t->ug[g1] + t->ub[b1]) >> 17];		// U
+			*pyuv++ = c[(t->yr[r1] + t->yg[g1] + t->yb[b1]) >> 16];		// Y1
+			*pyuv++ = c[(t->vr[r0] + t->vg[g0] + t->vb[b0] + 
+						 t->vr[r1] + t->vg[g1] + t->vb[b1]) >> 17];		// V
+			prgb += 6;
 		}
 		pyuv += dw;
-		pbgr += srcStride;
+		prgb += sw;
 	}
 }
 
-//--------------------------------------------------------------------------------------
-
-/*------------------------------- Color space conversions --------------------*/
-
-
-/* rrrr rggg gggb bbbb */
-
-static inline uint16_t  make565(int red, int green, int blue)
+void rgb_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *prgb, int srcStride, int width, int height, int colorspace) 
 {
-    return (uint16_t)( ((red   << 8) & 0xf800) |
-                       ((green << 3) & 0x07e0) |
-                       ((blue  >> 3) & 0x001f) );
+	rgb24_to_yuyv(pyuv, dstStride, prgb, srcStride, width, height, colorspace, 0, 2);
 }
 
-#define FIX1P8(x) ((int)((x) * (1<<8)))
-
-static inline int clip(int x) 
+void bgr_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *pbgr, int srcStride, int width, int height, int colorspace) 
 {
-	if (x > 255)
-		x = 255;
-	if (x < 0)
-		x = 0;
-	return x;
+	rgb24_to_yuyv(pyuv, dstStride, pbgr, srcStride, width, height, colorspace, 2, 0);
 }
 
-
-void yuyv_to_rgb565_line (uint8_t *pyuv, uint8_t *prgb, int width)
+/* The chroma of each pixel pair is looked up once, then the luma of each pixel is
+   added to it */
+static void yuyv_to_rgb565_line (uint8_t *pyuv, uint8_t *prgb, int width, const struct yuv2rgb_tables* t)
 {
+	const uint16_t* cr = clamp565r + CLAMP_OFFSET;
+	const uint16_t* cg = clamp565g + CLAMP_OFFSET;
+	const uint16_t* cb = clamp565b + CLAMP_OFFSET;
 	int l=0;
 	int ln = width >> 1;
 	uint16_t *p = (uint16_t *)prgb;
 	
 	for(l=0; l<ln; l++) 
 	{	/*iterate every 4 bytes*/
-	
-		int u  = pyuv[1] - 128;
-		int v  = pyuv[3] - 128;
-		
-		int ri = (                       + FIX1P8(1.402)   * v) >> 8;
-		int gi = ( - FIX1P8(0.34414) * u - FIX1P8(0.71414) * v) >> 8;
-		int bi = ( + FIX1P8(1.772)   * u                      ) >> 8;
-
-		/* standart: r = y0 + 1.402 (v-128) */
-		/* logitech: r = y0 + 1.370705 (v-128) */
-		/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-		/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-		/* standart: b = y0 + 1.772 (u-128) */
-		/* logitech: b = y0 + 1.732446 (u-128) */
-
-		int y0 = pyuv[0];
-		*p++ = make565(
-			clip(y0 + ri),
-			clip(y0 + gi),
-			clip(y0 + bi)
-			);
+		int rv  = t->rv[pyuv[3]];
+		int guv = t->gu[pyuv[1]] + t->gv[pyuv[3]];
+		int bu  = t->bu[pyuv[1]];
+
+		int y0 = t->y[pyuv[0]];
+		*p++ = cr[(y0 + rv) >> 8] | cg[(y0 + guv) >> 8] | cb[(y0 + bu) >> 8];
 		
-		int y1 = pyuv[2];
-		*p++ = make565(
-			clip(y1 + ri),
-			clip(y1 + gi),
-			clip(y1 + bi)
-			);
+		int y1 = t->y[pyuv[2]];
+		*p++ = cr[(y1 + rv) >> 8] | cg[(y1 + guv) >> 8] | cb[(y1 + bu) >> 8];
 		
 		pyuv += 4;
 	}
 }
 
 /* regular yuv (YUYV) to rgb565*/
-void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
+void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace)
 {
+	color_tables_setup();
+	const struct yuv2rgb_tables* t = &yuv2rgb[colorspace];
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_rgb565_line (pyuv,prgb,width);
+		yuyv_to_rgb565_line (pyuv,prgb,width,t);
 		pyuv += pyuvstride;
 		prgb += prgbstride;
 	}
 }
 
-
-void yuyv_to_rgb24_line (uint8_t *pyuv, uint8_t *prgb, int width)
+/* 24 bits per pixel: ro and bo are the positions of red and blue */
+static inline void yuyv_to_rgb24_line (uint8_t *pyuv, uint8_t *prgb, int width, const struct yuv2rgb_tables* t, int ro, int bo)
 {
+	const uint8_t* c = clamp8 + CLAMP_OFFSET;
 	int l=0;
 	int ln = width >> 1;
 	
 	for(l=0; l<ln; l++) 
 	{	/*iterate every 4 bytes*/
-	
-		int u  = pyuv[1] - 128;
-		int v  = pyuv[3] - 128;
+		int rv  = t->rv[pyuv[3]];
+		int guv = t->gu[pyuv[1]] + t->gv[pyuv[3]];
+		int bu  = t->bu[pyuv[1]];
+
+		int y0 = t->y[pyuv[0]];
+		prgb[ro] = c[(y0 + rv ) >> 8];
+		prgb[1]  = c[(y0 + guv) >> 8];
+		prgb[bo] = c[(y0 + bu ) >> 8];
 		
-		int ri = (                       + FIX1P8(1.402)   * v) >> 8;
-		int gi = ( - FIX1P8(0.34414) * u - FIX1P8(0.71414) * v) >> 8;
-		int bi = ( + FIX1P8(1.772)   * u                      ) >> 8;
-
-		/* standart: r = y0 + 1.402 (v-128) */
-		/* logitech: r = y0 + 1.370705 (v-128) */
-		/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-		/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-		/* standart: b = y0 + 1.772 (u-128) */
-		/* logitech: b = y0 + 1.732446 (u-128) */
-
-		int y0 = pyuv[0];
-		*prgb++ = clip(y0 + ri);
-		*prgb++ = clip(y0 + gi);
-		*prgb++ = clip(y0 + bi);
-		
-		int y1 = pyuv[2];
-		*prgb++ = clip(y1 + ri);
-		*prgb++ = clip(y1 + gi);
-		*prgb++ = clip(y1 + bi);
+		int y1 = t->y[pyuv[2]];
+		prgb[ro+3] = c[(y1 + rv ) >> 8];
+		prgb[4]    = c[(y1 + guv) >> 8];
+		prgb[bo+3] = c[(y1 + bu ) >> 8];
 		
+		prgb += 6;
 		pyuv += 4;
 	}
 }
 
-/* regular yuv (YUYV) to rgb24*/
-void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
-{
-	int h=0;
-	for(h=0;h<height;h++) 
-	{	
-		yuyv_to_rgb24_line (pyuv,prgb,width);	
-		pyuv += pyuvstride;
-		prgb += prgbstride;
-	}
-}
-
-void yuyv_to_rgb32_line (uint8_t *pyuv, uint8_t *prgb, int width)
+/* 32 bits per pixel, opaque, written a word at a time (little endian): rs and bs
+   are the shifts of red and blue */
+static inline void yuyv_to_rgb32_line (uint8_t *pyuv, uint8_t *prgb, int width, const struct yuv2rgb_tables* t, int rs, int bs)
 {
+	const uint8_t* c = clamp8 + CLAMP_OFFSET;
 	int l=0;
 	int ln = width >> 1;
+	uint32_t *p = (uint32_t *)prgb;
 	
 	for(l=0; l<ln; l++) 
 	{	/*iterate every 4 bytes*/
-	
-		int u  = pyuv[1] - 128;
-		int v  = pyuv[3] - 128;
-		
-		int ri = (                       + FIX1P8(1.402)   * v) >> 8;
-		int gi = ( - FIX1P8(0.34414) * u - FIX1P8(0.71414) * v) >> 8;
-		int bi = ( + FIX1P8(1.772)   * u                      ) >> 8;
-
-		/* standart: r = y0 + 1.402 (v-128) */
-		/* logitech: r = y0 + 1.370705 (v-128) */
-		/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-		/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-		/* standart: b = y0 + 1.772 (u-128) */
-		/* logitech: b = y0 + 1.732446 (u-128) */
-
-		int y0 = pyuv[0];
-		*prgb++ = clip(y0 + ri);
-		*prgb++ = clip(y0 + gi);
-		*prgb++ = clip(y0 + bi);
-		prgb++;
+		int rv  = t->rv[pyuv[3]];
+		int guv = t->gu[pyuv[1]] + t->gv[pyuv[3]];
+		int bu  = t->bu[pyuv[1]];
+
+		int y0 = t->y[pyuv[0]];
+		*p++ = ((uint32_t)c[(y0 + rv) >> 8] << rs) | ((uint32_t)c[(y0 + guv) >> 8] << 8) | 
+			   ((uint32_t)c[(y0 + bu) >> 8] << bs) | 0xFF000000U;
 		
-		int y1 = pyuv[2];
-		*prgb++ = clip(y1 + ri);
-		*prgb++ = clip(y1 + gi);
-		*prgb++ = clip(y1 + bi);
-		prgb++;
+		int y1 = t->y[pyuv[2]];
+		*p++ = ((uint32_t)c[(y1 + rv) >> 8] << rs) | ((uint32_t)c[(y1 + guv) >> 8] << 8) | 
+			   ((uint32_t)c[(y1 + bu) >> 8] << bs) | 0xFF000000U;
 		
 		pyuv += 4;
 	}
 }
 
-/* regular yuv (YUYV) to rgb32*/
-void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
+/* regular yuv (YUYV) to rgb24*/
+void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace)
 {
+	color_tables_setup();
+	const struct yuv2rgb_tables* t = &yuv2rgb[colorspace];
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_rgb32_line (pyuv,prgb,width);		
+		yuyv_to_rgb24_line (pyuv,prgb,width,t,0,2);	
 		pyuv += pyuvstride;
 		prgb += prgbstride;
 	}
 }
 
-void yuyv_to_bgr24_line (uint8_t *pyuv, uint8_t *pbgr, int width)
+/* regular yuv (YUYV) to rgb32*/
+void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace)
 {
-	int l=0;
-	int ln = width >> 1;
-	for(l=0;l<ln;l++) 
-	{	/*iterate every 4 bytes*/
-		int u  = pyuv[1] - 128;
-		int v  = pyuv[3] - 128;
-		
-		int ri = (                       + FIX1P8(1.402)   * v) >> 8;
-		int gi = ( - FIX1P8(0.34414) * u - FIX1P8(0.71414) * v) >> 8;
-		int bi = ( + FIX1P8(1.772)   * u                      ) >> 8;
-
-		/* standart: r = y0 + 1.402 (v-128) */
-		/* logitech: r = y0 + 1.370705 (v-128) */
-		/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-		/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-		/* standart: b = y0 + 1.772 (u-128) */
-		/* logitech: b = y0 + 1.732446 (u-128) */
-
-		int y0 = pyuv[0];
-		*pbgr++ = clip(y0 + ri);
-		*pbgr++ = clip(y0 + gi);
-		*pbgr++ = clip(y0 + bi);
-		pbgr++;
-		
-		int y1 = pyuv[2];
-		*pbgr++ = clip(y1 + ri);
-		*pbgr++ = clip(y1 + gi);
-		*pbgr++ = clip(y1 + bi);
-		pbgr++;
-		
-		pyuv += 4;
+	color_tables_setup();
+	const struct yuv2rgb_tables* t = &yuv2rgb[colorspace];
+	int h=0;
+	for(h=0;h<height;h++) 
+	{	
+		yuyv_to_rgb32_line (pyuv,prgb,width,t,0,16);		
+		pyuv += pyuvstride;
+		prgb += prgbstride;
 	}
 }
 
 /* used for rgb video (fourcc="RGB ")           */
 /* lines are on correct order                   */
-void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height)
+void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height, int colorspace)
 {
+	color_tables_setup();
+	const struct yuv2rgb_tables* t = &yuv2rgb[colorspace];
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_bgr24_line (pyuv,pbgr,width);		
+		yuyv_to_rgb24_line (pyuv,pbgr,width,t,2,0);		
 		pyuv += pyuvstride;
 		pbgr += pbgrstride;
 	}
 }
 
-void yuyv_to_bgr32_line (uint8_t *pyuv, uint8_t *pbgr, int width)
-{
-	int l=0;
-	int ln = width >> 1;
-	for(l=0;l<ln;l++) 
-	{	/*iterate every 4 bytes*/
-		int u  = pyuv[1] - 128;
-		int v  = pyuv[3] - 128;
-		
-		int ri = (                       + FIX1P8(1.402)   * v) >> 8;
-		int gi = ( - FIX1P8(0.34414) * u - FIX1P8(0.71414) * v) >> 8;
-		int bi = ( + FIX1P8(1.772)   * u                      ) >> 8;
-
-		/* standart: r = y0 + 1.402 (v-128) */
-		/* logitech: r = y0 + 1.370705 (v-128) */
-		/* standart: g = y0 - 0.34414 (u-128) - 0.71414 (v-128)*/
-		/* logitech: g = y0 - 0.337633 (u-128)- 0.698001 (v-128)*/
-		/* standart: b = y0 + 1.772 (u-128) */
-		/* logitech: b = y0 + 1.732446 (u-128) */
-
-		int y0 = pyuv[0];
-		*pbgr++ = clip(y0 + ri);
-		*pbgr++ = clip(y0 + gi);
-		*pbgr++ = clip(y0 + bi);
-		pbgr++;
-		
-		int y1 = pyuv[2];
-		*pbgr++ = clip(y1 + ri);
-		*pbgr++ = clip(y1 + gi);
-		*pbgr++ = clip(y1 + bi);
-		pbgr++;
-		
-		pyuv += 4;
-	}
-}
-
 /* used for rgb video (fourcc="RGB ")           */
 /* lines are on correct order                   */
-void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height)
+void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height, int colorspace)
 {
+	color_tables_setup();
+	const struct yuv2rgb_tables* t = &yuv2rgb[colorspace];
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_bgr32_line (pyuv,pbgr,width);		
+		yuyv_to_rgb32_line (pyuv,pbgr,width,t,16,0);		
 		pyuv += pyuvstride;
 		pbgr += pbgrstride;
 	}
 }
 
+/* Digital zoom support: A window of a yuyv image is scaled with bilinear 
+   interpolation a few lines at a time, and each group of lines is converted to 
+   the wanted format while it is still in the cache. So zooming does not cost an 
+   additional pass over the whole frame */
+
+/* Sampling tap of a destination sample: offsets of the two source samples it lies
+   between, and the weight (0..255) of the second one */
+struct zoom_tap {
+	int o0;
+	int o1;
+	int f;
+};
+
+/* All the taps needed to zoom a window into a width x height image */
+struct zoom_taps {
+	struct zoom_tap* x;		// Luma, for each column
+	struct zoom_tap* c;		// Chroma, for each pair of columns
+	struct zoom_tap* y;		// For each line
+};
+
+/* Compute the taps to scale count source samples, starting at the first one, into 
+   dstCount samples. Source samples are size bytes apart, starting at base */
+static void zoom_make_taps(struct zoom_tap* tap, int dstCount, int first, int count, int size, int base)
+{
+	// 16.16 fixed point, sampling at the center of each destination sample
+	int step = (count << 16) / dstCount;
+	int pos = (step >> 1) - 0x8000;
+	int i;
+	for (i = 0; i < dstCount; i++, pos += step) {
+		int s = 0, f = 0;
+		if (pos > 0) {
+			s = pos >> 16;
+			f = (pos >> 8) & 0xFF;
+		}
+		int s1 = (s + 1 < count) ? s + 1 : s;
+		tap[i].o0 = (first + s ) * size + base;
+		tap[i].o1 = (first + s1) * size + base;
+		tap[i].f  = f;
+	}
+}
+
+/* Prepare the taps to scale the given window of the source into a width x height
+   image. Returns 0 if out of memory */
+static int zoom_setup(struct zoom_taps* z, int width, int height, int srcStride, int cropX, int cropY, int cropWidth, int cropHeight)
+{
+	z->x = (struct zoom_tap*) malloc(sizeof(struct zoom_tap) * (width + (width >> 1) + height));
+	if (!z->x)
+		return 0;
+	z->c = z->x + width;
+	z->y = z->c + (width >> 1);
+	
+	// Chroma is shared by pixel pairs: The window must start on one
+	cropX &= (-2);
+	zoom_make_taps(z->x, width, cropX, cropWidth, 2, 0);
+	zoom_make_taps(z->c, width >> 1, cropX >> 1, cropWidth >> 1, 4, 1);
+	zoom_make_taps(z->y, height, cropY, cropHeight, srcStride, 0);
+	return 1;
+}
+
+static inline int zoom_sample(const uint8_t* r0, const uint8_t* r1, const struct zoom_tap* t, int fy, int o)
+{
+	int a = (r0[t->o0 + o] << 8) + (r0[t->o1 + o] - r0[t->o0 + o]) * t->f;
+	int b = (r1[t->o0 + o] << 8) + (r1[t->o1 + o] - r1[t->o0 + o]) * t->f;
+	return ((a << 8) + (b - a) * fy + 0x8000) >> 16;
+}
+
+/* Build lines first..first+lines-1 of the zoomed image, as yuyv */
+static void zoom_lines(uint8_t *dst, int dstStride, int width, int first, int lines, const struct zoom_taps* z, uint8_t *src)
+{
+	int l, x;
+	for (l = 0; l < lines; l++) {
+		const struct zoom_tap* ty = &z->y[first + l];
+		const uint8_t* r0 = src + ty->o0;
+		const uint8_t* r1 = src + ty->o1;
+		int fy = ty->f;
+		uint8_t* d = dst + l * dstStride;
+		for (x = 0; x < width; x += 2) {
+			const struct zoom_tap* tc = &z->c[x >> 1];
+			d[0] = zoom_sample(r0, r1, &z->x[x    ], fy, 0);	// Y0
+			d[1] = zoom_sample(r0, r1, tc, fy, 0);			// U
+			d[2] = zoom_sample(r0, r1, &z->x[x + 1], fy, 0);	// Y1
+			d[3] = zoom_sample(r0, r1, tc, fy, 2);			// V
+			d += 4;
+		}
+	}
+}
+
+/* yuyv_zoom
+ *  scales a window of a YUYV image to width x height, converting it to 
+ * the given format on the fly. dstStride and dstHeight describe the 
+ * destination buffer as for the plain converters
+ */
+void yuyv_zoom(int dstFormat, uint8_t *dst, int dstStride, int dstHeight, int width, int height, uint8_t *src, int srcStride, int cropX, int cropY, int cropWidth, int cropHeight, int colorspace)
+{
+	struct zoom_taps z;
+	int stripStride = width << 1;
+	uint8_t* strip = NULL;
+	int y;
+	
+	if (!zoom_setup(&z, width, height, srcStride, cropX, cropY, cropWidth, cropHeight))
+		return;
+		
+	// YUYV is built straight into the destination
+	if (dstFormat != ZOOM_YUYV) {
+		strip = (uint8_t*) malloc(stripStride * ZOOM_STRIP_LINES);
+		if (!strip) {
+			free(z.x);
+			return;
+		}
+	}
+	
+	// Chroma planes, if any
+	int dstCStride = ((dstStride >> 1) + 15) & (-16);
+	uint8_t* dstC1 = dst + dstStride * dstHeight;
+	uint8_t* dstC2 = dstC1 + dstCStride * (dstFormat == ZOOM_YVU422P ? dstHeight : (dstHeight >> 1));
+	
+	for (y = 0; y < height; y += ZOOM_STRIP_LINES) {
+		int lines = height - y;
+		if (lines > ZOOM_STRIP_LINES)
+			lines = ZOOM_STRIP_LINES;
+		uint8_t* dstY = dst + y * dstStride;
+		int cy = y >> 1;
+		
+		if (dstFormat == ZOOM_YUYV) {
+			zoom_lines(dstY, dstStride, width, y, lines, &z, src);
+			continue;
+		}
+		
+		zoom_lines(strip, stripStride, width, y, lines, &z, src);
+		switch (dstFormat) {
+		case ZOOM_YVU420SP:
+			yuyv_to_420(dstY, dstStride, dstC1 + cy * dstStride + 1, dstC1 + cy * dstStride, dstStride, 2, strip, stripStride, width, lines);
+			break;
+		case ZOOM_YVU420P:
+			yuyv_to_420(dstY, dstStride, dstC2 + cy * dstCStride, dstC1 + cy * dstCStride, dstCStride, 1, strip, stripStride, width, lines);
+			break;
+		case ZOOM_YUV420P:
+			yuyv_to_420(dstY, dstStride, dstC1 + cy * dstCStride, dstC2 + cy * dstCStride, dstCStride, 1, strip, stripStride, width, lines);
+			break;
+		case ZOOM_YVU422P:
+			yuyv_to_422p(dstY, dstStride, dstC2 + y * dstCStride, dstC1 + y * dstCStride, dstCStride, strip, stripStride, width, lines);
+			break;
+		case ZOOM_RGB24:
+			yuyv_to_rgb24(strip, stripStride, dstY, dstStride, width, lines, colorspace);
+			break;
+		case ZOOM_RGB32:
+			yuyv_to_rgb32(strip, stripStride, dstY, dstStride, width, lines, colorspace);
+			break;
+		case ZOOM_BGR32:
+			yuyv_to_bgr32(strip, stripStride, dstY, dstStride, width, lines, colorspace);
+			break;
+		case ZOOM_RGB565:
+			yuyv_to_rgb565(strip, stripStride, dstY, dstStride, width, lines, colorspace);
+			break;
+		}
+	}
+	
+	free(strip);
+	free(z.x);
+}
+
 /*	This a custom destination manager for jpeglib that
 	enables the use of memory to memory compression.
 	See IJG documentation for details.
@@ -1705,6 +1787,7 @@ static GLOBAL(void) jpeg_memory_dest (j_compress_ptr cinfo,void* buf,int sz)
 	dest->bufsize = sz;
 	dest->buffer = (JOCTET*)buf;
 	dest->datasize = 0;
+	dest->overflowed = 0;
 	
 	/* set method callbacks */
 	dest->pub.init_destination 		= init_destination;
@@ -1713,21 +1796,39 @@ static GLOBAL(void) jpeg_memory_dest (j_compress_ptr cinfo,void* buf,int sz)
 }
 
 
-/* yuyv_to_jpeg
- *  converts an input image in the YUYV format into a jpeg image and puts
- * it in a memory buffer.
+/* yuyv_zoom_to_jpeg
+ *  converts a window of an input image in the YUYV format into a jpeg image 
+ * of width x height, scaling it if needed, and puts it in a memory buffer. 
+ * If app1 is not NULL, that APP1 segment (exif) is written instead of the 
+ * JFIF header. Returns the compressed size, or 0 if it did not fit into the 
+ * buffer
  */
-int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,int stride,int quality)
+int yuyv_zoom_to_jpeg(uint8_t* src, int stride, int cropX, int cropY, int cropWidth, int cropHeight, uint8_t* dst, int maxsize, int width, int height, int quality, const uint8_t* app1, int app1len)
 {
-	// Round height to a multiple of 16:
-	height &= (-16);
+	// Scale only if the window is not exactly the picture
+	int zoom = (cropWidth != width || cropHeight != height);
+	
+	// Round height to an even number. The last MCU row is padded
+	height &= (-2);
 	
 	// Round width to a multiple of 16
 	width &= (-16);
 	
-	// Calculate deltaStride
-	int dstride = stride - (width << 1);
-
+	// Zoomed lines are built one MCU row at a time
+	struct zoom_taps z;
+	uint8_t* strip = NULL;
+	if (zoom) {
+		if (!zoom_setup(&z, width, height, stride, cropX, cropY, cropWidth, cropHeight))
+			return 0;
+		strip = (uint8_t*) malloc((width << 1) * 16);
+		if (!strip) {
+			free(z.x);
+			return 0;
+		}
+	} else {
+		src += cropY * stride + ((cropX & (-2)) << 1);
+	}
+	
 	int i, j;
 
 	JSAMPROW y[16],cb[8],cr[8];
@@ -1776,34 +1877,61 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 
 	jpeg_memory_dest(&cinfo,dst,maxsize);	// data written to mem
 	
+	// The exif block replaces the JFIF header
+	if (app1) {
+		cinfo.write_JFIF_header = FALSE;
+	}
+	
 	jpeg_start_compress (&cinfo, TRUE);
 
-	uint8_t* yuyv = src;
+	if (app1) {
+		// Skip the marker and length: the library writes them
+		jpeg_write_marker(&cinfo, JPEG_APP0 + 1, app1 + 4, app1len - 4);
+	}
 	
 	for (j=0; j<height; j+=16) {
 	
+		uint8_t* base = src;
+		int bstride = stride;
+		int first = j;
+		int last = height - 2;
+		if (zoom) {
+			int lines = (height - j < 16) ? height - j : 16;
+			zoom_lines(strip, width << 1, width, j, lines, &z, src);
+			base = strip;
+			bstride = width << 1;
+			first = 0;
+			last = lines - 2;
+		}
+		
 		JSAMPROW pcb = cb[0];
 		JSAMPROW pcr = cr[0];
 		JSAMPROW py  = y[0];
 		for (i=0; i<8; i++) {
 			
+			// Rows past the bottom of the image repeat the last ones: libjpeg
+			//  discards them, but always wants complete MCU rows
+			int row = first + (i << 1);
+			if (row > last) 
+				row = last;
+			uint8_t* yuyv = base + row * bstride;
+			
 			int x;
 			for (x = 0; x < (width>>1); x++) {
 				*py++ = *yuyv++;		// Y0
-				*pcb++ = (yuyv[0] + yuyv[stride]) >> 1; // U
+				*pcb++ = (yuyv[0] + yuyv[bstride]) >> 1; // U
 				yuyv++;
 				*py++ = *yuyv++;		// Y1
-				*pcr++ = (yuyv[0] + yuyv[stride]) >> 1;	// V
+				*pcr++ = (yuyv[0] + yuyv[bstride]) >> 1;	// V
 				yuyv++;
 			}
-			yuyv += dstride;
+			yuyv += bstride - (width << 1);
 			for (x = 0; x < (width>>1); x++) {	
 				*py++ = *yuyv++;		// Y2
 				yuyv++;
 				*py++ = *yuyv++;		// Y3
 				yuyv++;
 			}
-			yuyv += dstride;
 		}
 		jpeg_write_raw_data(&cinfo, data, 8*2);
 	}
@@ -1814,12 +1942,150 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 	free(y[0]);
 	free(cb[0]);
 	free(cr[0]);
+	if (zoom) {
+		free(strip);
+		free(z.x);
+	}
 
 	// Create a buffer with the compressed data
     int fileSize = ((mem_dest_ptr)cinfo.dest)->datasize;
+	if (((mem_dest_ptr)cinfo.dest)->overflowed) {
+		fileSize = 0;
+	}
 	
 	// Destroy compressor context
 	jpeg_destroy_compress(&cinfo);
 	
 	return fileSize;
 } 
+
+/* yuyv_to_jpeg
+ *  converts a whole YUYV image into a jpeg image
+ */
+int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,int stride,int quality, const uint8_t* app1, int app1len)
+{
+	return yuyv_zoom_to_jpeg(src, stride, 0, 0, width, height, dst, maxsize, width, height, quality, app1, app1len);
+}
+
+/* yuyv_scale_box
+ *  shrinks a YUYV image: each destination pixel is the average of all the 
+ * source pixels it covers. Only reductions are supported
+ */
+void yuyv_scale_box(uint8_t *dst, int dstStride, int dstWidth, int dstHeight, uint8_t *src, int srcStride, int srcWidth, int srcHeight)
+{
+	int x, y, dy;
+	
+	dstWidth &= -2;
+	srcWidth &= -2;
+	if (dstWidth <= 0 || dstHeight <= 0 || dstWidth > srcWidth || dstHeight > srcHeight)
+		return;
+	
+	// First source pixel of each destination column, and the per column sums 
+	//  laid out as YUYV: Y0, U, Y1, V
+	int* xs  = (int*) malloc((dstWidth + 1) * sizeof(int));
+	int* acc = (int*) malloc((dstWidth << 1) * sizeof(int));
+	if (!xs || !acc) {
+		free(xs);
+		free(acc);
+		return;
+	}
+	for (x = 0; x <= dstWidth; x++) {
+		xs[x] = x * srcWidth / dstWidth;
+	}
+	
+	int sy0 = 0;
+	for (dy = 0; dy < dstHeight; dy++) {
+		int sy1 = (dy + 1) * srcHeight / dstHeight;
+		
+		memset(acc, 0, (dstWidth << 1) * sizeof(int));
+		for (y = sy0; y < sy1; y++) {
+			uint8_t* s = src + y * srcStride;
+			int* a = acc;
+			for (x = 0; x < dstWidth; x += 2, a += 4) {
+				int sx;
+				
+				// Luma of both pixels
+				for (sx = xs[x]; sx < xs[x+1]; sx++)
+					a[0] += s[sx << 1];
+				for (sx = xs[x+1]; sx < xs[x+2]; sx++)
+					a[2] += s[sx << 1];
+					
+				// Chroma is shared by each pixel pair
+				for (sx = xs[x] & -2; sx < xs[x+2]; sx += 2) {
+					a[1] += s[(sx << 1) + 1];
+					a[3] += s[(sx << 1) + 3];
+				}
+			}
+		}
+		
+		// Store the averages
+		int rows = sy1 - sy0;
+		uint8_t* d = dst + dy * dstStride;
+		int* a = acc;
+		for (x = 0; x < dstWidth; x += 2, a += 4) {
+			int pairs = ((xs[x+2] - (xs[x] & -2)) + 1) >> 1;
+			*d++ = a[0] / ((xs[x+1] - xs[x]) * rows);
+			*d++ = a[1] / (pairs * rows);
+			*d++ = a[2] / ((xs[x+2] - xs[x+1]) * rows);
+			*d++ = a[3] / (pairs * rows);
+		}
+		sy0 = sy1;
+	}
+	
+	free(xs);
+	free(acc);
+}
+
+/* yuyv_luma_quarter
+ *  extracts the luma plane of a YUYV image at a quarter of its size in both 
+ * directions, each pixel being the average of a 4x4 block
+ */
+void yuyv_luma_quarter(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height)
+{
+	int x, y;
+	int qw = width >> 2;
+	int qh = height >> 2;
+	
+	for (y = 0; y < qh; y++) {
+		uint8_t* s0 = src + (y << 2) * srcStride;
+		uint8_t* s1 = s0 + srcStride;
+		uint8_t* s2 = s1 + srcStride;
+		uint8_t* s3 = s2 + srcStride;
+		uint8_t* d = dst + y * dstStride;
+		
+		for (x = 0; x < qw; x++) {
+			int sum = s0[0] + s0[2] + s0[4] + s0[6] +
+					  s1[0] + s1[2] + s1[4] + s1[6] +
+					  s2[0] + s2[2] + s2[4] + s2[6] +
+					  s3[0] + s3[2] + s3[4] + s3[6];
+			*d++ = (sum + 8) >> 4;
+			s0 += 8;
+			s1 += 8;
+			s2 += 8;
+			s3 += 8;
+		}
+	}
+}
+
+/* yuyv_luma_histogram
+ *  builds a coarse luma histogram out of a sparse grid of samples
+ */
+int yuyv_luma_histogram(unsigned int *hist, uint8_t *src, int srcStride, int width, int height, int step)
+{
+	int x, y;
+	int samples = 0;
+	int xstep = step << 1;		// in bytes
+	int bytes = width << 1;
+	
+	memset(hist, 0, LUMA_HISTOGRAM_BINS * sizeof(unsigned int));
+	
+	for (y = 0; y < height; y += step) {
+		uint8_t* s = src + y * srcStride;
+		for (x = 0; x < bytes; x += xstep) {
+			hist[s[x] >> 3]++;
+		}
+		samples += (bytes + xstep - 1) / xstep;
+	}
+	
+	return samples;
+}
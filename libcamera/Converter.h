@@ -44,6 +44,17 @@
 #ifndef CONVERTER_H
 #define CONVERTER_H
 
+/* YCbCr encodings of the yuv data, for the conversions to and from rgb. Full 
+   range (as JPEG) uses 0..255 for all the components, limited range (as video) 
+   uses 16..235 for luma and 16..240 for chroma */
+enum {
+	COLORSPACE_BT601_FULL,
+	COLORSPACE_BT601_LIMITED,
+	COLORSPACE_BT709_FULL,
+	COLORSPACE_BT709_LIMITED,
+	COLORSPACE_COUNT
+};
+
 /* Converters from camera format to android format */
 void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height);
 
@@ -63,10 +74,11 @@ void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 *      prgb: pointer to buffer containing rgb24 data
 *      width: picture width
 *      height: picture height
+*      colorspace: encoding of the yuv data (COLORSPACE_*)
 */
-void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
-void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
-void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
+void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace);
+void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace);
+void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height, int colorspace);
 
 
 /*convert yuyv to bgr24/32/565
@@ -75,10 +87,11 @@ void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride,
 *      prgb: pointer to buffer containing rgb24 data
 *      width: picture width
 *      height: picture height
+*      colorspace: encoding of the yuv data (COLORSPACE_*)
 */
-void yuyv_to_bgr565 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
-void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
-void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
+void yuyv_to_bgr565 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height, int colorspace);
+void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height, int colorspace);
+void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height, int colorspace);
 
 
 /*convert yuv 420 planar (yu12) to yuv 422
@@ -254,8 +267,9 @@ void bayer_to_rgb24(uint8_t *pBay, uint8_t *pRGB24, int width, int height, int p
 *      stride: stride of framebuffer
 *      width: picture width
 *      height: picture height
+*      colorspace: encoding to use for the yuv data (COLORSPACE_*)
 */
-void rgb_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height);
+void rgb_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height, int colorspace);
 
 /*convert bgr24 to yuyv
 * args: 
@@ -264,14 +278,88 @@ void rgb_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int w
 *      stride: stride of framebuffer
 *      width: picture width
 *      height: picture height
+*      colorspace: encoding to use for the yuv data (COLORSPACE_*)
 */
-void bgr_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height);
+void bgr_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height, int colorspace);
 
 /* yuyv_to_jpeg
  *  converts an input image in the YUYV format into a jpeg image and puts
  * it in a memory buffer.
+ * args: 
+ *      app1: complete APP1 (exif) segment to write instead of the JFIF header, or NULL
+ *      app1len: size of the APP1 segment
+ * returns: the compressed size, or 0 if it did not fit into the buffer
+ */
+int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight, int srcstride, int quality, const uint8_t* app1, int app1len);
+
+/* yuyv_zoom_to_jpeg
+ *  same as yuyv_to_jpeg, but compresses the cropX,cropY cropWidth x cropHeight 
+ * window of the source, scaled to width x height
  */
-int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight, int srcstride, int quality);
+int yuyv_zoom_to_jpeg(uint8_t* src, int srcstride, int cropX, int cropY, int cropWidth, int cropHeight, uint8_t* dst, int maxsize, int width, int height, int quality, const uint8_t* app1, int app1len);
+
+/* Output formats of yuyv_zoom */
+enum {
+	ZOOM_YUYV,
+	ZOOM_YVU420SP,
+	ZOOM_YVU420P,
+	ZOOM_YUV420P,
+	ZOOM_YVU422P,
+	ZOOM_RGB24,
+	ZOOM_RGB32,
+	ZOOM_BGR32,
+	ZOOM_RGB565
+};
+
+/* Lines scaled at once by yuyv_zoom before converting them. Must be even */
+#define ZOOM_STRIP_LINES 8
+
+/*scale a window of a yuyv image, converting it to another format in the same pass
+* args: 
+*      dstFormat: one of the ZOOM_ formats
+*      dst, dstStride, dstHeight: destination buffer, as for the plain converters
+*      width, height: size of the scaled image
+*      src: pointer to the source image (yuyv)
+*      srcStride: stride of the source image
+*      cropX, cropY, cropWidth, cropHeight: window of the source to scale
+*      colorspace: encoding of the source, for the rgb formats
+*/
+void yuyv_zoom(int dstFormat, uint8_t *dst, int dstStride, int dstHeight, int width, int height, uint8_t *src, int srcStride, int cropX, int cropY, int cropWidth, int cropHeight, int colorspace);
+
+/*shrink a yuyv image averaging the source pixels covered by each destination one
+* args: 
+*      dst: pointer to buffer for the reduced image (yuyv)
+*      dstStride: stride of the reduced image
+*      dstWidth, dstHeight: size of the reduced image
+*      src: pointer to the source image (yuyv)
+*      srcStride: stride of the source image
+*      srcWidth, srcHeight: size of the source image. Must not be smaller than the reduced one
+*/
+void yuyv_scale_box(uint8_t *dst, int dstStride, int dstWidth, int dstHeight, uint8_t *src, int srcStride, int srcWidth, int srcHeight);
+
+/*extract the luma of a yuyv image, scaled to a quarter of its size in both directions
+* args: 
+*      dst: pointer to buffer for the luma plane, of (width/4)x(height/4) pixels
+*      dstStride: stride of the luma plane
+*      src: pointer to the source image (yuyv)
+*      srcStride: stride of the source image
+*      width, height: size of the source image
+*/
+void yuyv_luma_quarter(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height);
+
+/* Number of bins of the luma histograms */
+#define LUMA_HISTOGRAM_BINS 32
+
+/*compute the luma histogram of a yuyv image
+* args: 
+*      hist: LUMA_HISTOGRAM_BINS counters to fill
+*      src: pointer to the image (yuyv)
+*      srcStride: stride of the image
+*      width, height: size of the image
+*      step: only one pixel every step pixels, in both directions, is sampled
+* returns: the number of samples taken
+*/
+int yuyv_luma_histogram(unsigned int *hist, uint8_t *src, int srcStride, int width, int height, int step);
 
 
 #endif
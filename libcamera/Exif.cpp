@@ -0,0 +1,252 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#include "Exif.h"
+extern "C" {
+#include <string.h>
+};
+
+#define LOG_TAG "CameraHardware"
+#include <utils/Log.h>
+
+/* TIFF field types */
+#define EXIF_ASCII				2
+#define EXIF_SHORT				3
+#define EXIF_LONG				4
+#define EXIF_RATIONAL			5
+#define EXIF_UNDEFINED			7
+
+/* Tags we write */
+#define TAG_MAKE				0x010f
+#define TAG_MODEL				0x0110
+#define TAG_ORIENTATION			0x0112
+#define TAG_X_RESOLUTION		0x011a
+#define TAG_Y_RESOLUTION		0x011b
+#define TAG_RESOLUTION_UNIT		0x0128
+#define TAG_DATETIME			0x0132
+#define TAG_YCBCR_POSITIONING	0x0213
+#define TAG_COMPRESSION			0x0103
+#define TAG_JPEG_IF_OFFSET		0x0201
+#define TAG_JPEG_IF_LENGTH		0x0202
+#define TAG_EXIF_IFD			0x8769
+#define TAG_EXIF_VERSION		0x9000
+#define TAG_DATETIME_ORIGINAL	0x9003
+#define TAG_COLOR_SPACE			0xa001
+#define TAG_PIXEL_X_DIMENSION	0xa002
+#define TAG_PIXEL_Y_DIMENSION	0xa003
+
+/* The TIFF header follows the APP1 marker, its length and the "Exif\0\0" identifier */
+#define TIFF_OFFSET				10
+
+/* An IFD being written. All offsets are relative to the TIFF header, as exif requires */
+struct ifd {
+	uint8_t* tiff;			// TIFF header
+	int maxsize;			// Space available from the TIFF header on
+	int entry;				// Offset of the next directory entry to fill
+	int data;				// Offset of the next free byte of the value area
+	int err;				// Set if something did not fit
+};
+
+static inline void put16(uint8_t* p, int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put32(uint8_t* p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Start an IFD of count entries at offset pos. Values that don't fit into 
+   an entry are stored right after the directory */
+static void ifd_begin(struct ifd* ifd, uint8_t* tiff, int maxsize, int pos, int count)
+{
+	ifd->tiff = tiff;
+	ifd->maxsize = maxsize;
+	ifd->entry = pos + 2;
+	ifd->data = pos + 2 + count * 12 + 4;
+	ifd->err = ifd->data > maxsize;
+	if (!ifd->err) 
+		put16(tiff + pos, count);
+}
+
+static void ifd_add(struct ifd* ifd, int tag, int type, int count, const void* value, int size)
+{
+	if (ifd->err)
+		return;
+		
+	uint8_t* e = ifd->tiff + ifd->entry;
+	put16(e, tag);
+	put16(e + 2, type);
+	put32(e + 4, count);
+	if (size <= 4) {
+		memset(e + 8, 0, 4);
+		memcpy(e + 8, value, size);
+	} else {
+		// Values must start on a word boundary
+		int padded = (size + 1) & ~1;
+		if (ifd->data + padded > ifd->maxsize) {
+			ifd->err = 1;
+			return;
+		}
+		put32(e + 8, ifd->data);
+		memcpy(ifd->tiff + ifd->data, value, size);
+		if (padded != size)
+			ifd->tiff[ifd->data + size] = 0;
+		ifd->data += padded;
+	}
+	ifd->entry += 12;
+}
+
+static void ifd_add_short(struct ifd* ifd, int tag, int v)
+{
+	uint8_t b[2];
+	put16(b, v);
+	ifd_add(ifd, tag, EXIF_SHORT, 1, b, 2);
+}
+
+static void ifd_add_long(struct ifd* ifd, int tag, uint32_t v)
+{
+	uint8_t b[4];
+	put32(b, v);
+	ifd_add(ifd, tag, EXIF_LONG, 1, b, 4);
+}
+
+static void ifd_add_rational(struct ifd* ifd, int tag, uint32_t num, uint32_t den)
+{
+	uint8_t b[8];
+	put32(b, num);
+	put32(b + 4, den);
+	ifd_add(ifd, tag, EXIF_RATIONAL, 1, b, 8);
+}
+
+static void ifd_add_ascii(struct ifd* ifd, int tag, const char* s)
+{
+	int len = strlen(s) + 1;
+	ifd_add(ifd, tag, EXIF_ASCII, len, s, len);
+}
+
+/* Close the IFD and return the offset where the next one could start. The link 
+   to the next IFD is left as 0, and its offset returned in link, if not NULL */
+static int ifd_end(struct ifd* ifd, int* link)
+{
+	if (!ifd->err)
+		put32(ifd->tiff + ifd->entry, 0);
+	if (link)
+		*link = ifd->entry;
+	return ifd->data;
+}
+
+/* Convert a rotation in degrees to the exif orientation tag value */
+static int exif_orientation(int degrees)
+{
+	switch (((degrees % 360) + 360) % 360) {
+		case 90:	return 6;
+		case 180:	return 3;
+		case 270:	return 8;
+		default:	return 1;
+	}
+}
+
+int exif_build_app1(uint8_t* dst, int maxsize, const struct exif_info* info)
+{
+	struct ifd ifd0, exif, ifd1;
+	char datetime[20];
+	struct tm tm;
+	int pos, len, link;
+	
+	if (maxsize > EXIF_MAX_APP1_SIZE)
+		maxsize = EXIF_MAX_APP1_SIZE;
+	if (maxsize < TIFF_OFFSET + 8)
+		return 0;
+		
+	uint8_t* tiff = dst + TIFF_OFFSET;
+	int tiffmax = maxsize - TIFF_OFFSET;
+
+	localtime_r(&info->timestamp, &tm);
+	strftime(datetime, sizeof(datetime), "%Y:%m:%d %H:%M:%S", &tm);
+	
+	/* TIFF header: Little endian, first IFD right after it */
+	memcpy(tiff, "II\x2a\x00", 4);
+	put32(tiff + 4, 8);
+	
+	/* IFD0: Main image. Entries must be sorted by tag */
+	ifd_begin(&ifd0, tiff, tiffmax, 8, 7 + (info->make ? 1 : 0) + (info->model ? 1 : 0));
+	if (info->make)
+		ifd_add_ascii(&ifd0, TAG_MAKE, info->make);
+	if (info->model)
+		ifd_add_ascii(&ifd0, TAG_MODEL, info->model);
+	ifd_add_short(&ifd0, TAG_ORIENTATION, exif_orientation(info->orientation));
+	ifd_add_rational(&ifd0, TAG_X_RESOLUTION, 72, 1);
+	ifd_add_rational(&ifd0, TAG_Y_RESOLUTION, 72, 1);
+	ifd_add_short(&ifd0, TAG_RESOLUTION_UNIT, 2);		// inches
+	ifd_add_ascii(&ifd0, TAG_DATETIME, datetime);
+	ifd_add_short(&ifd0, TAG_YCBCR_POSITIONING, 1);		// centered
+	ifd_add_long(&ifd0, TAG_EXIF_IFD, ifd0.data);		// The exif IFD goes right after this one
+	pos = ifd_end(&ifd0, &link);
+	
+	/* Exif IFD */
+	ifd_begin(&exif, tiff, tiffmax, pos, 5);
+	ifd_add(&exif, TAG_EXIF_VERSION, EXIF_UNDEFINED, 4, "0220", 4);
+	ifd_add_ascii(&exif, TAG_DATETIME_ORIGINAL, datetime);
+	ifd_add_short(&exif, TAG_COLOR_SPACE, 1);			// sRGB
+	ifd_add_long(&exif, TAG_PIXEL_X_DIMENSION, info->width);
+	ifd_add_long(&exif, TAG_PIXEL_Y_DIMENSION, info->height);
+	len = ifd_end(&exif, NULL);
+	
+	/* IFD1: Thumbnail, linked from IFD0. The JPEG data goes right after it */
+	ifd1.err = 0;
+	if (info->thumbnail && info->thumbnailSize > 0 && !ifd0.err && !exif.err) {
+		put32(tiff + link, len);
+		ifd_begin(&ifd1, tiff, tiffmax, len, 6);
+		ifd_add_short(&ifd1, TAG_COMPRESSION, 6);			// JPEG
+		ifd_add_rational(&ifd1, TAG_X_RESOLUTION, 72, 1);
+		ifd_add_rational(&ifd1, TAG_Y_RESOLUTION, 72, 1);
+		ifd_add_short(&ifd1, TAG_RESOLUTION_UNIT, 2);
+		ifd_add_long(&ifd1, TAG_JPEG_IF_OFFSET, ifd1.data);
+		ifd_add_long(&ifd1, TAG_JPEG_IF_LENGTH, info->thumbnailSize);
+		len = ifd_end(&ifd1, NULL);
+		
+		if (!ifd1.err && len + info->thumbnailSize <= tiffmax) {
+			memcpy(tiff + len, info->thumbnail, info->thumbnailSize);
+			len += info->thumbnailSize;
+		} else {
+			ifd1.err = 1;
+		}
+	}
+	
+	if (ifd0.err || exif.err || ifd1.err) {
+		LOGE("exif_build_app1: exif block does not fit in %d bytes", maxsize);
+		return 0;
+	}
+	
+	/* APP1 marker, segment length (marker excluded) and exif identifier */
+	len += TIFF_OFFSET;
+	dst[0] = 0xff;
+	dst[1] = 0xe1;
+	dst[2] = (len - 2) >> 8;
+	dst[3] = (len - 2) & 0xff;
+	memcpy(dst + 4, "Exif\0\0", 6);
+	
+	return len;
+}
@@ -0,0 +1,47 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#ifndef EXIF_H
+#define EXIF_H
+
+extern "C" {
+#include <stdint.h>
+#include <time.h>
+};
+
+/* Largest APP1 segment we will ever build (marker included) */
+#define EXIF_MAX_APP1_SIZE	65537
+
+/* Information to store into the exif block of a picture */
+struct exif_info {
+	int width;						// Picture width
+	int height;						// Picture height
+	int orientation;				// Clockwise rotation to apply when displaying, in degrees
+	time_t timestamp;				// When the picture was taken
+	const char* make;				// Camera manufacturer, or NULL
+	const char* model;				// Camera model, or NULL
+	const uint8_t* thumbnail;		// JPEG thumbnail, or NULL
+	int thumbnailSize;				// Size of the JPEG thumbnail
+};
+
+/* Build an APP1 segment, marker included, holding the exif block and the
+   thumbnail, if any. Returns the length of the segment or 0 if it does not fit */
+int exif_build_app1(uint8_t* dst, int maxsize, const struct exif_info* info);
+
+#endif
@@ -0,0 +1,621 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define LOG_TAG "FaceDetector"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "FaceDetector.h"
+#include "Converter.h"
+
+/* The cascade file holds blank separated numbers:
+	<window width> <window height> <number of stages>
+   then, for each stage:
+	<number of classifiers> <stage threshold>
+   and for each classifier of the stage:
+	<number of rects (2 or 3)> { <x> <y> <width> <height> <weight> } <threshold> <left value> <right value>
+   That is, the contents of the OpenCV haarcascade_frontalface_*.xml cascades,
+   which have no tilted features */
+
+#define HAAR_MAX_RECTS		3
+
+/* Growth of the detection window between scans */
+#define FACE_SCALE_STEP		1.2f
+
+/* Most raw detections kept before grouping them */
+#define FACE_MAX_CANDIDATES	512
+
+namespace android {
+
+struct HaarRect {
+	int x, y, w, h;
+	float weight;
+};
+
+struct HaarClassifier {
+	int count;
+	HaarRect rect[HAAR_MAX_RECTS];
+	float threshold;
+	float left;							// Value when below the threshold
+	float right;						// Value otherwise
+};
+
+struct HaarStage {
+	int count;							// Classifiers in the stage
+	float threshold;
+};
+
+struct FaceCascade {
+	int width, height;					// Size of the window it was trained for
+	int numStages;
+	HaarStage* stages;
+	int numClassifiers;
+	HaarClassifier* classifiers;		// Those of all the stages, in order
+};
+
+/* A classifier scaled to the current window size. The corners of its rects
+   are stored as offsets into the integral image from the window origin */
+struct ScaledClassifier {
+	int count;
+	int off[HAAR_MAX_RECTS][4];			// top left, top right, bottom left, bottom right
+	float weight[HAAR_MAX_RECTS];
+	float threshold;
+	float left;
+	float right;
+};
+
+struct FaceRect {
+	int x, y, w, h;
+	int neighbors;
+};
+
+static FaceCascade* gCascade = NULL;
+static pthread_once_t gCascadeOnce = PTHREAD_ONCE_INIT;
+
+static void freeCascade(FaceCascade* c)
+{
+	if (c) {
+		free(c->stages);
+		free(c->classifiers);
+		free(c);
+	}
+}
+
+static FaceCascade* loadCascade(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		LOGI("loadCascade: No cascade at %s, face detection disabled", path);
+		return NULL;
+	}
+
+	FaceCascade* c = (FaceCascade*) calloc(1, sizeof(FaceCascade));
+	if (!c)
+		goto fail;
+
+	if (fscanf(f, "%d %d %d", &c->width, &c->height, &c->numStages) != 3 ||
+		c->width < 8 || c->width > 64 || c->height < 8 || c->height > 64 ||
+		c->numStages <= 0 || c->numStages > 64)
+		goto bad;
+
+	c->stages = (HaarStage*) calloc(c->numStages, sizeof(HaarStage));
+	if (!c->stages)
+		goto fail;
+
+	for (int s = 0; s < c->numStages; s++) {
+		HaarStage& stage = c->stages[s];
+		if (fscanf(f, "%d %f", &stage.count, &stage.threshold) != 2 ||
+			stage.count <= 0 || stage.count > 1000)
+			goto bad;
+
+		HaarClassifier* cl = (HaarClassifier*) realloc(c->classifiers,
+			(c->numClassifiers + stage.count) * sizeof(HaarClassifier));
+		if (!cl)
+			goto fail;
+		c->classifiers = cl;
+
+		for (int i = 0; i < stage.count; i++) {
+			HaarClassifier& h = c->classifiers[c->numClassifiers++];
+			if (fscanf(f, "%d", &h.count) != 1 || h.count < 2 || h.count > HAAR_MAX_RECTS)
+				goto bad;
+			for (int r = 0; r < h.count; r++) {
+				HaarRect& rc = h.rect[r];
+				if (fscanf(f, "%d %d %d %d %f", &rc.x, &rc.y, &rc.w, &rc.h, &rc.weight) != 5 ||
+					rc.x < 0 || rc.y < 0 || rc.w <= 0 || rc.h <= 0 ||
+					rc.x + rc.w > c->width || rc.y + rc.h > c->height)
+					goto bad;
+			}
+			if (fscanf(f, "%f %f %f", &h.threshold, &h.left, &h.right) != 3)
+				goto bad;
+		}
+	}
+
+	fclose(f);
+	LOGD("loadCascade: %dx%d window, %d stages, %d classifiers",
+		c->width, c->height, c->numStages, c->numClassifiers);
+	return c;
+
+bad:
+	LOGE("loadCascade: %s is not a valid cascade", path);
+	freeCascade(c);
+	fclose(f);
+	return NULL;
+
+fail:
+	LOGE("loadCascade: Out of memory");
+	freeCascade(c);
+	fclose(f);
+	return NULL;
+}
+
+static void cascadeSetup()
+{
+	gCascade = loadCascade(FACE_CASCADE_FILE);
+}
+
+static inline int roundf_int(float v)
+{
+	return (int)(v + 0.5f);
+}
+
+/* Scale the classifiers to a window scale times bigger than the trained one.
+   Weights are normalized by the window area, and the weight of the first rect
+   is recomputed so the rounding of the others does not bias the feature */
+static void scaleClassifiers(const FaceCascade* c, ScaledClassifier* sc, float scale, float invArea, int stride)
+{
+	for (int i = 0; i < c->numClassifiers; i++) {
+		const HaarClassifier& h = c->classifiers[i];
+		ScaledClassifier& s = sc[i];
+		int area0 = 0;
+		float sum0 = 0.0f;
+
+		s.count = h.count;
+		for (int r = 0; r < h.count; r++) {
+			int x = roundf_int(h.rect[r].x * scale);
+			int y = roundf_int(h.rect[r].y * scale);
+			int w = roundf_int(h.rect[r].w * scale);
+			int hh = roundf_int(h.rect[r].h * scale);
+
+			s.off[r][0] = y * stride + x;
+			s.off[r][1] = y * stride + x + w;
+			s.off[r][2] = (y + hh) * stride + x;
+			s.off[r][3] = (y + hh) * stride + x + w;
+			s.weight[r] = h.rect[r].weight * invArea;
+
+			if (r == 0)
+				area0 = w * hh;
+			else
+				sum0 += s.weight[r] * w * hh;
+		}
+		if (area0)
+			s.weight[0] = -sum0 / area0;
+
+		s.threshold = h.threshold;
+		s.left = h.left;
+		s.right = h.right;
+	}
+}
+
+/* Two detections of the same face */
+static bool sameFace(const FaceRect& a, const FaceRect& b)
+{
+	int delta = ((a.w < b.w ? a.w : b.w) + (a.h < b.h ? a.h : b.h)) / 10;
+	return abs(a.x - b.x) <= delta &&
+		   abs(a.y - b.y) <= delta &&
+		   abs(a.x + a.w - b.x - b.w) <= delta &&
+		   abs(a.y + a.h - b.y - b.h) <= delta;
+}
+
+static int findRoot(int* parent, int i)
+{
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/* Merge the overlapping detections into faces, averaging them. Detections
+   with few neighbors are probably false ones, and are dropped */
+static int groupFaces(FaceRect* rects, int count, FaceRect* faces)
+{
+	int parent[FACE_MAX_CANDIDATES];
+	FaceRect sums[FACE_MAX_CANDIDATES];
+	int i, j;
+
+	for (i = 0; i < count; i++)
+		parent[i] = i;
+	for (i = 0; i < count; i++) {
+		for (j = i + 1; j < count; j++) {
+			if (sameFace(rects[i], rects[j]))
+				parent[findRoot(parent, j)] = findRoot(parent, i);
+		}
+	}
+
+	memset(sums, 0, count * sizeof(FaceRect));
+	for (i = 0; i < count; i++) {
+		FaceRect& s = sums[findRoot(parent, i)];
+		s.x += rects[i].x;
+		s.y += rects[i].y;
+		s.w += rects[i].w;
+		s.h += rects[i].h;
+		s.neighbors++;
+	}
+
+	int groups = 0;
+	for (i = 0; i < count; i++) {
+		int n = sums[i].neighbors;
+		if (n >= FACE_MIN_NEIGHBORS) {
+			FaceRect& g = rects[groups++];		// Never ahead of i
+			g.x = (sums[i].x + (n >> 1)) / n;
+			g.y = (sums[i].y + (n >> 1)) / n;
+			g.w = (sums[i].w + (n >> 1)) / n;
+			g.h = (sums[i].h + (n >> 1)) / n;
+			g.neighbors = n;
+		}
+	}
+
+	// Drop faces centered inside a stronger one, and keep the strongest ones
+	int found = 0;
+	for (i = 0; i < groups; i++) {
+		const FaceRect& g = rects[i];
+		int cx = g.x + (g.w >> 1);
+		int cy = g.y + (g.h >> 1);
+		bool inside = false;
+		for (j = 0; j < groups && !inside; j++) {
+			const FaceRect& o = rects[j];
+			inside = j != i && o.neighbors > g.neighbors &&
+				cx >= o.x && cx < o.x + o.w && cy >= o.y && cy < o.y + o.h;
+		}
+		if (inside)
+			continue;
+
+		for (j = found; j > 0 && faces[j - 1].neighbors < g.neighbors; j--) {
+			if (j < FACE_MAX_FACES)
+				faces[j] = faces[j - 1];
+		}
+		if (j < FACE_MAX_FACES) {
+			faces[j] = g;
+			if (found < FACE_MAX_FACES)
+				found++;
+		}
+	}
+
+	return found;
+}
+
+FaceDetector::DetectorThread::DetectorThread(FaceDetector* fd) :
+	Thread(false),
+	mDetector(fd)
+{
+}
+
+void FaceDetector::DetectorThread::onFirstRef()
+{
+	run("CameraFaceDetector", PRIORITY_BACKGROUND);
+}
+
+bool FaceDetector::DetectorThread::threadLoop()
+{
+	return mDetector->detectorThread();
+}
+
+FaceDetector::FaceDetector()
+	: mLuma(NULL),
+	  mLumaWidth(0),
+	  mLumaHeight(0),
+	  mBusy(false),
+	  mExit(false),
+	  mNextFrame(0),
+	  mNumFaces(0),
+	  mNewFaces(false),
+	  mReportedFaces(false),
+	  mFrames(0),
+	  mLastDuration(0),
+	  mMaxDuration(0)
+{
+}
+
+FaceDetector::~FaceDetector()
+{
+	stop();
+	if (mLuma)
+		mLuma->release();
+}
+
+bool FaceDetector::isAvailable()
+{
+	pthread_once(&gCascadeOnce, cascadeSetup);
+	return gCascade != NULL;
+}
+
+status_t FaceDetector::start()
+{
+	if (!isAvailable())
+		return INVALID_OPERATION;
+
+	Mutex::Autolock lock(mLock);
+	if (mThread != 0)
+		return NO_ERROR;
+
+	LOGD("FaceDetector::start");
+	mBusy = false;
+	mExit = false;
+	mNextFrame = 0;
+	mNumFaces = 0;
+	mNewFaces = false;
+	mReportedFaces = false;
+	mThread = new DetectorThread(this);
+	return NO_ERROR;
+}
+
+void FaceDetector::stop()
+{
+	sp<DetectorThread> thread;
+	{
+		Mutex::Autolock lock(mLock);
+		thread = mThread;
+		mThread.clear();
+		mExit = true;
+		mCond.signal();
+	}
+
+	if (thread != 0) {
+		LOGD("FaceDetector::stop");
+		thread->requestExitAndWait();
+	}
+
+	Mutex::Autolock lock(mLock);
+	mBusy = false;
+	mNewFaces = false;
+}
+
+bool FaceDetector::isRunning() const
+{
+	Mutex::Autolock lock(mLock);
+	return mThread != 0;
+}
+
+bool FaceDetector::wantsFrame(nsecs_t now)
+{
+	Mutex::Autolock lock(mLock);
+	return mThread != 0 && !mBusy && now >= mNextFrame;
+}
+
+void FaceDetector::putFrame(uint8_t* yuyv, int stride, int width, int height, nsecs_t now)
+{
+	int lw = width >> 2;
+	int lh = height >> 2;
+	size_t size = lw * lh;
+
+	// The thread is idle, so the luma buffer is ours until it is marked busy
+	if (mLuma && mLuma->size() < size) {
+		mLuma->release();
+		mLuma = NULL;
+	}
+	if (!mLuma) {
+		mLuma = FramePool::get().acquire(size);
+		if (!mLuma)
+			return;
+	}
+	yuyv_luma_quarter((uint8_t*)mLuma->data(), lw, yuyv, stride, width, height);
+
+	Mutex::Autolock lock(mLock);
+	mLumaWidth = lw;
+	mLumaHeight = lh;
+	mBusy = true;
+	mNextFrame = now + seconds_to_nanoseconds(1) / FACE_DETECT_FPS;
+	mCond.signal();
+}
+
+bool FaceDetector::getFaces(camera_face_t* faces, int& count)
+{
+	Mutex::Autolock lock(mLock);
+	if (!mNewFaces)
+		return false;
+	mNewFaces = false;
+
+	// Report when the faces are gone, but only once
+	if (!mNumFaces && !mReportedFaces)
+		return false;
+	mReportedFaces = mNumFaces != 0;
+
+	memcpy(faces, mFaces, mNumFaces * sizeof(camera_face_t));
+	count = mNumFaces;
+	return true;
+}
+
+bool FaceDetector::detectorThread()
+{
+	int width, height;
+	{
+		Mutex::Autolock lock(mLock);
+		while (!mBusy && !mExit)
+			mCond.wait(mLock);
+		if (mExit)
+			return false;
+		width = mLumaWidth;
+		height = mLumaHeight;
+	}
+
+	camera_face_t faces[FACE_MAX_FACES];
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+	int count = detect((const uint8_t*)mLuma->data(), width, height, faces);
+	nsecs_t duration = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+	Mutex::Autolock lock(mLock);
+	memcpy(mFaces, faces, count * sizeof(camera_face_t));
+	mNumFaces = count;
+	mNewFaces = true;
+	mBusy = false;
+
+	mFrames++;
+	mLastDuration = duration;
+	if (duration > mMaxDuration)
+		mMaxDuration = duration;
+
+	return true;
+}
+
+/* Run the cascade over the reduced luma at growing window sizes, using the
+   integral images to evaluate each feature in constant time */
+int FaceDetector::detect(const uint8_t* luma, int width, int height, camera_face_t* faces)
+{
+	const FaceCascade* c = gCascade;
+	if (width < c->width || height < c->height)
+		return 0;
+
+	int stride = width + 1;
+	size_t isize = stride * (height + 1);
+	FrameBuffer* ib = FramePool::get().acquire(isize * (sizeof(uint64_t) + sizeof(uint32_t)));
+	FrameBuffer* sb = FramePool::get().acquire(c->numClassifiers * sizeof(ScaledClassifier));
+	if (!ib || !sb) {
+		if (ib)
+			ib->release();
+		if (sb)
+			sb->release();
+		return 0;
+	}
+	uint64_t* sq = (uint64_t*) ib->data();
+	uint32_t* ii = (uint32_t*) (sq + isize);
+	ScaledClassifier* sc = (ScaledClassifier*) sb->data();
+
+	// Integral images of the luma and of its square
+	memset(ii, 0, stride * sizeof(uint32_t));
+	memset(sq, 0, stride * sizeof(uint64_t));
+	for (int y = 0; y < height; y++) {
+		const uint8_t* l = luma + y * width;
+		uint32_t* ip = ii + y * stride;
+		uint64_t* sp = sq + y * stride;
+		uint32_t rs = 0;
+		uint32_t rsq = 0;
+
+		ip[stride] = 0;
+		sp[stride] = 0;
+		for (int x = 0; x < width; x++) {
+			rs += l[x];
+			rsq += l[x] * l[x];
+			ip[stride + x + 1] = ip[x + 1] + rs;
+			sp[stride + x + 1] = sp[x + 1] + rsq;
+		}
+	}
+
+	FaceRect cand[FACE_MAX_CANDIDATES];
+	int ncand = 0;
+
+	for (float scale = 1.0f; ncand < FACE_MAX_CANDIDATES; scale *= FACE_SCALE_STEP) {
+		int ww = roundf_int(c->width * scale);
+		int wh = roundf_int(c->height * scale);
+		if (ww > width || wh > height)
+			break;
+
+		// Contrast is normalized over the window minus a one pixel border, as
+		//  the cascades are trained
+		int ex = roundf_int(scale);
+		int ew = roundf_int((c->width - 2) * scale);
+		int eh = roundf_int((c->height - 2) * scale);
+		int e0 = ex * stride + ex;
+		int e1 = e0 + ew;
+		int e2 = e0 + eh * stride;
+		int e3 = e2 + ew;
+		float invArea = 1.0f / (ew * eh);
+
+		scaleClassifiers(c, sc, scale, invArea, stride);
+
+		float step = scale > 2.0f ? scale : 2.0f;
+		for (float fy = 0; (int)fy + wh <= height && ncand < FACE_MAX_CANDIDATES; fy += step) {
+			int y = (int)fy;
+			for (float fx = 0; (int)fx + ww <= width; fx += step) {
+				int x = (int)fx;
+				const uint32_t* p = ii + y * stride + x;
+				const uint64_t* q = sq + y * stride + x;
+
+				float mean = (uint32_t)(p[e3] - p[e1] - p[e2] + p[e0]) * invArea;
+				float var = (float)(q[e3] - q[e1] - q[e2] + q[e0]) * invArea - mean * mean;
+				float norm = var > 0.0f ? sqrtf(var) : 1.0f;
+
+				const ScaledClassifier* s = sc;
+				bool face = true;
+				for (int st = 0; st < c->numStages && face; st++) {
+					float sum = 0.0f;
+					for (int i = 0; i < c->stages[st].count; i++, s++) {
+						float v = 0.0f;
+						for (int r = 0; r < s->count; r++) {
+							v += s->weight[r] * (int)(p[s->off[r][3]] - p[s->off[r][1]] - p[s->off[r][2]] + p[s->off[r][0]]);
+						}
+						sum += (v < s->threshold * norm) ? s->left : s->right;
+					}
+					face = sum >= c->stages[st].threshold - 0.0001f;
+				}
+
+				if (face) {
+					FaceRect& r = cand[ncand++];
+					r.x = x;
+					r.y = y;
+					r.w = ww;
+					r.h = wh;
+					r.neighbors = 1;
+					if (ncand == FACE_MAX_CANDIDATES)
+						break;
+				}
+			}
+		}
+	}
+
+	ib->release();
+	sb->release();
+
+	FaceRect found[FACE_MAX_FACES];
+	int count = groupFaces(cand, ncand, found);
+
+	// Android wants the faces in a -1000..1000 space spanning the field of view
+	for (int i = 0; i < count; i++) {
+		const FaceRect& r = found[i];
+		camera_face_t& f = faces[i];
+		f.rect[0] = r.x * 2000 / width - 1000;
+		f.rect[1] = r.y * 2000 / height - 1000;
+		f.rect[2] = (r.x + r.w) * 2000 / width - 1000;
+		f.rect[3] = (r.y + r.h) * 2000 / height - 1000;
+		f.score = r.neighbors * 100 / (r.neighbors + FACE_MIN_NEIGHBORS);
+		f.id = -1;						// Faces are not tracked
+		f.left_eye[0] = f.left_eye[1] = -2000;
+		f.right_eye[0] = f.right_eye[1] = -2000;
+		f.mouth[0] = f.mouth[1] = -2000;
+	}
+
+	return count;
+}
+
+void FaceDetector::dump(String8& result) const
+{
+	Mutex::Autolock lock(mLock);
+	if (!gCascade) {
+		result.appendFormat("  Face detection: not available\n");
+		return;
+	}
+	result.appendFormat("  Face detection: %s, %dx%d luma, %d frames analyzed, last %d ms (max %d ms), %d faces\n",
+		mThread != 0 ? "running" : "stopped", mLumaWidth, mLumaHeight, mFrames,
+		(int)ns2ms(mLastDuration), (int)ns2ms(mMaxDuration), mNumFaces);
+}
+
+}; // namespace android
@@ -0,0 +1,110 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FACEDETECTOR_H
+#define FACEDETECTOR_H
+
+#include <stdint.h>
+#include <hardware/camera.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+#include "FramePool.h"
+
+/* Haar cascade used to find faces. Without it, face detection is not offered */
+#define FACE_CASCADE_FILE		"/system/etc/camera/face_cascade.txt"
+
+/* Most faces reported at once */
+#define FACE_MAX_FACES			10
+
+/* Preview frames analyzed per second */
+#define FACE_DETECT_FPS			4
+
+/* Overlapping detections needed to accept a face */
+#define FACE_MIN_NEIGHBORS		3
+
+namespace android {
+
+struct FaceCascade;
+
+/* Software face detector. The preview thread hands it the luma of a frame,
+   reduced to a quarter of its size, whenever it is idle. A background thread
+   runs the cascade over it, and the preview thread picks up the results */
+class FaceDetector {
+public:
+	FaceDetector();
+	~FaceDetector();
+
+	/* True if the cascade could be loaded */
+	static bool isAvailable();
+
+	status_t start();
+	void stop();
+	bool isRunning() const;
+
+	/* True if a new frame should be handed in */
+	bool wantsFrame(nsecs_t now);
+
+	/* Hand in the area of a yuyv frame to look for faces into */
+	void putFrame(uint8_t* yuyv, int stride, int width, int height, nsecs_t now);
+
+	/* Get the faces found since the last call, in android coordinates.
+	   Returns false if there is nothing new to report */
+	bool getFaces(camera_face_t* faces, int& count);
+
+	void dump(String8& result) const;
+
+private:
+	class DetectorThread : public Thread {
+		FaceDetector* mDetector;
+
+	public:
+		DetectorThread(FaceDetector* fd);
+		virtual void onFirstRef();
+		virtual bool threadLoop();
+	};
+
+	bool detectorThread();
+	int detect(const uint8_t* luma, int width, int height, camera_face_t* faces);
+
+	mutable Mutex		mLock;
+	Condition			mCond;
+	sp<DetectorThread>	mThread;
+
+	FrameBuffer*		mLuma;					// Reduced luma of the frame being analyzed
+	int					mLumaWidth;
+	int					mLumaHeight;
+	bool				mBusy;					// The thread is analyzing mLuma
+	bool				mExit;					// The thread must end
+	nsecs_t				mNextFrame;				// Earliest time to take a new frame
+
+	camera_face_t		mFaces[FACE_MAX_FACES];	// Last results
+	int					mNumFaces;
+	bool				mNewFaces;				// Not picked up yet
+	bool				mReportedFaces;			// The last report had faces
+
+	// Statistics, reported by dump
+	int					mFrames;				// Frames analyzed
+	nsecs_t				mLastDuration;
+	nsecs_t				mMaxDuration;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,198 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define LOG_TAG "FramePool"
+#include <utils/Log.h>
+
+#include <stdlib.h>
+#include "FramePool.h"
+
+namespace android {
+
+FrameBuffer::FrameBuffer(void* data, size_t size, size_t classSize)
+	: mData(data),
+	  mSize(size),
+	  mClassSize(classSize),
+	  mRefs(1),
+	  mNext(NULL)
+{
+}
+
+FrameBuffer::~FrameBuffer()
+{
+	free(mData);
+}
+
+void FrameBuffer::acquire()
+{
+	Mutex::Autolock lock(FramePool::get().mLock);
+	mRefs++;
+}
+
+void FrameBuffer::release()
+{
+	FramePool::get().put(this);
+}
+
+FramePool& FramePool::get()
+{
+	static FramePool pool;
+	return pool;
+}
+
+FramePool::FramePool()
+	: mCache(NULL),
+	  mCached(0),
+	  mCachedBytes(0),
+	  mInUse(0),
+	  mInUseBytes(0),
+	  mPeakInUseBytes(0),
+	  mPeakTotalBytes(0),
+	  mHits(0),
+	  mAllocs(0),
+	  mFailures(0)
+{
+}
+
+/* Sizes are rounded up to a quarter of their power of two, so a buffer can be
+   reused for slightly different frame sizes while wasting at most 25% */
+size_t FramePool::classSize(size_t size)
+{
+	size_t p = 4096;
+	if (size <= p)
+		return p;
+	while ((p << 1) <= size)
+		p <<= 1;
+	size_t step = p >> 2;
+	return (size + step - 1) & ~(step - 1);
+}
+
+FrameBuffer* FramePool::acquire(size_t size)
+{
+	size_t cls = classSize(size);
+
+	Mutex::Autolock lock(mLock);
+
+	// Prefer the smallest cached buffer that is big enough, but not one twice
+	//  as big as needed
+	FrameBuffer** best = NULL;
+	for (FrameBuffer** p = &mCache; *p; p = &(*p)->mNext) {
+		size_t c = (*p)->mClassSize;
+		if (c >= cls && c < (cls << 1) && (!best || c < (*best)->mClassSize)) {
+			best = p;
+			if (c == cls)
+				break;
+		}
+	}
+
+	FrameBuffer* buf;
+	if (best) {
+		buf = *best;
+		*best = buf->mNext;
+		mCached--;
+		mCachedBytes -= buf->mClassSize;
+		buf->mNext = NULL;
+		buf->mSize = size;
+		buf->mRefs = 1;
+		mHits++;
+	} else {
+
+		// The cache is kept as it is: Other sizes are still likely to be
+		//  reused, and put enforces the limit. Only give it back if the
+		//  memory is really needed
+		void* data = malloc(cls);
+		if (!data) {
+			evictLocked(0);
+			data = malloc(cls);
+		}
+		if (!data) {
+			LOGE("FramePool::acquire: Unable to allocate %u bytes", (unsigned)cls);
+			mFailures++;
+			return NULL;
+		}
+		buf = new FrameBuffer(data, size, cls);
+		mAllocs++;
+	}
+
+	mInUse++;
+	mInUseBytes += buf->mClassSize;
+	if (mInUseBytes > mPeakInUseBytes)
+		mPeakInUseBytes = mInUseBytes;
+	if (mInUseBytes + mCachedBytes > mPeakTotalBytes)
+		mPeakTotalBytes = mInUseBytes + mCachedBytes;
+
+	return buf;
+}
+
+void FramePool::put(FrameBuffer* buf)
+{
+	Mutex::Autolock lock(mLock);
+
+	if (--buf->mRefs > 0)
+		return;
+
+	mInUse--;
+	mInUseBytes -= buf->mClassSize;
+
+	// Too big to keep: Give it back
+	if (buf->mClassSize > FRAME_POOL_MAX_CACHED) {
+		delete buf;
+		return;
+	}
+
+	evictLocked(FRAME_POOL_MAX_CACHED - buf->mClassSize);
+	buf->mNext = mCache;
+	mCache = buf;
+	mCached++;
+	mCachedBytes += buf->mClassSize;
+}
+
+/* Free the least recently used cached buffers until at most max bytes are cached */
+void FramePool::evictLocked(size_t max)
+{
+	while (mCachedBytes > max) {
+		FrameBuffer** p = &mCache;
+		while ((*p)->mNext)
+			p = &(*p)->mNext;
+		FrameBuffer* buf = *p;
+		*p = NULL;
+		mCached--;
+		mCachedBytes -= buf->mClassSize;
+		delete buf;
+	}
+}
+
+void FramePool::trim()
+{
+	Mutex::Autolock lock(mLock);
+	LOGD("FramePool::trim: Freeing %d cached buffers, %u KB", mCached, (unsigned)(mCachedBytes >> 10));
+	evictLocked(0);
+}
+
+void FramePool::dump(String8& result) const
+{
+	Mutex::Autolock lock(mLock);
+	result.appendFormat("  Frame pool: %d buffers in use (%u KB, peak %u KB), %d cached (%u KB), peak total %u KB\n",
+		mInUse, (unsigned)(mInUseBytes >> 10), (unsigned)(mPeakInUseBytes >> 10),
+		mCached, (unsigned)(mCachedBytes >> 10), (unsigned)(mPeakTotalBytes >> 10));
+	result.appendFormat("  Frame pool requests: %d reused, %d allocated, %d failed\n",
+		mHits, mAllocs, mFailures);
+}
+
+};
@@ -0,0 +1,94 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stddef.h>
+#include <utils/threads.h>
+#include <utils/String8.h>
+
+/* Most memory the pool keeps cached for reuse when nobody uses it */
+#define FRAME_POOL_MAX_CACHED	(24 * 1024 * 1024)
+
+namespace android {
+
+class FramePool;
+
+/* A block of frame memory. It goes back to the pool when its last user releases it */
+class FrameBuffer {
+public:
+	void* data() const { return mData; }
+	size_t size() const { return mSize; }
+
+	void acquire();
+	void release();
+
+private:
+	friend class FramePool;
+
+	FrameBuffer(void* data, size_t size, size_t classSize);
+	~FrameBuffer();
+
+	void*			mData;
+	size_t			mSize;				// Size asked for
+	size_t			mClassSize;			// Size really allocated
+	int				mRefs;				// Protected by the pool lock
+	FrameBuffer*	mNext;				// In the cache
+};
+
+/* Frame memory for the whole HAL. Buffers are allocated in size classes, and
+   released ones are cached, so preview restarts and pictures reuse the same
+   memory instead of fragmenting the heap */
+class FramePool {
+public:
+	static FramePool& get();
+
+	/* Returns a buffer of at least size bytes, with one reference, or NULL */
+	FrameBuffer* acquire(size_t size);
+
+	/* Free all the cached buffers */
+	void trim();
+
+	void dump(String8& result) const;
+
+private:
+	FramePool();
+
+	friend class FrameBuffer;
+	void put(FrameBuffer* buf);
+	void evictLocked(size_t max);
+	static size_t classSize(size_t size);
+
+	mutable Mutex	mLock;
+	FrameBuffer*	mCache;				// Released buffers, most recently used first
+	int				mCached;
+	size_t			mCachedBytes;
+	int				mInUse;
+	size_t			mInUseBytes;
+	size_t			mPeakInUseBytes;	// High water marks
+	size_t			mPeakTotalBytes;
+	int				mHits;				// Requests served from the cache
+	int				mAllocs;			// Requests that needed new memory
+	int				mFailures;
+};
+
+};
+
+#endif
@@ -0,0 +1,140 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#include <string.h>
+#include "FrameStats.h"
+
+namespace android {
+
+void LatencyHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	total = 0;
+	max = 0;
+}
+
+/* Values below SUBS get a bucket each. Above that, each power of 2 is split 
+   into SUBS buckets */
+int LatencyHistogram::bucketOf(uint32_t us)
+{
+	if (us < SUBS) 
+		return us;
+		
+	int msb = 31 - __builtin_clz(us);
+	return ((msb - SUB_BITS + 1) << SUB_BITS) + ((us >> (msb - SUB_BITS)) & (SUBS - 1));
+}
+
+uint32_t LatencyHistogram::bucketStart(int bucket)
+{
+	if (bucket < SUBS) 
+		return bucket;
+		
+	int msb = (bucket >> SUB_BITS) + SUB_BITS - 1;
+	return (uint32_t)(SUBS + (bucket & (SUBS - 1))) << (msb - SUB_BITS);
+}
+
+void LatencyHistogram::add(nsecs_t duration)
+{
+	if (duration < 0) 
+		duration = 0;
+		
+	nsecs_t us = ns2us(duration);
+	if (us > 0xFFFFFFFFLL)
+		us = 0xFFFFFFFFLL;
+		
+	buckets[bucketOf((uint32_t)us)]++;
+	count++;
+	total += duration;
+	if (duration > max)
+		max = duration;
+}
+
+/* Returns the duration below which the given percent of the samples are. The 
+   end of the bucket is reported, so it is never optimistic */
+nsecs_t LatencyHistogram::getPercentile(int percent) const
+{
+	if (count == 0)
+		return 0;
+		
+	// Rank of the sample we want, rounding up
+	int rank = (count * percent + 99) / 100;
+	if (rank < 1) 
+		rank = 1;
+	
+	int seen = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			nsecs_t end = (i + 1 < BUCKETS) ? us2ns((nsecs_t)bucketStart(i + 1)) : max;
+			return (end < max) ? end : max;
+		}
+	}
+	return max;
+}
+
+void LatencyHistogram::dump(String8& result, const char* name) const
+{
+	if (count == 0) {
+		result.appendFormat("    %-10s: no samples\n", name);
+		return;
+	}
+	
+	result.appendFormat("    %-10s: n=%d avg=%.2fms p50=%.2fms p95=%.2fms p99=%.2fms max=%.2fms\n",
+		name, count,
+		(total / count) / 1000000.0,
+		getPercentile(50) / 1000000.0,
+		getPercentile(95) / 1000000.0,
+		getPercentile(99) / 1000000.0,
+		max / 1000000.0);
+}
+
+void FpsCounter::reset(nsecs_t now)
+{
+	start = now;
+	frames = 0;
+	periodStart = now;
+	periodFrames = 0;
+	lastRate = 0;
+}
+
+void FpsCounter::tick(nsecs_t now)
+{
+	frames++;
+	
+	// Close the current period once a second has gone by
+	nsecs_t elapsed = now - periodStart;
+	if (elapsed >= seconds_to_nanoseconds(1)) {
+		lastRate = (int)(seconds_to_nanoseconds(periodFrames) / elapsed);
+		periodStart = now;
+		periodFrames = 0;
+	}
+	periodFrames++;
+}
+
+void FpsCounter::dump(String8& result, const char* name, nsecs_t now) const
+{
+	nsecs_t elapsed = now - start;
+	result.appendFormat("    %-10s: %d frames, %.1f fps average, %d fps last second\n",
+		name, frames,
+		(elapsed > 0) ? (frames * 1000000000.0) / elapsed : 0.0,
+		lastRate);
+}
+
+}; // namespace android
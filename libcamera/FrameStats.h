@@ -0,0 +1,91 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <stdint.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+/* Logs issued for every captured frame. Define CAMERA_NO_FRAME_LOGS to compile them out */
+#ifdef CAMERA_NO_FRAME_LOGS
+#define LOGD_FRAME(...)	((void)0)
+#else
+#define LOGD_FRAME(...)	LOGD(__VA_ARGS__)
+#endif
+
+namespace android {
+
+/* Distribution of the durations of a processing stage. Durations are kept in 
+   microseconds, in buckets 1/8 of their magnitude wide, so percentiles are 
+   accurate to about 12% without storing samples */
+class LatencyHistogram {
+public:
+	LatencyHistogram() { reset(); }
+	
+	void reset();
+	void add(nsecs_t duration);
+	
+	int getCount() const { return count; }
+	nsecs_t getPercentile(int percent) const;
+	nsecs_t getMax() const { return max; }
+	
+	void dump(String8& result, const char* name) const;
+	
+private:
+	enum {
+		SUB_BITS = 3,							// Resolution of each power of 2
+		SUBS = 1 << SUB_BITS,
+		BUCKETS = (32 - SUB_BITS + 1) * SUBS	// Enough for any 32 bit duration
+	};
+	
+	static int bucketOf(uint32_t us);
+	static uint32_t bucketStart(int bucket);
+	
+	uint32_t buckets[BUCKETS];
+	int count;
+	nsecs_t total;
+	nsecs_t max;
+};
+
+/* Frame rate counter. Keeps the average rate since reset, and the rate over
+   the last whole second */
+class FpsCounter {
+public:
+	FpsCounter() { reset(0); }
+	
+	void reset(nsecs_t now);
+	void tick(nsecs_t now);
+	
+	int getFrames() const { return frames; }
+	
+	void dump(String8& result, const char* name, nsecs_t now) const;
+	
+private:
+	nsecs_t start;				// Time of the reset
+	int frames;					// Frames since then
+	nsecs_t periodStart;		// Start of the current one second period
+	int periodFrames;			// Frames in it
+	int lastRate;				// Frames in the last complete period
+};
+
+}; // namespace android
+
+#endif
@@ -370,6 +370,8 @@ struct scan
 /******** Markers *********/
 #define M_SOI   0xd8
 #define M_APP0  0xe0
+#define M_APP1  0xe1
+#define M_APP15 0xef
 #define M_DQT   0xdb
 #define M_SOF0  0xc0
 #define M_DHT   0xc4
@@ -1309,3 +1311,153 @@ static void idctqtab(uint8_t *qin,PREC *qout)
 				IMULT(aaidct[i], aaidct[j]);
 }
 
+/*validate a jpeg frame as delivered by the camera
+* args: 
+*      buf:    pointer to input data ( compressed jpeg )
+*      size:   number of valid bytes in buf
+*      width:  returns the width of the image
+*      height: returns the height of the image
+*      hasDHT: returns 1 if the image has huffman tables, 0 if the default ones must be used (MJPG frame)
+* returns: length of the image up to EOI (inclusive) or a negated error code
+*/
+int jpeg_validate(const uint8_t *buf, int size, int *width, int *height, int *hasDHT)
+{
+	int pos = 2;
+	int sof = 0;
+	
+	*hasDHT = 0;
+	
+	/*check SOI (0xFFD8)*/
+	if (size < 4 || buf[0] != 0xff || buf[1] != M_SOI) 
+		return -ERR_NO_SOI;
+
+	/*walk the segments up to the start of scan*/
+	for (;;) 
+	{
+		int m, len;
+		
+		if (pos + 4 > size || buf[pos] != 0xff)
+			return -ERR_WRONG_MARKER;
+		m = buf[pos + 1];
+		
+		/*fill bytes*/
+		if (m == 0xff) 
+		{
+			pos++;
+			continue;
+		}
+		
+		len = (buf[pos + 2] << 8) | buf[pos + 3];
+		if (len < 2 || pos + 2 + len > size)
+			return -ERR_WRONG_MARKER;
+		
+		if (m == M_SOS)
+			break;
+			
+		switch (m) 
+		{
+			case M_SOF0:
+				if (len < 8)
+					return -ERR_WRONG_MARKER;
+				if (buf[pos + 4] != 8)
+					return -ERR_NOT_8BIT;
+				*height = (buf[pos + 5] << 8) | buf[pos + 6];
+				*width  = (buf[pos + 7] << 8) | buf[pos + 8];
+				sof = 1;
+				break;
+				
+			case M_DHT:
+				*hasDHT = 1;
+				break;
+				
+			/*progressive, lossless, arithmetic coded... we can't pass those*/
+			case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+			case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+				return -ERR_NOT_SEQUENTIAL_DCT;
+		}
+		pos += 2 + len;
+	}
+	
+	if (!sof) 
+		return -ERR_BAD_WIDTH_OR_HEIGHT;
+	
+	/*UVC cameras pad the frame with zeros after EOI. Ignore the padding, but
+	  anything else means the frame was truncated*/
+	while (size > pos && buf[size - 1] == 0)
+		size--;
+	if (size < pos + 2 || buf[size - 2] != 0xff || buf[size - 1] != M_EOI)
+		return -ERR_NO_EOI;
+		
+	return size;
+}
+
+/*rebuild a camera jpeg frame into a jpeg file
+* args: 
+*      dst:     pointer to the output buffer
+*      maxsize: size of the output buffer
+*      src:     pointer to a jpeg frame, already checked with jpeg_validate
+*      size:    length of the frame, as returned by jpeg_validate
+*      app1:    complete APP1 (exif) segment to insert after SOI, or NULL
+*      app1len: length of the APP1 segment
+* returns: size of the rebuilt image or 0 if it does not fit the output buffer
+*/
+int jpeg_rebuild(uint8_t *dst, int maxsize, const uint8_t *src, int size, const uint8_t *app1, int app1len)
+{
+	int pos = 2;
+	int out = 0;
+	int hasDHT = 0;
+	
+	if (maxsize < size + app1len + JPG_HUFFMAN_TABLE_LENGTH + 4)
+		return 0;
+	
+	/*SOI, followed by our own APP1*/
+	dst[out++] = 0xff;
+	dst[out++] = M_SOI;
+	if (app1 && app1len > 0) 
+	{
+		memcpy(dst + out, app1, app1len);
+		out += app1len;
+	}
+
+	/*copy the table segments, dropping the camera APPn ones (AVI1, etc)*/
+	for (;;) 
+	{
+		int m = src[pos + 1];
+		int len;
+		
+		if (m == 0xff) 
+		{
+			pos++;
+			continue;
+		}
+		if (m == M_SOS)
+			break;
+			
+		len = 2 + ((src[pos + 2] << 8) | src[pos + 3]);
+		if (m == M_DHT)
+			hasDHT = 1;
+		if (m < M_APP0 || m > M_APP15) 
+		{
+			memcpy(dst + out, src + pos, len);
+			out += len;
+		}
+		pos += len;
+	}
+	
+	/*MJPG frames omit the huffman tables: Insert the ones they were coded with*/
+	if (!hasDHT) 
+	{
+		dst[out++] = 0xff;
+		dst[out++] = M_DHT;
+		dst[out++] = (JPG_HUFFMAN_TABLE_LENGTH + 2) >> 8;
+		dst[out++] = (JPG_HUFFMAN_TABLE_LENGTH + 2) & 0xff;
+		memcpy(dst + out, JPEGHuffmanTable, JPG_HUFFMAN_TABLE_LENGTH);
+		out += JPG_HUFFMAN_TABLE_LENGTH;
+	}
+	
+	/*and the scan itself, up to EOI*/
+	memcpy(dst + out, src + pos, size - pos);
+	out += size - pos;
+	
+	return out;
+}
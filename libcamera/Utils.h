@@ -49,6 +49,15 @@ extern "C" {
 
 int jpeg_decode(uint8_t *pic,int stride, uint8_t *buf, int width, int height);
 
+/* Check that a camera supplied frame is a complete baseline JPEG image.
+   Returns the length of the image up to and including EOI, or a negated error code */
+int jpeg_validate(const uint8_t *buf, int size, int *width, int *height, int *hasDHT);
+
+/* Rebuild a camera supplied JPEG image into a standalone file: Camera APPn segments 
+   are replaced by the given APP1 segment, and the standard huffman tables are inserted 
+   if the image does not define its own. Returns the final size, or 0 on error */
+int jpeg_rebuild(uint8_t *dst, int maxsize, const uint8_t *src, int size, const uint8_t *app1, int app1len);
+
 /*******Error codes *******/
 #define ERR_NO_SOI 1
 #define ERR_NOT_8BIT 2
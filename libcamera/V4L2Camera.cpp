@@ -32,14 +32,16 @@ extern "C" {
 namespace android {
 
 V4L2Camera::V4L2Camera ()
-        : fd(-1), nQueued(0), nDequeued(0)
+        : dev(new V4L2RealDevice()), nQueued(0), nDequeued(0), exposureCtrl(0), lastDqTime(0), lastDecodeTime(0)
 {
     videoIn = (struct vdIn *) calloc (1, sizeof (struct vdIn));
+	m_EnumDevice[0] = 0;
 }
 
 V4L2Camera::~V4L2Camera()
 {
 	Close();
+	delete dev;
     free(videoIn);
 }
 
@@ -52,12 +54,15 @@ int V4L2Camera::Open (const char *device)
 	
     memset(videoIn, 0, sizeof (struct vdIn));
 
-    if ((fd = open(device, O_RDWR)) == -1) {
+	/* A real device node, or a fake one replaying recorded frames */
+	delete dev;
+	dev = V4L2Device::Create(device);
+    if (dev->Open(device) < 0) {
         LOGE("ERROR opening V4L interface: %s", strerror(errno));
         return -1;
     }
 
-    ret = ioctl (fd, VIDIOC_QUERYCAP, &videoIn->cap);
+    ret = dev->Ioctl(VIDIOC_QUERYCAP, &videoIn->cap);
     if (ret < 0) {
         LOGE("Error opening device: unable to query device.");
         return -1;
@@ -73,8 +78,16 @@ int V4L2Camera::Open (const char *device)
         return -1;
     }
 	
-	/* Enumerate all available frame formats */
-	EnumFrameFormats();
+	/* Enumerate all available frame formats. They are kept from the last 
+	   time this same device was opened, as enumerating them is slow */
+	if (m_AllFmts.isEmpty() || strcmp(m_EnumDevice, device) != 0) {
+		EnumFrameFormats();
+		strncpy(m_EnumDevice, device, sizeof(m_EnumDevice) - 1);
+		m_EnumDevice[sizeof(m_EnumDevice) - 1] = 0;
+	}
+	
+	/* And find out if we can follow the auto exposure */
+	QueryExposureControl();
 
     return ret;
 }
@@ -83,13 +96,11 @@ void V4L2Camera::Close ()
 {
 	/* Release the temporary buffer, if any */
 	if (videoIn->tmpBuffer)
-		free(videoIn->tmpBuffer);
+		videoIn->tmpBuffer->release();
 	videoIn->tmpBuffer = NULL;
 
-	/* Close the file descriptor */
-	if (fd > 0)
-		close(fd);
-	fd = -1;
+	/* Close the device */
+	dev->Close();
 }
 
 static int my_abs(int x)
@@ -97,7 +108,7 @@ static int my_abs(int x)
 	return (x < 0) ? -x : x;
 }
 
-int V4L2Camera::Init(int width, int height, int fps)
+int V4L2Camera::Init(int width, int height, int fps, bool preferJpeg)
 {
 	LOGD("V4L2Camera::Init");
 	
@@ -183,23 +194,52 @@ int V4L2Camera::Init(int width, int height, int fps)
 	// Check if we will have to crop the captured image
 	bool crop = width != closest.getWidth() || height != closest.getHeight();
 	
-	// Iterate through pixel formats from best to worst
 	ret = -1;
-	for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
 	
-		// If we will need to crop, make sure to only select formats we can crop...
-		if (!crop || pixFmtsOrder[i].allowscrop) {
-		
+	// If asked to, and the camera can deliver JPEG at exactly the requested
+	//  size, use it: The compressed frames can be used as they are.
+	if (preferJpeg && !crop) {
+		for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
+			if (pixFmtsOrder[i].fmt != V4L2_PIX_FMT_MJPEG &&
+				pixFmtsOrder[i].fmt != V4L2_PIX_FMT_JPEG)
+				continue;
+				
 			memset(&videoIn->format,0,sizeof(videoIn->format));
 			videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 			videoIn->format.fmt.pix.width = closest.getWidth();
 			videoIn->format.fmt.pix.height = closest.getHeight();
 			videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
 
-			ret = ioctl(fd, VIDIOC_TRY_FMT, &videoIn->format);
-			if (ret >= 0) {
+			// TRY_FMT silently adjusts unsupported formats, so check the result
+			ret = dev->Ioctl(VIDIOC_TRY_FMT, &videoIn->format);
+			if (ret >= 0 &&
+				videoIn->format.fmt.pix.pixelformat == (unsigned int)pixFmtsOrder[i].fmt &&
+				videoIn->format.fmt.pix.width == (unsigned int)closest.getWidth() &&
+				videoIn->format.fmt.pix.height == (unsigned int)closest.getHeight()) {
 				break;
 			}
+			ret = -1;
+		}
+	}
+	
+	// Iterate through pixel formats from best to worst
+	if (ret < 0) {
+		for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
+		
+			// If we will need to crop, make sure to only select formats we can crop...
+			if (!crop || pixFmtsOrder[i].allowscrop) {
+			
+				memset(&videoIn->format,0,sizeof(videoIn->format));
+				videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				videoIn->format.fmt.pix.width = closest.getWidth();
+				videoIn->format.fmt.pix.height = closest.getHeight();
+				videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
+
+				ret = dev->Ioctl(VIDIOC_TRY_FMT, &videoIn->format);
+				if (ret >= 0) {
+					break;
+				}
+			}
 		}
 	}
     if (ret < 0) {
@@ -213,7 +253,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 	videoIn->format.fmt.pix.width = closest.getWidth();
 	videoIn->format.fmt.pix.height = closest.getHeight();
 	videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
-	ret = ioctl(fd, VIDIOC_S_FMT, &videoIn->format);
+	ret = dev->Ioctl(VIDIOC_S_FMT, &videoIn->format);
     if (ret < 0) {
         LOGE("Open: VIDIOC_S_FMT Failed: %s", strerror(errno));
         return ret;
@@ -223,7 +263,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 	/* Query for the effective video format used */
 	memset(&videoIn->format,0,sizeof(videoIn->format));
 	videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	ret = ioctl(fd, VIDIOC_G_FMT, &videoIn->format);
+	ret = dev->Ioctl(VIDIOC_G_FMT, &videoIn->format);
     if (ret < 0) {
         LOGE("Open: VIDIOC_G_FMT Failed: %s", strerror(errno));
         return ret;
@@ -275,13 +315,13 @@ int V4L2Camera::Init(int width, int height, int fps)
 	videoIn->params.parm.capture.timeperframe.denominator = closest.getFps();
 
 	/* Set the framerate. If it fails, it wont be fatal */
-	if (ioctl(fd,VIDIOC_S_PARM,&videoIn->params) < 0) 
+	if (dev->Ioctl(VIDIOC_S_PARM,&videoIn->params) < 0) 
 	{
 		LOGE("VIDIOC_S_PARM error: Unable to set %d fps", closest.getFps());
 	} 
 	
 	/* Gets video device defined frame rate (not real - consider it a maximum value) */
-	if (ioctl(fd,VIDIOC_G_PARM,&videoIn->params) < 0) 
+	if (dev->Ioctl(VIDIOC_G_PARM,&videoIn->params) < 0) 
 	{
 		LOGE("VIDIOC_G_PARM - Unable to get timeperframe");
 	} 
@@ -299,13 +339,13 @@ int V4L2Camera::Init(int width, int height, int fps)
 		videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
 
 		/* Get the compression format */
-		ioctl(fd,VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp);
+		dev->Ioctl(VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp);
 
 		/* Set to maximum */
 		videoIn->jpegcomp.quality = 100;
 		
 		/* Try to set it */
-		if(ioctl(fd,VIDIOC_S_JPEGCOMP, &videoIn->jpegcomp) >= 0)
+		if(dev->Ioctl(VIDIOC_S_JPEGCOMP, &videoIn->jpegcomp) >= 0)
 		{
 			LOGE("VIDIOC_S_COMP:");
 			if(errno == EINVAL)
@@ -316,7 +356,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 		}
 
 		/* gets video stream jpeg compression parameters */
-		if(ioctl(fd,VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp) >= 0)
+		if(dev->Ioctl(VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp) >= 0)
 		{
 			LOGD("VIDIOC_G_COMP:\n");
 			LOGD("    quality:      %i\n", videoIn->jpegcomp.quality);
@@ -338,51 +378,11 @@ int V4L2Camera::Init(int width, int height, int fps)
 		}
 	}
 	
-    /* Check if camera can handle NB_BUFFER buffers */
-	memset(&videoIn->rb,0,sizeof(videoIn->rb));
-    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->rb.memory = V4L2_MEMORY_MMAP;
-    videoIn->rb.count = NB_BUFFER;
-
-    ret = ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
-    if (ret < 0) {
-        LOGE("Init: VIDIOC_REQBUFS failed: %s", strerror(errno));
-        return ret;
-    }
-
-    for (int i = 0; i < NB_BUFFER; i++) {
-
-        memset (&videoIn->buf, 0, sizeof (struct v4l2_buffer));
-        videoIn->buf.index = i;
-        videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        videoIn->buf.memory = V4L2_MEMORY_MMAP;
-
-        ret = ioctl (fd, VIDIOC_QUERYBUF, &videoIn->buf);
-        if (ret < 0) {
-            LOGE("Init: Unable to query buffer (%s)", strerror(errno));
-            return ret;
-        }
-
-        videoIn->mem[i] = mmap (0,
-                                videoIn->buf.length,
-                                PROT_READ | PROT_WRITE,
-                                MAP_SHARED,
-                                fd,
-                                videoIn->buf.m.offset);
-
-        if (videoIn->mem[i] == MAP_FAILED) {
-            LOGE("Init: Unable to map buffer (%s)", strerror(errno));
-            return -1;
-        }
-
-        ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
-        if (ret < 0) {
-            LOGE("Init: VIDIOC_QBUF Failed");
-            return -1;
-        }
-
-        nQueued++;
-    }
+	/* Map the capture buffers */
+	ret = RequestMmapBuffers();
+	if (ret < 0) {
+		return ret;
+	}
 	
 	// Reserve temporary buffers, if they will be needed
 	size_t tmpbuf_size=0;
@@ -425,11 +425,11 @@ int V4L2Camera::Init(int width, int height, int fps)
 			// rgb buffer for decoding bayer data
 			tmpbuf_size = videoIn->format.fmt.pix.width * videoIn->format.fmt.pix.height * 3;
 			if (videoIn->tmpBuffer)
-				free(videoIn->tmpBuffer);
-			videoIn->tmpBuffer = (uint8_t*)calloc(1, tmpbuf_size);
+				videoIn->tmpBuffer->release();
+			videoIn->tmpBuffer = FramePool::get().acquire(tmpbuf_size);
 			if (!videoIn->tmpBuffer) 
 			{
-				LOGE("couldn't calloc %lu bytes of memory for frame buffer\n",
+				LOGE("couldn't allocate %lu bytes of memory for frame buffer\n",
 					(unsigned long) tmpbuf_size);
 				return -ENOMEM;
 			} 
@@ -449,35 +449,107 @@ int V4L2Camera::Init(int width, int height, int fps)
     return 0;
 }
 
+/* Request, map and queue the driver allocated capture buffers */
+int V4L2Camera::RequestMmapBuffers()
+{
+	int ret;
+	
+    /* Check if camera can handle NB_BUFFER buffers */
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = V4L2_MEMORY_MMAP;
+    videoIn->rb.count = NB_BUFFER;
+
+    ret = dev->Ioctl(VIDIOC_REQBUFS, &videoIn->rb);
+    if (ret < 0) {
+        LOGE("RequestMmapBuffers: VIDIOC_REQBUFS failed: %s", strerror(errno));
+        return ret;
+    }
+
+    for (int i = 0; i < NB_BUFFER; i++) {
+
+        memset (&videoIn->buf, 0, sizeof (struct v4l2_buffer));
+        videoIn->buf.index = i;
+        videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        videoIn->buf.memory = V4L2_MEMORY_MMAP;
+
+        ret = dev->Ioctl(VIDIOC_QUERYBUF, &videoIn->buf);
+        if (ret < 0) {
+            LOGE("RequestMmapBuffers: Unable to query buffer (%s)", strerror(errno));
+            return ret;
+        }
+
+        videoIn->mem[i] = dev->Mmap(videoIn->buf.length, videoIn->buf.m.offset);
+        videoIn->memLength[i] = videoIn->buf.length;
+
+        if (videoIn->mem[i] == MAP_FAILED) {
+			videoIn->mem[i] = NULL;
+            LOGE("RequestMmapBuffers: Unable to map buffer (%s)", strerror(errno));
+            return -1;
+        }
+
+        ret = dev->Ioctl(VIDIOC_QBUF, &videoIn->buf);
+        if (ret < 0) {
+            LOGE("RequestMmapBuffers: VIDIOC_QBUF Failed");
+            return -1;
+        }
+
+        nQueued++;
+    }
+
+	return 0;
+}
+
+/* Unmap and free the driver allocated capture buffers. Not valid while streaming */
+void V4L2Camera::ReleaseMmapBuffers()
+{
+    for (int i = 0; i < NB_BUFFER; i++)
+		if (videoIn->mem[i] != NULL) {
+			if (dev->Munmap(videoIn->mem[i], videoIn->memLength[i]) < 0)
+				LOGE("ReleaseMmapBuffers: Unmap failed");
+			videoIn->mem[i] = NULL;
+		}
+		
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = V4L2_MEMORY_MMAP;
+    videoIn->rb.count = 0;
+    dev->Ioctl(VIDIOC_REQBUFS, &videoIn->rb);
+	
+    nQueued = 0;
+    nDequeued = 0;
+}
+
 void V4L2Camera::Uninit ()
 {
     int ret;
 
 	memset(&videoIn->buf,0,sizeof(videoIn->buf));
     videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->buf.memory = V4L2_MEMORY_MMAP;
+    videoIn->buf.memory = videoIn->isUserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
 
     /* Dequeue everything */
     int DQcount = nQueued - nDequeued;
 
     for (int i = 0; i < DQcount-1; i++) {
-        ret = ioctl(fd, VIDIOC_DQBUF, &videoIn->buf);
+        ret = dev->Ioctl(VIDIOC_DQBUF, &videoIn->buf);
         if (ret < 0)
             LOGE("Uninit: VIDIOC_DQBUF Failed");
     }
     nQueued = 0;
     nDequeued = 0;
 
-    /* Unmap buffers */
+    /* Unmap buffers. User supplied buffers are owned by the caller */
     for (int i = 0; i < NB_BUFFER; i++)
 		if (videoIn->mem[i] != NULL) {
-			if (munmap(videoIn->mem[i], videoIn->buf.length) < 0)
+			if (!videoIn->isUserPtr && dev->Munmap(videoIn->mem[i], videoIn->memLength[i]) < 0)
 				LOGE("Uninit: Unmap failed");
 			videoIn->mem[i] = NULL;
 		}
+	videoIn->isUserPtr = false;
 		
 	if (videoIn->tmpBuffer)
-		free(videoIn->tmpBuffer);
+		videoIn->tmpBuffer->release();
 	videoIn->tmpBuffer = NULL;
 		
 }
@@ -490,7 +562,7 @@ int V4L2Camera::StartStreaming ()
     if (!videoIn->isStreaming) {
         type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-        ret = ioctl (fd, VIDIOC_STREAMON, &type);
+        ret = dev->Ioctl(VIDIOC_STREAMON, &type);
         if (ret < 0) {
             LOGE("StartStreaming: Unable to start capture: %s", strerror(errno));
             return ret;
@@ -510,7 +582,7 @@ int V4L2Camera::StopStreaming ()
     if (videoIn->isStreaming) {
         type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-        ret = ioctl (fd, VIDIOC_STREAMOFF, &type);
+        ret = dev->Ioctl(VIDIOC_STREAMOFF, &type);
         if (ret < 0) {
             LOGE("StopStreaming: Unable to stop capture: %s", strerror(errno));
             return ret;
@@ -535,17 +607,100 @@ int V4L2Camera::getFps() const
 	return videoIn->params.parm.capture.timeperframe.denominator;
 }
 
+/* Returns if the camera is delivering compressed (JPEG) frames */
+bool V4L2Camera::isJpegCapture() const
+{
+	return videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG ||
+		   videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG;
+}
+
+/* Returns the YCbCr encoding (COLORSPACE_*) of the frames GrabRawFrame delivers */
+int V4L2Camera::getColorspace() const
+{
+	switch (videoIn->format.fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_JPEG:
+	case V4L2_PIX_FMT_MJPEG:
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SRGGB8:
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		// Decoded or converted by us, as JPEG does
+		return COLORSPACE_BT601_FULL;
+	}
+	
+	switch (videoIn->format.fmt.pix.colorspace) {
+	case V4L2_COLORSPACE_JPEG:
+		return COLORSPACE_BT601_FULL;
+	case V4L2_COLORSPACE_REC709:
+		return COLORSPACE_BT709_LIMITED;
+	case V4L2_COLORSPACE_SMPTE170M:
+	case V4L2_COLORSPACE_470_SYSTEM_M:
+	case V4L2_COLORSPACE_470_SYSTEM_BG:
+	case V4L2_COLORSPACE_SRGB:
+		return COLORSPACE_BT601_LIMITED;
+	}
+	
+	// Not reported: HD sizes are usually BT.709
+	return (videoIn->outHeight >= 720) ? COLORSPACE_BT709_LIMITED : COLORSPACE_BT601_LIMITED;
+}
+
+/* Returns the current exposure, as set by the camera auto exposure. False 
+   if the camera does not report it */
+bool V4L2Camera::getExposure(int& exposure) const
+{
+	struct v4l2_control ctrl;
+	
+	if (!exposureCtrl)
+		return false;
+		
+	memset(&ctrl, 0, sizeof(ctrl));
+	ctrl.id = exposureCtrl;
+	if (dev->Ioctl(VIDIOC_G_CTRL, &ctrl) < 0)
+		return false;
+		
+	exposure = ctrl.value;
+	return true;
+}
+
+/* Returns if the captured frames can be used as they are as YUYV frames of the given size 
+   and stride in bytes, so the camera could directly capture into such buffers */
+bool V4L2Camera::canCaptureDirect(int width, int height, int stride) const
+{
+	return videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV &&
+		   videoIn->capCropOffset == 0 &&
+		   videoIn->outWidth == width &&
+		   videoIn->outHeight == height &&
+		   (int)videoIn->format.fmt.pix.width == width &&
+		   (int)videoIn->format.fmt.pix.height == height &&
+		   (int)videoIn->format.fmt.pix.bytesperline == stride;
+}
+
+/* Returns how long the last grabbed frame took to arrive, and to be converted to YUYV */
+void V4L2Camera::getLastFrameTimes(nsecs_t& dqTime, nsecs_t& decodeTime) const
+{
+	dqTime = lastDqTime;
+	decodeTime = lastDecodeTime;
+}
+
 /* Grab frame in YUYV mode */
 void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 {
-	LOGD("V4L2Camera::GrabRawFrame: frameBuffer:%p, len:%d",frameBuffer,maxSize);
+	LOGD_FRAME("V4L2Camera::GrabRawFrame: frameBuffer:%p, len:%d",frameBuffer,maxSize);
     int ret;
+	
+	if (videoIn->isUserPtr) {
+		LOGE("GrabRawFrame: Not valid when capturing into user buffers");
+		return;
+	}
 
 	/* DQ */
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 	memset(&videoIn->buf,0,sizeof(videoIn->buf));
     videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     videoIn->buf.memory = V4L2_MEMORY_MMAP;
-	ret = ioctl(fd, VIDIOC_DQBUF, &videoIn->buf);
+	ret = dev->Ioctl(VIDIOC_DQBUF, &videoIn->buf);
     if (ret < 0) {
         LOGE("GrabPreviewFrame: VIDIOC_DQBUF Failed");
         return;
@@ -553,13 +708,16 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 
     nDequeued++;
 	
+	nsecs_t dequeued = systemTime(SYSTEM_TIME_MONOTONIC);
+	lastDqTime = dequeued - start;
+	
 	// Calculate the stride of the output image (YUYV) in bytes
 	int strideOut = videoIn->outWidth << 1;
 	
 	// And the pointer to the start of the image
 	uint8_t* src = (uint8_t*)videoIn->mem[videoIn->buf.index] + videoIn->capCropOffset;
 	
-	LOGD("V4L2Camera::GrabRawFrame - Got Raw frame (%dx%d) (buf:%d@0x%p, len:%d)",videoIn->format.fmt.pix.width,videoIn->format.fmt.pix.height,videoIn->buf.index,src,videoIn->buf.bytesused);
+	LOGD_FRAME("V4L2Camera::GrabRawFrame - Got Raw frame (%dx%d) (buf:%d@0x%p, len:%d)",videoIn->format.fmt.pix.width,videoIn->format.fmt.pix.height,videoIn->buf.index,src,videoIn->buf.bytesused);
 	
 	/* Avoid crashing! - Make sure there is enough room in the output buffer! */
 	if (maxSize < videoIn->outFrameSize) {
@@ -666,37 +824,37 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 				break;
 				
 			case V4L2_PIX_FMT_SGBRG8: //0
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 0);
+				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer->data(), videoIn->outWidth, videoIn->outHeight, 0);
 				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+							(uint8_t*)videoIn->tmpBuffer->data(), videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 				
 			case V4L2_PIX_FMT_SGRBG8: //1
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 1);
+				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer->data(), videoIn->outWidth, videoIn->outHeight, 1);
 				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+							(uint8_t*)videoIn->tmpBuffer->data(), videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 				
 			case V4L2_PIX_FMT_SBGGR8: //2
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 2);
+				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer->data(), videoIn->outWidth, videoIn->outHeight, 2);
 				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+							(uint8_t*)videoIn->tmpBuffer->data(), videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 				
 			case V4L2_PIX_FMT_SRGGB8: //3
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 3);
+				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer->data(), videoIn->outWidth, videoIn->outHeight, 3);
 				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+							(uint8_t*)videoIn->tmpBuffer->data(), videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 				
 			case V4L2_PIX_FMT_RGB24:
 				rgb_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 				
 			case V4L2_PIX_FMT_BGR24:
 				bgr_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight, COLORSPACE_BT601_FULL);
 				break;
 			
 			default:
@@ -704,11 +862,12 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 				break;
 		}
 		
-		LOGD("V4L2Camera::GrabRawFrame - Copied frame to destination 0x%p",frameBuffer);
+		LOGD_FRAME("V4L2Camera::GrabRawFrame - Copied frame to destination 0x%p",frameBuffer);
 	}
+	lastDecodeTime = systemTime(SYSTEM_TIME_MONOTONIC) - dequeued;
 	
 	/* And Queue the buffer again */
-    ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
+    ret = dev->Ioctl(VIDIOC_QBUF, &videoIn->buf);
     if (ret < 0) {
         LOGE("GrabPreviewFrame: VIDIOC_QBUF Failed");
         return;
@@ -716,10 +875,180 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 
     nQueued++;
 	
-	LOGD("V4L2Camera::GrabRawFrame - Queued buffer");
+	LOGD_FRAME("V4L2Camera::GrabRawFrame - Queued buffer");
 
 }
 
+/* Grab a frame as compressed by the camera, without decoding it. Only valid
+   when isJpegCapture(). Returns the number of bytes copied, or -1 on error */
+int V4L2Camera::GrabJpegFrame (void *jpegBuffer, int maxSize)
+{
+	LOGD("V4L2Camera::GrabJpegFrame: jpegBuffer:%p, len:%d",jpegBuffer,maxSize);
+    int ret;
+	int size = -1;
+	
+	if (!isJpegCapture()) {
+		LOGE("GrabJpegFrame: Camera is not capturing JPEG frames");
+		return -1;
+	}
+
+	/* DQ */
+	memset(&videoIn->buf,0,sizeof(videoIn->buf));
+    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->buf.memory = V4L2_MEMORY_MMAP;
+	ret = dev->Ioctl(VIDIOC_DQBUF, &videoIn->buf);
+    if (ret < 0) {
+        LOGE("GrabJpegFrame: VIDIOC_DQBUF Failed");
+        return -1;
+    }
+
+    nDequeued++;
+	
+	if (videoIn->buf.bytesused <= HEADERFRAME1) {
+		// Prevent crash on empty image
+		LOGE("GrabJpegFrame: Ignoring empty buffer ...");
+	} else if ((int)videoIn->buf.bytesused > maxSize) {
+		LOGE("GrabJpegFrame: Insufficient space in output buffer: Required: %d, Got %d - DROPPING FRAME",videoIn->buf.bytesused,maxSize);
+	} else {
+		memcpy(jpegBuffer, videoIn->mem[videoIn->buf.index], videoIn->buf.bytesused);
+		size = videoIn->buf.bytesused;
+	}
+	
+	/* And Queue the buffer again */
+    ret = dev->Ioctl(VIDIOC_QBUF, &videoIn->buf);
+    if (ret < 0) {
+        LOGE("GrabJpegFrame: VIDIOC_QBUF Failed");
+        return -1;
+    }
+
+    nQueued++;
+	
+	return size;
+}
+
+/* Switch to capture into buffers supplied by the caller (V4L2_MEMORY_USERPTR), 
+   so the camera writes straight into them. Not valid while streaming. Returns 
+   the number of buffers that can be queued, or -1 if the driver does not support
+   it - in that case, the driver allocated buffers are kept in use */
+int V4L2Camera::UseUserPtr (int count)
+{
+	LOGD("V4L2Camera::UseUserPtr: count:%d",count);
+	
+	if (videoIn->isStreaming || videoIn->isUserPtr)
+		return -1;
+		
+	if (count > NB_BUFFER)
+		count = NB_BUFFER;
+	
+	ReleaseMmapBuffers();
+	
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = V4L2_MEMORY_USERPTR;
+    videoIn->rb.count = count;
+    if (dev->Ioctl(VIDIOC_REQBUFS, &videoIn->rb) < 0 || videoIn->rb.count == 0) {
+        LOGI("UseUserPtr: User pointer capture not supported: %s", strerror(errno));
+		
+		// Go back to the driver allocated buffers
+		RequestMmapBuffers();
+        return -1;
+    }
+	
+	videoIn->isUserPtr = true;
+	return (videoIn->rb.count < (unsigned int)count) ? videoIn->rb.count : count;
+}
+
+/* Go back to capturing into driver allocated buffers. Not valid while streaming.
+   The caller gets back ownership of all the buffers it had queued */
+int V4L2Camera::UseMmap ()
+{
+	LOGD("V4L2Camera::UseMmap");
+	
+	if (videoIn->isStreaming)
+		return -1;
+	
+	if (videoIn->isUserPtr) {
+		memset(&videoIn->rb,0,sizeof(videoIn->rb));
+		videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		videoIn->rb.memory = V4L2_MEMORY_USERPTR;
+		videoIn->rb.count = 0;
+		dev->Ioctl(VIDIOC_REQBUFS, &videoIn->rb);
+		
+		for (int i = 0; i < NB_BUFFER; i++)
+			videoIn->mem[i] = NULL;
+		videoIn->isUserPtr = false;
+		nQueued = 0;
+		nDequeued = 0;
+	}
+	
+	return RequestMmapBuffers();
+}
+
+/* Queue a caller supplied buffer to be filled by the camera. Only valid after UseUserPtr() */
+int V4L2Camera::QueueUserPtr (void *frameBuffer, int length)
+{
+	if (!videoIn->isUserPtr)
+		return -1;
+	
+	/* Find a free slot */
+	int i;
+	for (i = 0; i < (int)videoIn->rb.count && videoIn->mem[i] != NULL; i++);
+	if (i >= (int)videoIn->rb.count) {
+		LOGE("QueueUserPtr: No free buffer slots");
+		return -1;
+	}
+	
+	memset(&videoIn->buf,0,sizeof(videoIn->buf));
+	videoIn->buf.index = i;
+    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->buf.memory = V4L2_MEMORY_USERPTR;
+	videoIn->buf.m.userptr = (unsigned long)frameBuffer;
+	videoIn->buf.length = length;
+    if (dev->Ioctl(VIDIOC_QBUF, &videoIn->buf) < 0) {
+        LOGE("QueueUserPtr: VIDIOC_QBUF Failed: %s", strerror(errno));
+        return -1;
+    }
+	
+	videoIn->mem[i] = frameBuffer;
+	videoIn->memLength[i] = length;
+    nQueued++;
+	
+	return 0;
+}
+
+/* Get back a caller supplied buffer, filled by the camera. Returns NULL on errors. 
+   Only valid after UseUserPtr(), and the caller must make sure there is at least 
+   one buffer queued */
+void* V4L2Camera::DequeueUserPtr ()
+{
+	if (!videoIn->isUserPtr)
+		return NULL;
+		
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+	memset(&videoIn->buf,0,sizeof(videoIn->buf));
+    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->buf.memory = V4L2_MEMORY_USERPTR;
+	if (dev->Ioctl(VIDIOC_DQBUF, &videoIn->buf) < 0) {
+        LOGE("DequeueUserPtr: VIDIOC_DQBUF Failed: %s", strerror(errno));
+        return NULL;
+    }
+	
+    nDequeued++;
+	
+	// No conversion at all
+	lastDqTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+	lastDecodeTime = 0;
+	
+	void* frameBuffer = videoIn->mem[videoIn->buf.index];
+	videoIn->mem[videoIn->buf.index] = NULL;
+	
+	if ((int)videoIn->buf.bytesused < videoIn->outFrameSize) {
+		LOGD_FRAME("DequeueUserPtr: Short frame: %d bytes",videoIn->buf.bytesused);
+	}
+	
+	return frameBuffer;
+}
+
 /* enumerate frame intervals (fps)
  * args:
  * pixfmt: v4l2 pixel format that we want to list frame intervals for
@@ -740,7 +1069,7 @@ bool V4L2Camera::EnumFrameIntervals(int pixfmt, int width, int height)
 	fival.height = height;
 	
 	LOGD("\tTime interval between frame: ");
-	while (ioctl(fd,VIDIOC_ENUM_FRAMEINTERVALS, &fival) >=0 ) 
+	while (dev->Ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &fival) >=0 ) 
 	{
 		fival.index++;
 		if (fival.type == V4L2_FRMIVAL_TYPE_DISCRETE) 
@@ -791,7 +1120,7 @@ bool V4L2Camera::EnumFrameSizes(int pixfmt)
 	memset(&fsize, 0, sizeof(fsize));
 	fsize.index = 0;
 	fsize.pixel_format = pixfmt;
-	while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsize) >= 0) 
+	while (dev->Ioctl(VIDIOC_ENUM_FRAMESIZES, &fsize) >= 0) 
 	{
 		fsize.index++;
 		if (fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) 
@@ -861,7 +1190,7 @@ bool V4L2Camera::EnumFrameSizes(int pixfmt)
 			fmt.fmt.pix.pixelformat = pixfmt;
 			fmt.fmt.pix.field = V4L2_FIELD_ANY;
 			
-			if (ioctl(fd,VIDIOC_TRY_FMT, &fmt) >= 0) 
+			if (dev->Ioctl(VIDIOC_TRY_FMT, &fmt) >= 0) 
 			{
 				LOGD("{ ?GSPCA? : width = %u, height = %u }\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
 
@@ -892,7 +1221,7 @@ bool V4L2Camera::EnumFrameFormats()
 	fmt.index = 0;
 	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	while (ioctl(fd,VIDIOC_ENUM_FMT, &fmt) >= 0) 
+	while (dev->Ioctl(VIDIOC_ENUM_FMT, &fmt) >= 0) 
 	{
 		fmt.index++;
 		LOGD("{ pixelformat = '%c%c%c%c', description = '%s' }",
@@ -935,6 +1264,29 @@ bool V4L2Camera::EnumFrameFormats()
 	return true;
 } 
 
+/* Find the control that reports the exposure time, if any */
+void V4L2Camera::QueryExposureControl()
+{
+	static const int ctrls[] = {
+		V4L2_CID_EXPOSURE_ABSOLUTE,
+		V4L2_CID_EXPOSURE
+	};
+	struct v4l2_queryctrl qc;
+	unsigned int i;
+	
+	exposureCtrl = 0;
+	for (i = 0; i < (sizeof(ctrls) / sizeof(ctrls[0])); i++) {
+		memset(&qc, 0, sizeof(qc));
+		qc.id = ctrls[i];
+		if (dev->Ioctl(VIDIOC_QUERYCTRL, &qc) >= 0 && 
+			!(qc.flags & V4L2_CTRL_FLAG_DISABLED)) {
+			LOGD("V4L2Camera::QueryExposureControl: using '%s' [%d..%d]", qc.name, qc.minimum, qc.maximum);
+			exposureCtrl = ctrls[i];
+			break;
+		}
+	}
+}
+
 SortedVector<SurfaceSize> V4L2Camera::getAvailableSizes() const
 {
 	LOGD("V4L2Camera::getAvailableSizes");
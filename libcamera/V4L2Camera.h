@@ -18,6 +18,9 @@ extern "C" {
 #include "uvc_compat.h"
 };
 #include "SurfaceDesc.h"
+#include "FrameStats.h"
+#include "FramePool.h"
+#include "V4L2Device.h"
 
 namespace android {
 
@@ -30,9 +33,11 @@ struct vdIn {
 	struct v4l2_jpegcompression jpegcomp;	// v4l2 jpeg compression settings 
 	
     void *mem[NB_BUFFER];
+    size_t memLength[NB_BUFFER];			// Length of each buffer
     bool isStreaming;
+	bool isUserPtr;							// If capturing into buffers supplied by the caller
 	
-	void* tmpBuffer;
+	FrameBuffer* tmpBuffer;				// Conversion buffer, from the frame pool
 	
 	int outWidth;							// Requested Output width 
 	int outHeight;							// Requested Output height
@@ -51,16 +56,27 @@ public:
     int Open (const char *device);
     void Close ();
 
-    int Init (int width, int height, int fps);
+    int Init (int width, int height, int fps, bool preferJpeg = false);
     void Uninit ();
 
     int StartStreaming ();
     int StopStreaming ();
 
     void GrabRawFrame (void *frameBuffer,int maxSize);
+    int GrabJpegFrame (void *jpegBuffer,int maxSize);
+    
+    int UseUserPtr (int count);
+    int UseMmap ();
+    int QueueUserPtr (void *frameBuffer,int length);
+    void* DequeueUserPtr ();
     
 	void getSize(int& width, int& height) const;
 	int getFps() const;  	
+	bool isJpegCapture() const;
+	int getColorspace() const;
+	bool getExposure(int& exposure) const;
+	bool canCaptureDirect(int width, int height, int stride) const;
+	void getLastFrameTimes(nsecs_t& dqTime, nsecs_t& decodeTime) const;
 	
 	SortedVector<SurfaceSize> getAvailableSizes() const;
 	SortedVector<int> getAvailableFps() const;
@@ -71,15 +87,24 @@ private:
 	bool EnumFrameIntervals(int pixfmt, int width, int height);
 	bool EnumFrameSizes(int pixfmt);
 	bool EnumFrameFormats(); 
+	void QueryExposureControl();
+	int RequestMmapBuffers();
+	void ReleaseMmapBuffers();
 	int saveYUYVtoJPEG(uint8_t* src, uint8_t* dst, int maxsize, int width, int height, int quality);
 	
 private:
     struct vdIn *videoIn;
-    int fd;
+    V4L2Device *dev;							// The device being used
 
     int nQueued;
     int nDequeued;
 	
+	int exposureCtrl;							// Control reporting the exposure, or 0 if none
+	
+	nsecs_t lastDqTime;							// Time spent waiting for the last frame
+	nsecs_t lastDecodeTime;						// Time spent converting it to YUYV
+	
+	char m_EnumDevice[256];						// Device the modes below belong to
 	SortedVector<SurfaceDesc> m_AllFmts;		// Available video modes
 	SurfaceDesc m_BestPreviewFmt;				// Best preview mode. maximum fps with biggest frame
 	SurfaceDesc m_BestPictureFmt;				// Best picture format. maximum size
@@ -0,0 +1,555 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#define LOG_TAG "V4L2Device"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "uvc_compat.h"
+#include "v4l2_formats.h"
+};
+
+#include "V4L2Device.h"
+
+namespace android {
+
+bool V4L2Device::isFake(const char *device)
+{
+	return strncmp(device, FAKE_DEVICE_PREFIX, sizeof(FAKE_DEVICE_PREFIX) - 1) == 0;
+}
+
+V4L2Device* V4L2Device::Create(const char *device)
+{
+	if (isFake(device))
+		return new V4L2FakeDevice();
+	return new V4L2RealDevice();
+}
+
+/****************************************************************************
+ * Real device
+ ***************************************************************************/
+
+int V4L2RealDevice::Open(const char *device)
+{
+	Close();
+	fd = open(device, O_RDWR);
+	return (fd >= 0) ? 0 : -1;
+}
+
+void V4L2RealDevice::Close()
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+}
+
+int V4L2RealDevice::Ioctl(unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+void* V4L2RealDevice::Mmap(size_t length, off_t offset)
+{
+	return mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+}
+
+int V4L2RealDevice::Munmap(void *addr, size_t length)
+{
+	return munmap(addr, length);
+}
+
+/****************************************************************************
+ * Fake device
+ ***************************************************************************/
+
+V4L2FakeDevice::V4L2FakeDevice()
+	: data(NULL), dataSize(0), frameCount(0), frameOffset(NULL), frameLength(NULL), nextFrame(0),
+	  pixelFormat(0), width(0), height(0), bytesPerLine(0), sizeImage(0), fps(0), jitterMs(0),
+	  streaming(false), bufferCount(0), queued(0), sequence(0), frameClock(0), nextDue(0)
+{
+	memset(buffers, 0, sizeof(buffers));
+}
+
+int V4L2FakeDevice::Open(const char *device)
+{
+	Close();
+	
+	char path[256];
+	char fcc[5] = {0};
+	int w = 0, h = 0, rate = 0, jitter = 0;
+	int n = sscanf(device + sizeof(FAKE_DEVICE_PREFIX) - 1, "%255[^,],%4c,%dx%d,%d,%d", 
+				path, fcc, &w, &h, &rate, &jitter);
+	if (n < 5 || w <= 0 || h <= 0 || rate <= 0 || jitter < 0) {
+		LOGE("Invalid fake device: %s", device);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	pixelFormat = v4l2_fourcc(fcc[0], fcc[1], fcc[2], fcc[3]);
+	width = w;
+	height = h;
+	fps = rate;
+	jitterMs = jitter;
+	if (!setupFormat()) {
+		LOGE("Fake device: Unsupported pixel format '%s'", fcc);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	/* Load the recorded frames */
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		LOGE("Fake device: Unable to open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (size > 0) {
+		data = (uint8_t*)malloc(size);
+	}
+	if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+		LOGE("Fake device: Unable to read %s", path);
+		fclose(f);
+		Close();
+		errno = EIO;
+		return -1;
+	}
+	fclose(f);
+	dataSize = size;
+	
+	if (!indexFrames()) {
+		LOGE("Fake device: No usable frames in %s", path);
+		Close();
+		errno = EINVAL;
+		return -1;
+	}
+	
+	LOGI("Fake device: %d frames of %dx%d '%s' at %d fps, jitter %d ms",
+		frameCount, width, height, fcc, fps, jitterMs);
+	return 0;
+}
+
+void V4L2FakeDevice::Close()
+{
+	freeBuffers();
+	streaming = false;
+	
+	free(frameOffset);
+	frameOffset = NULL;
+	free(frameLength);
+	frameLength = NULL;
+	frameCount = 0;
+	nextFrame = 0;
+	
+	free(data);
+	data = NULL;
+	dataSize = 0;
+}
+
+/* Calculate the layout of the frames, as a driver would report it */
+bool V4L2FakeDevice::setupFormat()
+{
+	switch (pixelFormat) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_YYUV:
+		case V4L2_PIX_FMT_Y16:
+			bytesPerLine = width << 1;
+			sizeImage = bytesPerLine * height;
+			break;
+			
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			bytesPerLine = width * 3;
+			sizeImage = bytesPerLine * height;
+			break;
+			
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_SGBRG8:
+		case V4L2_PIX_FMT_SGRBG8:
+		case V4L2_PIX_FMT_SBGGR8:
+		case V4L2_PIX_FMT_SRGGB8:
+			bytesPerLine = width;
+			sizeImage = bytesPerLine * height;
+			break;
+			
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_SPCA501:
+		case V4L2_PIX_FMT_SPCA505:
+		case V4L2_PIX_FMT_SPCA508:
+			bytesPerLine = width;
+			sizeImage = (width * height * 3) >> 1;
+			break;
+			
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV61:
+			bytesPerLine = width;
+			sizeImage = (width * height) << 1;
+			break;
+			
+		case V4L2_PIX_FMT_Y41P:
+			bytesPerLine = (width * 12) >> 3;
+			sizeImage = bytesPerLine * height;
+			break;
+			
+		case V4L2_PIX_FMT_MJPEG:
+		case V4L2_PIX_FMT_JPEG:
+			/* Compressed: no line length, and frames of any size up to this */
+			bytesPerLine = 0;
+			sizeImage = (width * height) << 1;
+			break;
+			
+		default:
+			return false;
+	}
+	return true;
+}
+
+/* Returns the offset just past the EOI of the JPEG image starting at pos, or 0 
+   if it is truncated or corrupt */
+static size_t findJpegEnd(const uint8_t* p, size_t pos, size_t size)
+{
+	pos += 2; // SOI
+	while (pos + 1 < size) {
+		if (p[pos] != 0xFF)
+			return 0;
+			
+		uint8_t marker = p[pos + 1];
+		if (marker == 0xD9) 				// EOI
+			return pos + 2;
+		if (marker == 0xFF) {				// Fill byte
+			pos++;
+			continue;
+		}
+		if (pos + 3 >= size)
+			return 0;
+		pos += 2 + ((p[pos + 2] << 8) | p[pos + 3]);
+		if (marker != 0xDA)
+			continue;
+			
+		/* Skip the entropy coded data of the scan. Stuffed zeros and 
+		   restart markers are part of it */
+		while (pos + 1 < size && 
+			   !(p[pos] == 0xFF && p[pos + 1] != 0x00 && (p[pos + 1] < 0xD0 || p[pos + 1] > 0xD7)))
+			pos++;
+	}
+	return 0;
+}
+
+/* Find where each recorded frame is */
+bool V4L2FakeDevice::indexFrames()
+{
+	bool compressed = pixelFormat == V4L2_PIX_FMT_MJPEG || pixelFormat == V4L2_PIX_FMT_JPEG;
+	int capacity = compressed ? 16 : (int)(dataSize / sizeImage);
+	if (capacity <= 0)
+		return false;
+		
+	frameOffset = (size_t*)malloc(capacity * sizeof(size_t));
+	frameLength = (size_t*)malloc(capacity * sizeof(size_t));
+	if (frameOffset == NULL || frameLength == NULL) 
+		return false;
+	
+	if (!compressed) {
+		for (frameCount = 0; frameCount < capacity; frameCount++) {
+			frameOffset[frameCount] = frameCount * sizeImage;
+			frameLength[frameCount] = sizeImage;
+		}
+		return true;
+	}
+	
+	/* Split the file into JPEG images */
+	size_t pos = 0;
+	while (pos + 1 < dataSize) {
+		if (data[pos] != 0xFF || data[pos + 1] != 0xD8) {
+			pos++;
+			continue;
+		}
+		
+		size_t end = findJpegEnd(data, pos, dataSize);
+		if (end == 0)
+			break;
+			
+		if (end - pos > (size_t)sizeImage) {
+			LOGD("Fake device: Skipping image too big for the capture buffers at %u", (unsigned int)pos);
+		} else {
+			if (frameCount == capacity) {
+				capacity <<= 1;
+				frameOffset = (size_t*)realloc(frameOffset, capacity * sizeof(size_t));
+				frameLength = (size_t*)realloc(frameLength, capacity * sizeof(size_t));
+				if (frameOffset == NULL || frameLength == NULL)
+					return false;
+			}
+			frameOffset[frameCount] = pos;
+			frameLength[frameCount] = end - pos;
+			frameCount++;
+		}
+		pos = end;
+	}
+	
+	return frameCount > 0;
+}
+
+void V4L2FakeDevice::freeBuffers()
+{
+	for (int i = 0; i < bufferCount; i++) {
+		free(buffers[i]);
+		buffers[i] = NULL;
+	}
+	bufferCount = 0;
+	queued = 0;
+}
+
+void V4L2FakeDevice::fillFormat(struct v4l2_format* fmt) const
+{
+	memset(&fmt->fmt.pix, 0, sizeof(fmt->fmt.pix));
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+	fmt->fmt.pix.pixelformat = pixelFormat;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = bytesPerLine;
+	fmt->fmt.pix.sizeimage = sizeImage;
+	fmt->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+}
+
+/* Deliver the next recorded frame, waiting until it is due */
+int V4L2FakeDevice::dequeue(struct v4l2_buffer* buf)
+{
+	if (!streaming || queued == 0 || buf->memory != V4L2_MEMORY_MMAP) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	nsecs_t interval = seconds_to_nanoseconds(1) / fps;
+	nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+	if (nextDue > now) {
+		usleep(ns2us(nextDue - now));
+		now = systemTime(SYSTEM_TIME_MONOTONIC);
+	} else if (now - frameClock >= interval) {
+	
+		/* The consumer is late: A real camera would have dropped the 
+		   frames there were no buffers for */
+		int missed = (int)((now - frameClock) / interval);
+		sequence += missed;
+		nextFrame = (nextFrame + missed) % frameCount;
+		frameClock += missed * interval;
+	}
+	
+	/* Take the oldest queued buffer */
+	int index = queue[0];
+	queued--;
+	memmove(queue, queue + 1, queued * sizeof(queue[0]));
+	
+	size_t length = frameLength[nextFrame];
+	memcpy(buffers[index], data + frameOffset[nextFrame], length);
+	nextFrame = (nextFrame + 1) % frameCount;
+	
+	memset(buf, 0, sizeof(*buf));
+	buf->index = index;
+	buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory = V4L2_MEMORY_MMAP;
+	buf->m.offset = index * sizeImage;
+	buf->length = sizeImage;
+	buf->bytesused = length;
+	buf->field = V4L2_FIELD_NONE;
+	buf->flags = V4L2_BUF_FLAG_MAPPED;
+	buf->sequence = sequence++;
+	buf->timestamp.tv_sec = now / seconds_to_nanoseconds(1);
+	buf->timestamp.tv_usec = ns2us(now % seconds_to_nanoseconds(1));
+	
+	/* Schedule the next frame, off its ideal time by up to the jitter */
+	frameClock += interval;
+	nextDue = frameClock;
+	if (jitterMs > 0) {
+		nextDue += ms2ns((rand() % (2 * jitterMs + 1)) - jitterMs);
+	}
+	
+	return 0;
+}
+
+int V4L2FakeDevice::Ioctl(unsigned long request, void *arg)
+{
+	switch (request) {
+		case VIDIOC_QUERYCAP: {
+			struct v4l2_capability* cap = (struct v4l2_capability*)arg;
+			memset(cap, 0, sizeof(*cap));
+			strcpy((char*)cap->driver, "fake");
+			strcpy((char*)cap->card, "Fake camera");
+			strcpy((char*)cap->bus_info, "file");
+			cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FMT: {
+			struct v4l2_fmtdesc* desc = (struct v4l2_fmtdesc*)arg;
+			if (desc->index != 0 || desc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				break;
+			desc->flags = (bytesPerLine == 0) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+			desc->pixelformat = pixelFormat;
+			strcpy((char*)desc->description, "Recorded frames");
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FRAMESIZES: {
+			struct v4l2_frmsizeenum* fsize = (struct v4l2_frmsizeenum*)arg;
+			if (fsize->index != 0 || fsize->pixel_format != pixelFormat) 
+				break;
+			fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+			fsize->discrete.width = width;
+			fsize->discrete.height = height;
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FRAMEINTERVALS: {
+			struct v4l2_frmivalenum* fival = (struct v4l2_frmivalenum*)arg;
+			if (fival->index != 0 || fival->pixel_format != pixelFormat ||
+				fival->width != (unsigned int)width || fival->height != (unsigned int)height) 
+				break;
+			fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+			fival->discrete.numerator = 1;
+			fival->discrete.denominator = fps;
+			return 0;
+		}
+		
+		/* Only one format: Adjust whatever is asked to it, as drivers do */
+		case VIDIOC_TRY_FMT:
+		case VIDIOC_S_FMT:
+		case VIDIOC_G_FMT: {
+			struct v4l2_format* fmt = (struct v4l2_format*)arg;
+			if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				break;
+			if (request == VIDIOC_S_FMT && bufferCount > 0) {
+				errno = EBUSY;
+				return -1;
+			}
+			fillFormat(fmt);
+			return 0;
+		}
+		
+		case VIDIOC_S_PARM:
+		case VIDIOC_G_PARM: {
+			struct v4l2_streamparm* parm = (struct v4l2_streamparm*)arg;
+			if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				break;
+			memset(&parm->parm.capture, 0, sizeof(parm->parm.capture));
+			parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+			parm->parm.capture.timeperframe.numerator = 1;
+			parm->parm.capture.timeperframe.denominator = fps;
+			return 0;
+		}
+		
+		/* Only driver allocated buffers are supported */
+		case VIDIOC_REQBUFS: {
+			struct v4l2_requestbuffers* rb = (struct v4l2_requestbuffers*)arg;
+			if (rb->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || rb->memory != V4L2_MEMORY_MMAP)
+				break;
+			if (streaming) {
+				errno = EBUSY;
+				return -1;
+			}
+			freeBuffers();
+			
+			int count = (rb->count > FAKE_DEVICE_BUFFERS) ? FAKE_DEVICE_BUFFERS : rb->count;
+			for (bufferCount = 0; bufferCount < count; bufferCount++) {
+				buffers[bufferCount] = (uint8_t*)calloc(1, sizeImage);
+				if (buffers[bufferCount] == NULL) 
+					break;
+			}
+			rb->count = bufferCount;
+			return 0;
+		}
+		
+		case VIDIOC_QUERYBUF: 
+		case VIDIOC_QBUF: {
+			struct v4l2_buffer* buf = (struct v4l2_buffer*)arg;
+			if (buf->index >= (unsigned int)bufferCount || buf->memory != V4L2_MEMORY_MMAP)
+				break;
+				
+			int i;
+			for (i = 0; i < queued && queue[i] != (int)buf->index; i++);
+			bool isQueued = i < queued;
+			
+			if (request == VIDIOC_QBUF) {
+				if (isQueued) 
+					break;
+				queue[queued++] = buf->index;
+				isQueued = true;
+			}
+			
+			buf->m.offset = buf->index * sizeImage;
+			buf->length = sizeImage;
+			buf->flags = V4L2_BUF_FLAG_MAPPED | (isQueued ? V4L2_BUF_FLAG_QUEUED : 0);
+			return 0;
+		}
+		
+		case VIDIOC_DQBUF:
+			return dequeue((struct v4l2_buffer*)arg);
+			
+		case VIDIOC_STREAMON:
+			if (bufferCount == 0)
+				break;
+			if (!streaming) {
+				streaming = true;
+				sequence = 0;
+				frameClock = systemTime(SYSTEM_TIME_MONOTONIC) + seconds_to_nanoseconds(1) / fps;
+				nextDue = frameClock;
+			}
+			return 0;
+			
+		case VIDIOC_STREAMOFF:
+			/* All the buffers are given back */
+			streaming = false;
+			queued = 0;
+			return 0;
+	}
+	
+	/* Anything else (controls, compression settings, ...) is not supported */
+	errno = EINVAL;
+	return -1;
+}
+
+void* V4L2FakeDevice::Mmap(size_t length, off_t offset)
+{
+	int index = (sizeImage > 0) ? (int)(offset / sizeImage) : -1;
+	if (index < 0 || index >= bufferCount || length > (size_t)sizeImage) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return buffers[index];
+}
+
+int V4L2FakeDevice::Munmap(void *addr, size_t length)
+{
+	/* The buffers are freed along with the device */
+	return 0;
+}
+
+}; // namespace android
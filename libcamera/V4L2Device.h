@@ -0,0 +1,130 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+#ifndef V4L2DEVICE_H
+#define V4L2DEVICE_H
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+#include "uvc_compat.h"
+};
+#include <utils/Timers.h>
+
+/* Prefix of the device names that select a fake device replaying a file:
+	fake:<file>,<fourcc>,<width>x<height>,<fps>[,<jitter in ms>]
+   Raw formats are read as consecutive frames of the size the format implies.
+   MJPEG/JPEG files are read as consecutive JPEG images.
+   On the device, such a name is given in the debug.camera.device property.
+   host/ builds V4L2Camera on a Linux box to drive it with the recordings in
+   host/fixtures, with no camera and no Android */
+#define FAKE_DEVICE_PREFIX	"fake:"
+
+#define FAKE_DEVICE_BUFFERS	8
+
+namespace android {
+
+/* Access to a V4L2 capture device. V4L2Camera only talks to the device
+   through this interface, so a fake device can be used instead of a real one */
+class V4L2Device {
+public:
+	virtual ~V4L2Device() {}
+	
+	virtual int Open(const char *device) = 0;
+	virtual void Close() = 0;
+	virtual bool isOpen() const = 0;
+	
+	/* Same semantics as the system calls: -1 and errno set on errors */
+	virtual int Ioctl(unsigned long request, void *arg) = 0;
+	virtual void* Mmap(size_t length, off_t offset) = 0;
+	virtual int Munmap(void *addr, size_t length) = 0;
+	
+	/* Creates the right kind of device for the given device name */
+	static V4L2Device* Create(const char *device);
+	static bool isFake(const char *device);
+};
+
+/* A real V4L2 device node */
+class V4L2RealDevice : public V4L2Device {
+public:
+	V4L2RealDevice() : fd(-1) {}
+	virtual ~V4L2RealDevice() { Close(); }
+	
+	virtual int Open(const char *device);
+	virtual void Close();
+	virtual bool isOpen() const { return fd >= 0; }
+	
+	virtual int Ioctl(unsigned long request, void *arg);
+	virtual void* Mmap(size_t length, off_t offset);
+	virtual int Munmap(void *addr, size_t length);
+	
+private:
+	int fd;
+};
+
+/* A fake device, replaying recorded frames at a given rate with some jitter */
+class V4L2FakeDevice : public V4L2Device {
+public:
+	V4L2FakeDevice();
+	virtual ~V4L2FakeDevice() { Close(); }
+	
+	virtual int Open(const char *device);
+	virtual void Close();
+	virtual bool isOpen() const { return data != NULL; }
+	
+	virtual int Ioctl(unsigned long request, void *arg);
+	virtual void* Mmap(size_t length, off_t offset);
+	virtual int Munmap(void *addr, size_t length);
+	
+private:
+	bool setupFormat();
+	bool indexFrames();
+	void freeBuffers();
+	int dequeue(struct v4l2_buffer* buf);
+	void fillFormat(struct v4l2_format* fmt) const;
+	
+	uint8_t* data;						// The whole recorded file
+	size_t dataSize;
+	
+	int frameCount;						// Frames in it
+	size_t* frameOffset;				// Start of each frame
+	size_t* frameLength;				// And its length
+	int nextFrame;						// Next frame to deliver
+	
+	uint32_t pixelFormat;				// Format of the recorded frames
+	int width;
+	int height;
+	int bytesPerLine;
+	int sizeImage;						// Size of the capture buffers
+	int fps;
+	int jitterMs;						// Maximum deviation of each frame from its due time
+	
+	bool streaming;
+	int bufferCount;					// Allocated capture buffers
+	uint8_t* buffers[FAKE_DEVICE_BUFFERS];
+	int queue[FAKE_DEVICE_BUFFERS];		// Queued buffers, in order
+	int queued;
+	uint32_t sequence;
+	nsecs_t frameClock;					// When the next frame would be due without jitter
+	nsecs_t nextDue;					// When it is really due
+};
+
+}; // namespace android
+
+#endif
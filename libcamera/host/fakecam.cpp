@@ -0,0 +1,143 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* Host driver for V4L2Camera on a fake device. It does what the preview thread
+   does with each frame, grabbing it and converting it to YV12 for the preview
+   window, and reports how long each stage took. It fails if the frames could
+   not be grabbed, or if they are not the recorded ones */
+
+#define LOG_TAG "fakecam"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "V4L2Camera.h"
+#include "Converter.h"
+
+using namespace android;
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: fakecam <fake device> <width> <height> <fps> [frames]\n"
+		"  <fake device> is " FAKE_DEVICE_PREFIX "<file>,<fourcc>,<width>x<height>,<fps>[,<jitter in ms>]\n");
+}
+
+static uint32_t checksum(const uint8_t* data, int size)
+{
+	uint32_t sum = 0;
+	for (int i = 0; i < size; i++)
+		sum = (sum << 1 | sum >> 31) ^ data[i];
+	return sum;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 5) {
+		usage();
+		return 2;
+	}
+
+	const char* device = argv[1];
+	int width = atoi(argv[2]);
+	int height = atoi(argv[3]);
+	int fps = atoi(argv[4]);
+	int frames = (argc > 5) ? atoi(argv[5]) : 30;
+
+	V4L2Camera camera;
+	if (camera.Open(device) < 0) {
+		fprintf(stderr, "Unable to open %s\n", device);
+		return 1;
+	}
+	nsecs_t initStart = systemTime(SYSTEM_TIME_MONOTONIC);
+	if (camera.Init(width, height, fps) < 0) {
+		fprintf(stderr, "Unable to init %s at %dx%d %d fps\n", device, width, height, fps);
+		camera.Close();
+		return 1;
+	}
+	nsecs_t initTime = systemTime(SYSTEM_TIME_MONOTONIC) - initStart;
+
+	int w, h;
+	camera.getSize(w, h);
+	int rawSize = (w * h) << 1;
+	int stride = (w + 15) & (-16);
+	int yv12Size = stride * h + (((stride >> 1) + 15) & (-16)) * h;
+	uint8_t* raw = (uint8_t*) malloc(rawSize);
+	uint8_t* yv12 = (uint8_t*) malloc(yv12Size);
+
+	LatencyHistogram dqStats, decodeStats, displayStats, frameStats;
+	FpsCounter fpsCounter;
+	uint32_t* sums = (uint32_t*) calloc(frames, sizeof(uint32_t));
+	int failures = 0;
+
+	camera.StartStreaming();
+	fpsCounter.reset(systemTime(SYSTEM_TIME_MONOTONIC));
+	for (int i = 0; i < frames; i++) {
+		nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+		memset(raw, 0, rawSize);
+		camera.GrabRawFrame(raw, rawSize);
+
+		nsecs_t dqTime, decodeTime;
+		camera.getLastFrameTimes(dqTime, decodeTime);
+
+		nsecs_t displayStart = systemTime(SYSTEM_TIME_MONOTONIC);
+		yuyv_to_yvu420p(yv12, stride, h, raw, w << 1, w, h);
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+		dqStats.add(dqTime);
+		decodeStats.add(decodeTime);
+		displayStats.add(now - displayStart);
+		frameStats.add(now - start);
+		fpsCounter.tick(now);
+
+		// A blank frame means it could not be grabbed or decoded
+		sums[i] = checksum(raw, rawSize);
+		if (sums[i] == 0)
+			failures++;
+	}
+	nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+	camera.StopStreaming();
+	camera.Uninit();
+	camera.Close();
+
+	// The recording is replayed in a loop: Consecutive frames must differ
+	int repeated = 0;
+	for (int i = 1; i < frames; i++) {
+		if (sums[i] == sums[i - 1])
+			repeated++;
+	}
+
+	String8 result;
+	result.appendFormat("%s: %dx%d, %s, init %.2fms\n", device, w, h,
+		camera.isJpegCapture() ? "jpeg" : "raw", initTime / 1000000.0);
+	dqStats.dump(result, "dqbuf");
+	decodeStats.dump(result, "decode");
+	displayStats.dump(result, "display");
+	frameStats.dump(result, "frame");
+	fpsCounter.dump(result, "preview", end);
+	result.appendFormat("    %d blank frames, %d repeated frames\n", failures, repeated);
+	fputs(result.string(), stdout);
+
+	free(sums);
+	free(yv12);
+	free(raw);
+	return (failures || repeated) ? 1 : 0;
+}
@@ -0,0 +1 @@
+/* Not needed on the host */
@@ -0,0 +1,25 @@
+/* Host stand-in for the Android log macros: Everything goes to stderr */
+#ifndef HOST_UTILS_LOG_H
+#define HOST_UTILS_LOG_H
+
+#include <stdio.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG NULL
+#endif
+
+#define HOST_LOG(prio, ...) \
+	do { fprintf(stderr, "%s/%s: ", prio, LOG_TAG); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } while (0)
+
+#ifdef HOST_VERBOSE
+#define LOGV(...)	HOST_LOG("V", __VA_ARGS__)
+#define LOGD(...)	HOST_LOG("D", __VA_ARGS__)
+#else
+#define LOGV(...)	((void)0)
+#define LOGD(...)	((void)0)
+#endif
+#define LOGI(...)	HOST_LOG("I", __VA_ARGS__)
+#define LOGW(...)	HOST_LOG("W", __VA_ARGS__)
+#define LOGE(...)	HOST_LOG("E", __VA_ARGS__)
+
+#endif
@@ -0,0 +1,52 @@
+/* Host stand-in for the Android SortedVector: A sorted set, using the
+   compare_type of its items */
+#ifndef HOST_UTILS_SORTEDVECTOR_H
+#define HOST_UTILS_SORTEDVECTOR_H
+
+#include <sys/types.h>
+#include <vector>
+
+namespace android {
+
+template<typename T> inline int compare_type(const T& lhs, const T& rhs)
+{
+	return (lhs < rhs) ? -1 : ((rhs < lhs) ? 1 : 0);
+}
+
+template<class T> class SortedVector {
+public:
+	size_t size() const { return mItems.size(); }
+	bool isEmpty() const { return mItems.empty(); }
+	void clear() { mItems.clear(); }
+	
+	const T& operator[](size_t index) const { return mItems[index]; }
+	const T& itemAt(size_t index) const { return mItems[index]; }
+	const T& top() const { return mItems.back(); }
+	
+	/* Adds the item, or replaces the one comparing equal. Returns its index */
+	ssize_t add(const T& item) {
+		size_t i = 0;
+		while (i < mItems.size() && compare_type(mItems[i], item) < 0)
+			i++;
+		if (i < mItems.size() && compare_type(mItems[i], item) == 0)
+			mItems[i] = item;
+		else
+			mItems.insert(mItems.begin() + i, item);
+		return i;
+	}
+	
+	ssize_t indexOf(const T& item) const {
+		for (size_t i = 0; i < mItems.size(); i++) {
+			if (compare_type(mItems[i], item) == 0)
+				return i;
+		}
+		return -1;
+	}
+	
+private:
+	std::vector<T> mItems;
+};
+
+};
+
+#endif
@@ -0,0 +1,32 @@
+/* Host stand-in for the Android String8, only what the dumps use */
+#ifndef HOST_UTILS_STRING8_H
+#define HOST_UTILS_STRING8_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+namespace android {
+
+class String8 {
+public:
+	const char* string() const { return mString.c_str(); }
+	size_t length() const { return mString.length(); }
+	
+	void append(const char* s) { mString += s; }
+	void appendFormat(const char* fmt, ...) {
+		char buf[1024];
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+		mString += buf;
+	}
+	
+private:
+	std::string mString;
+};
+
+};
+
+#endif
@@ -0,0 +1,34 @@
+/* Host stand-in for the Android time helpers */
+#ifndef HOST_UTILS_TIMERS_H
+#define HOST_UTILS_TIMERS_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int64_t nsecs_t;
+
+enum {
+	SYSTEM_TIME_REALTIME = 0,
+	SYSTEM_TIME_MONOTONIC = 1
+};
+
+static inline nsecs_t systemTime(int clock = SYSTEM_TIME_MONOTONIC)
+{
+	struct timespec t;
+	clock_gettime(clock == SYSTEM_TIME_REALTIME ? CLOCK_REALTIME : CLOCK_MONOTONIC, &t);
+	return (nsecs_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static inline nsecs_t seconds_to_nanoseconds(nsecs_t secs) { return secs * 1000000000; }
+static inline nsecs_t milliseconds_to_nanoseconds(nsecs_t ms) { return ms * 1000000; }
+static inline nsecs_t microseconds_to_nanoseconds(nsecs_t us) { return us * 1000; }
+static inline nsecs_t nanoseconds_to_microseconds(nsecs_t ns) { return ns / 1000; }
+static inline nsecs_t nanoseconds_to_milliseconds(nsecs_t ns) { return ns / 1000000; }
+
+static inline nsecs_t s2ns(nsecs_t v)  { return seconds_to_nanoseconds(v); }
+static inline nsecs_t ms2ns(nsecs_t v) { return milliseconds_to_nanoseconds(v); }
+static inline nsecs_t us2ns(nsecs_t v) { return microseconds_to_nanoseconds(v); }
+static inline nsecs_t ns2us(nsecs_t v) { return nanoseconds_to_microseconds(v); }
+static inline nsecs_t ns2ms(nsecs_t v) { return nanoseconds_to_milliseconds(v); }
+
+#endif
@@ -0,0 +1,33 @@
+/* Host stand-in for the Android Mutex, on top of pthreads */
+#ifndef HOST_UTILS_THREADS_H
+#define HOST_UTILS_THREADS_H
+
+#include <pthread.h>
+
+namespace android {
+
+class Mutex {
+public:
+	Mutex() { pthread_mutex_init(&mMutex, NULL); }
+	~Mutex() { pthread_mutex_destroy(&mMutex); }
+	int lock() { return -pthread_mutex_lock(&mMutex); }
+	void unlock() { pthread_mutex_unlock(&mMutex); }
+	
+	class Autolock {
+	public:
+		Autolock(Mutex& mutex) : mLock(mutex) { mLock.lock(); }
+		Autolock(Mutex* mutex) : mLock(*mutex) { mLock.lock(); }
+		~Autolock() { mLock.unlock(); }
+	private:
+		Mutex& mLock;
+	};
+	
+private:
+	Mutex(const Mutex&);
+	Mutex& operator=(const Mutex&);
+	pthread_mutex_t mMutex;
+};
+
+};
+
+#endif